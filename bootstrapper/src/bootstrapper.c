@@ -14,6 +14,7 @@ typedef void (*script_on_update_func)(f64 ts);
 typedef void (*script_on_deinit_func)();
 
 typedef void (*script_on_reload_func)(void*);
+typedef void (*script_on_pre_reload_func)();
 typedef u64 (*script_get_storage_size_func)();
 
 struct script_context {
@@ -27,6 +28,7 @@ struct script_context {
 	script_on_deinit_func on_deinit;
 
 	script_on_reload_func on_reload;
+	script_on_pre_reload_func on_pre_reload;
 	script_get_storage_size_func get_storage_size;
 
 	void* instance;
@@ -47,6 +49,10 @@ static void open_funcs(struct script_context* ctx) {
 		fprintf(stderr, "Failed to locate function `on_reload'.\n");
 	}
 
+	/* Optional; Called just before the assembly is unloaded, so that
+	 * it can finish anything that is still running its code. */
+	ctx->on_pre_reload = (script_on_pre_reload_func)dynlib_get_sym(ctx->handle, "on_pre_reload");
+
 	ctx->get_storage_size = (script_get_storage_size_func)dynlib_get_sym(ctx->handle, "get_storage_size");
 	if (!ctx->get_storage_size) {
 		fprintf(stderr, "Failed to locate function `get_storage_size'.\n");
@@ -167,6 +173,10 @@ void script_context_update(struct script_context* ctx, f64 ts) {
 		if (mtime > ctx->lib_mod_time) {
 			ctx->lib_mod_time = mtime;
 
+			if (ctx->on_pre_reload) {
+				ctx->on_pre_reload();
+			}
+
 			if (ctx->handle) {
 				close_dynlib(ctx->handle);
 			}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #include "audio.h"
@@ -8,7 +9,13 @@
 #include "res.h"
 #include "video.h"
 
-i32 main() {
+/* The most time to spend each frame uploading resources that
+ * were loaded in the background, in seconds. */
+#define res_upload_budget 0.002
+
+/* Running with `--trace' records the order that resources are read
+ * in to res_trace_path, for the packer to lay the package out by. */
+i32 main(i32 argc, char** argv) {
 	srand((u32)time(null));
 
 	init_time();
@@ -26,18 +33,20 @@ i32 main() {
 	audio_init();
 	res_init();
 
+	for (i32 i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--trace") == 0) {
+			res_trace_begin(res_trace_path);
+		}
+	}
+
 	init_time();
 
 	/* Loading screen */
 	{
 		struct shader sprite_shader = load_shader("res/shaders/sprite.glsl");
-		struct renderer* renderer = new_renderer(sprite_shader, make_v2i(1366, 768));
-
-		u8* raw;
-		u64 raw_size;
-		read_raw("res/CourierPrime.ttf", &raw, &raw_size, false);
+		struct renderer* renderer = new_renderer(sprite_shader, make_v2i(1366, 768), 64);
 
-		struct font* font = load_font_from_memory(raw, raw_size, 20.0f);
+		struct font* font = load_font("res/CourierPrime.ttf", 20.0f);
 
 		struct textured_quad quad = {
 			.texture = null,
@@ -61,7 +70,7 @@ i32 main() {
 		swap_window(main_window);
 
 		free_renderer(renderer);
-		free_font(font);
+		res_release_font(font);
 	}
 
 	scripts_allocate_storage(scripts);
@@ -73,6 +82,8 @@ i32 main() {
 	while (!window_should_close(main_window)) {
 		update_events(main_window);
 
+		res_update(res_upload_budget);
+
 		video_clear();
 
 		script_context_update(scripts, timestep);
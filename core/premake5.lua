@@ -25,12 +25,18 @@ project "core"
 		"src/entity.h",
 		"src/imui.c",
 		"src/imui.h",
+		"src/jobs.c",
+		"src/jobs.h",
 		"src/keytable.c",
 		"src/keytable.h",
 		"src/lsp.c",
 		"src/lsp.h",
+		"src/lz.c",
+		"src/lz.h",
 		"src/maths.c",
 		"src/maths.h",
+		"src/pack.c",
+		"src/pack.h",
 		"src/physics.c",
 		"src/physics.h",
 		"src/platform.c",
@@ -3,6 +3,7 @@
 #include <string.h>
 
 #include "core.h"
+#include "platform.h"
 #include "vector.h"
 
 u64 elf_hash(const u8* data, u32 size) {
@@ -19,6 +20,17 @@ u64 elf_hash(const u8* data, u32 size) {
 	return (hash & 0x7FFFFFFFFF);
 }
 
+u64 fnv1a_hash(const u8* data, u64 size) {
+	u64 hash = 0xcbf29ce484222325;
+
+	for (u64 i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001b3;
+	}
+
+	return hash;
+}
+
 u32 str_id(const char* str) {
 	u32 r = 0;
 	
@@ -42,7 +54,9 @@ char* copy_string(const char* src) {
 }
 
 #ifdef DEBUG
-u64 memory_usage = 0;
+/* Resources are loaded on worker threads, so this is only ever
+ * updated atomically. */
+i64 memory_usage = 0;
 
 void* core_alloc(u64 size) {
 	u8* ptr = malloc(sizeof(u64) + size);
@@ -54,7 +68,7 @@ void* core_alloc(u64 size) {
 
 	memcpy(ptr, &size, sizeof(u64));
 
-	memory_usage += size;
+	atomic_add(&memory_usage, (i64)size);
 
 	return ptr + sizeof(u64);
 }
@@ -73,7 +87,7 @@ void* core_calloc(u64 count, u64 size) {
 
 	memcpy(ptr, &alloc_size, sizeof(u64));
 
-	memory_usage += size;
+	atomic_add(&memory_usage, (i64)alloc_size);
 
 	return ptr + sizeof(u64);
 }
@@ -83,7 +97,7 @@ void* core_realloc(void* p, u64 size) {
 
 	if (ptr) {
 		u64* old_size = (u64*)(ptr - sizeof(u64));
-		memory_usage -= *old_size;
+		atomic_add(&memory_usage, -(i64)*old_size);
 	}
 
 	u8* new_ptr = realloc(ptr ? ptr - sizeof(u64) : null, sizeof(u64) + size);
@@ -95,7 +109,7 @@ void* core_realloc(void* p, u64 size) {
 
 	memcpy(new_ptr, &size, sizeof(u64));
 
-	memory_usage += size;
+	atomic_add(&memory_usage, (i64)size);
 
 	return new_ptr + sizeof(u64);
 }
@@ -106,13 +120,13 @@ void core_free(void* p) {
 	u8* ptr = p;
 
 	u64* old_size = (u64*)(ptr - sizeof(u64));
-	memory_usage -= *old_size;
+	atomic_add(&memory_usage, -(i64)*old_size);
 
 	free(old_size);
 }
 
 u64 core_get_memory_usage() {
-	return memory_usage;
+	return (u64)atomic_add(&memory_usage, 0);
 }
 #else
 void* core_alloc(u64 size) {
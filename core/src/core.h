@@ -15,6 +15,10 @@ API extern struct window* main_window;
 /* Return the hash of a string using the ELF hash algorithm*/
 API u64 elf_hash(const u8* data, u32 size);
 
+/* Return the 64-bit FNV-1a hash of some data. Unlike elf_hash, this
+ * uses the full 64 bits, so it is used where collisions matter. */
+API u64 fnv1a_hash(const u8* data, u64 size);
+
 /* Sum up all the characters in a string, creating an ID for
  * that string. Not to be used in place of a hash function. */
 API u32 str_id(const char* str);
@@ -115,7 +115,8 @@ static i32 pool_sparse_idx(struct pool* pool, entity e) {
 	return pool->sparse[get_entity_id(e)];
 }
 
-static void* pool_add(struct pool* pool, entity e, void* init) {
+/* Adds a component without calling the pool's create function. */
+static void* pool_insert(struct pool* pool, entity e, void* init) {
 	if (pool->count >= pool->capacity) {
 		u32 capacity = pool->capacity < 8 ? 8 : pool->capacity * 2;
 		void* new_allocation = core_alloc(capacity * pool->type.size);
@@ -177,6 +178,12 @@ static void* pool_add(struct pool* pool, entity e, void* init) {
 
 	memcpy(ptr, init, pool->type.size);
 
+	return ptr;
+}
+
+static void* pool_add(struct pool* pool, entity e, void* init) {
+	void* ptr = pool_insert(pool, e, init);
+
 	if (pool->on_create) {
 		pool->on_create(pool->world, e, ptr);
 	}
@@ -184,14 +191,10 @@ static void* pool_add(struct pool* pool, entity e, void* init) {
 	return ptr;
 }
 
-static void pool_remove(struct pool* pool, entity e) {
+/* Removes a component without calling the pool's destroy function. */
+static void pool_erase(struct pool* pool, entity e) {
 	const i32 pos = pool->sparse[get_entity_id(e)];
 
-	if (pool->on_destroy) {
-		void* ptr = &((char*)pool->data)[pos * pool->type.size];
-		pool->on_destroy(pool->world, e, ptr);
-	}
-
 	const entity other = pool->dense[pool->dense_count - 1];
 
 	pool->sparse[get_entity_id(other)] = pos;
@@ -208,6 +211,14 @@ static void pool_remove(struct pool* pool, entity e) {
 	pool->count--;
 }
 
+static void pool_remove(struct pool* pool, entity e) {
+	if (pool->on_destroy) {
+		pool->on_destroy(pool->world, e, pool_get(pool, e));
+	}
+
+	pool_erase(pool, e);
+}
+
 static void* pool_get_by_idx(struct pool* pool, i32 idx) {
 	return &((char*)pool->data)[idx * pool->type.size];
 }
@@ -400,6 +411,26 @@ void destroy_entity(struct world* world, entity e) {
 	world->alive_entity_count--;
 }
 
+entity move_entity(struct world* from, struct world* to, entity e) {
+	const entity moved = new_entity(to);
+
+	for (u32 i = 0; i < from->pool_count; i++) {
+		struct pool* pool = &from->pools[i];
+
+		if (pool_has(pool, e)) {
+			pool_insert(get_pool(to, pool->type), moved, pool_get(pool, e));
+			pool_erase(pool, e);
+		}
+	}
+
+	const entity_version nv = get_entity_version(e) + 1;
+	release_entity(from, e, nv);
+
+	from->alive_entity_count--;
+
+	return moved;
+}
+
 bool entity_valid(struct world* world, entity e) {
 	const entity_id id = get_entity_id(e);
 	return id < world->entity_count && world->entities[id] == e;
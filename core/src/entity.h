@@ -68,6 +68,12 @@ API struct world* new_world();
 API void free_world(struct world* world);
 API entity new_entity(struct world* world);
 API void destroy_entity(struct world* world, entity e);
+
+/* Moves an entity and all of its components into another world, as a
+ * new entity, which is returned. The components are copied as they
+ * are, so neither their create nor their destroy functions are called;
+ * Anything that they own goes with them. */
+API entity move_entity(struct world* from, struct world* to, entity e);
 API bool entity_valid(struct world* world, entity e);
 
 API u32 get_entity_component_types(struct world* world, entity e, struct type_info* info, u32 count);
@@ -358,7 +358,7 @@ struct ui_context* new_ui_context(struct shader shader, struct window* window, s
 
 	ui->font = font;
 	ui->window = window;
-	ui->renderer = new_renderer(shader, make_v2i(800, 600));
+	ui->renderer = new_renderer(shader, make_v2i(800, 600), 4096);
 	ui->renderer->clip_enable = true;
 
 	ui->style_colors[ui_col_window_background]   = make_color(0x1a1a1a, 150);
@@ -0,0 +1,254 @@
+#include "core.h"
+#include "jobs.h"
+#include "platform.h"
+
+struct job_pool {
+	struct mutex* mutex;
+
+	/* Counts the jobs in the queue, so that idle workers can sleep. */
+	struct semaphore* semaphore;
+
+	struct job* head;
+	struct job* tail;
+
+	/* How many jobs are being run, by any thread. */
+	u32 running;
+
+	struct thread** threads;
+	u32 thread_count;
+
+	bool quit;
+};
+
+/* Must be called with the mutex locked. */
+static struct job* pop_job(struct job_pool* pool) {
+	struct job* job = pool->head;
+	if (!job) { return null; }
+
+	pool->head = job->next;
+	if (!pool->head) {
+		pool->tail = null;
+	}
+
+	job->next = null;
+	job->state = job_running;
+
+	pool->running++;
+
+	return job;
+}
+
+/* Remove a queued job from the queue. Must be called with the
+ * mutex locked. */
+static void unlink_job(struct job_pool* pool, struct job* job) {
+	struct job* prev = null;
+
+	for (struct job* j = pool->head; j; prev = j, j = j->next) {
+		if (j != job) { continue; }
+
+		if (prev) {
+			prev->next = j->next;
+		} else {
+			pool->head = j->next;
+		}
+
+		if (pool->tail == j) {
+			pool->tail = prev;
+		}
+
+		break;
+	}
+
+	job->next = null;
+}
+
+static void run_job(struct job_pool* pool, struct job* job) {
+	job->func(job);
+
+	lock_mutex(pool->mutex);
+	job->state = job_done;
+	pool->running--;
+	unlock_mutex(pool->mutex);
+}
+
+static void job_worker(struct thread* thread) {
+	struct job_pool* pool = get_thread_uptr(thread);
+
+	for (;;) {
+		semaphore_wait(pool->semaphore);
+
+		lock_mutex(pool->mutex);
+
+		if (pool->quit) {
+			unlock_mutex(pool->mutex);
+			return;
+		}
+
+		/* The queue can be empty here if the job was cancelled, or
+		 * taken by a thread in job_wait. */
+		struct job* job = pop_job(pool);
+
+		unlock_mutex(pool->mutex);
+
+		if (job) {
+			run_job(pool, job);
+		}
+	}
+}
+
+struct job_pool* new_job_pool(u32 thread_count) {
+	struct job_pool* pool = core_calloc(1, sizeof(struct job_pool));
+
+	pool->mutex = new_mutex(0);
+	pool->semaphore = new_semaphore(0);
+
+	pool->thread_count = thread_count > 0 ? thread_count : 1;
+	pool->threads = core_alloc(pool->thread_count * sizeof(struct thread*));
+
+	for (u32 i = 0; i < pool->thread_count; i++) {
+		pool->threads[i] = new_thread(job_worker);
+		set_thread_uptr(pool->threads[i], pool);
+		thread_execute(pool->threads[i]);
+	}
+
+	return pool;
+}
+
+void free_job_pool(struct job_pool* pool) {
+	lock_mutex(pool->mutex);
+	pool->quit = true;
+	unlock_mutex(pool->mutex);
+
+	for (u32 i = 0; i < pool->thread_count; i++) {
+		semaphore_signal(pool->semaphore);
+	}
+
+	for (u32 i = 0; i < pool->thread_count; i++) {
+		free_thread(pool->threads[i]);
+	}
+
+	core_free(pool->threads);
+
+	free_semaphore(pool->semaphore);
+	free_mutex(pool->mutex);
+
+	core_free(pool);
+}
+
+void job_submit(struct job_pool* pool, struct job* job) {
+	lock_mutex(pool->mutex);
+
+	job->state = job_queued;
+	job->next = null;
+
+	if (pool->tail) {
+		pool->tail->next = job;
+	} else {
+		pool->head = job;
+	}
+
+	pool->tail = job;
+
+	unlock_mutex(pool->mutex);
+
+	semaphore_signal(pool->semaphore);
+}
+
+bool job_cancel(struct job_pool* pool, struct job* job) {
+	lock_mutex(pool->mutex);
+
+	if (job->state == job_queued) {
+		unlink_job(pool, job);
+		job->state = job_idle;
+	}
+
+	bool cancelled = job->state == job_idle;
+
+	unlock_mutex(pool->mutex);
+
+	return cancelled;
+}
+
+bool job_finished(struct job_pool* pool, struct job* job) {
+	lock_mutex(pool->mutex);
+	bool finished = job->state == job_done;
+	unlock_mutex(pool->mutex);
+
+	return finished;
+}
+
+void job_wait(struct job_pool* pool, struct job* job) {
+	for (;;) {
+		lock_mutex(pool->mutex);
+
+		if (job->state == job_done || job->state == job_idle) {
+			unlock_mutex(pool->mutex);
+			return;
+		}
+
+		/* Prefer the job that is being waited for, if it hasn't
+		 * been picked up by a worker yet. */
+		struct job* next;
+		if (job->state == job_queued) {
+			unlink_job(pool, job);
+			job->state = job_running;
+			pool->running++;
+			next = job;
+		} else {
+			next = pop_job(pool);
+		}
+
+		unlock_mutex(pool->mutex);
+
+		if (next) {
+			run_job(pool, next);
+		} else {
+			thread_yield();
+		}
+	}
+}
+
+void job_join(struct job_pool* pool, struct job* job) {
+	for (;;) {
+		lock_mutex(pool->mutex);
+
+		if (job->state == job_done || job->state == job_idle) {
+			unlock_mutex(pool->mutex);
+			return;
+		}
+
+		bool queued = job->state == job_queued;
+		if (queued) {
+			unlink_job(pool, job);
+			job->state = job_running;
+			pool->running++;
+		}
+
+		unlock_mutex(pool->mutex);
+
+		if (queued) {
+			run_job(pool, job);
+		} else {
+			thread_yield();
+		}
+	}
+}
+
+void job_drain(struct job_pool* pool) {
+	for (;;) {
+		lock_mutex(pool->mutex);
+
+		struct job* next = pop_job(pool);
+		bool idle = !next && pool->running == 0;
+
+		unlock_mutex(pool->mutex);
+
+		if (idle) { return; }
+
+		if (next) {
+			run_job(pool, next);
+		} else {
+			thread_yield();
+		}
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.h"
+
+/* A pool of worker threads that run jobs in the order that they
+ * were submitted.
+ *
+ * Jobs are owned by whoever submits them, and must stay alive
+ * until they have either finished or been cancelled. A job is
+ * usually embedded in a larger structure, which the job function
+ * gets back to through `udata'. */
+
+struct job;
+
+typedef void (*job_func)(struct job* job);
+
+enum {
+	job_idle = 0,
+	job_queued,
+	job_running,
+	job_done
+};
+
+struct job {
+	job_func func;
+	void* udata;
+
+	/* Managed by the pool. */
+	u32 state;
+	struct job* next;
+};
+
+struct job_pool;
+
+API struct job_pool* new_job_pool(u32 thread_count);
+
+/* Jobs that are still queued when the pool is freed are never run;
+ * Jobs that are running are waited for. */
+API void free_job_pool(struct job_pool* pool);
+
+API void job_submit(struct job_pool* pool, struct job* job);
+
+/* Remove a job from the queue. Returns false if it has already
+ * started running, in which case it must be waited for instead. */
+API bool job_cancel(struct job_pool* pool, struct job* job);
+
+API bool job_finished(struct job_pool* pool, struct job* job);
+
+/* Block until a job has finished. The calling thread runs jobs from
+ * the queue while it waits, rather than sitting idle. */
+API void job_wait(struct job_pool* pool, struct job* job);
+
+/* Like job_wait, but never runs any job other than the one that is
+ * being waited for; For waiting on the main thread, where running
+ * somebody else's job would stall the frame. */
+API void job_join(struct job_pool* pool, struct job* job);
+
+/* Block until every job that has been submitted has finished. The
+ * calling thread runs jobs from the queue while it waits. */
+API void job_drain(struct job_pool* pool);
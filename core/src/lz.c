@@ -0,0 +1,190 @@
+#include <string.h>
+
+#include "lz.h"
+
+#define hash_bits 12
+#define min_match 4
+#define max_offset 65535
+
+static u32 read_u32(const u8* p) {
+	u32 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static u32 hash_seq(u32 seq) {
+	return (seq * 2654435761u) >> (32 - hash_bits);
+}
+
+static u8* write_length(u8* op, u64 len) {
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+
+	*op++ = (u8)len;
+
+	return op;
+}
+
+static bool read_length(const u8** ip, const u8* end, u64* len) {
+	u8 b;
+	do {
+		if (*ip >= end) { return false; }
+
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+
+	return true;
+}
+
+u64 lz_compress_bound(u64 size) {
+	return size + (size / 255) + 16;
+}
+
+u64 lz_compress(const u8* src, u64 size, u8* dst, u64 capacity) {
+	/* Positions are stored plus one, so that zero means empty. */
+	u32 table[1 << hash_bits];
+	memset(table, 0, sizeof(table));
+
+	const u8* ip = src;
+	const u8* anchor = src;
+	const u8* end = src + size;
+	const u8* limit = size >= min_match ? end - min_match : src;
+
+	u8* op = dst;
+	u8* op_end = dst + capacity;
+
+	while (ip < limit) {
+		u32 seq = read_u32(ip);
+		u32 h = hash_seq(seq);
+		u32 candidate = table[h];
+		table[h] = (u32)(ip - src) + 1;
+
+		if (!candidate) {
+			ip++;
+			continue;
+		}
+
+		const u8* ref = src + candidate - 1;
+		if (ip - ref > max_offset || read_u32(ref) != seq) {
+			ip++;
+			continue;
+		}
+
+		const u8* mp = ip + min_match;
+		const u8* rp = ref + min_match;
+		while (mp < end && *mp == *rp) {
+			mp++;
+			rp++;
+		}
+
+		u64 lit_len = (u64)(ip - anchor);
+		u64 match_len = (u64)(mp - ip) - min_match;
+
+		if ((u64)(op_end - op) < 1 + (lit_len / 255) + 1 + lit_len + 2 + (match_len / 255) + 1) {
+			return 0;
+		}
+
+		u8* token = op++;
+		*token = (u8)((lit_len >= 15 ? 15 : lit_len) << 4);
+		if (lit_len >= 15) {
+			op = write_length(op, lit_len - 15);
+		}
+
+		memcpy(op, anchor, lit_len);
+		op += lit_len;
+
+		u16 offset = (u16)(ip - ref);
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+
+		*token |= (u8)(match_len >= 15 ? 15 : match_len);
+		if (match_len >= 15) {
+			op = write_length(op, match_len - 15);
+		}
+
+		ip = mp;
+		anchor = ip;
+	}
+
+	/* The last sequence; Whatever is left over, as literals. */
+	u64 lit_len = (u64)(end - anchor);
+
+	if ((u64)(op_end - op) < 1 + (lit_len / 255) + 1 + lit_len) {
+		return 0;
+	}
+
+	u8* token = op++;
+	*token = (u8)((lit_len >= 15 ? 15 : lit_len) << 4);
+	if (lit_len >= 15) {
+		op = write_length(op, lit_len - 15);
+	}
+
+	memcpy(op, anchor, lit_len);
+	op += lit_len;
+
+	return (u64)(op - dst);
+}
+
+bool lz_decompress(const u8* src, u64 size, u8* dst, u64 dst_size) {
+	const u8* ip = src;
+	const u8* end = src + size;
+
+	u8* op = dst;
+	u8* op_end = dst + dst_size;
+
+	while (ip < end) {
+		u8 token = *ip++;
+
+		u64 lit_len = token >> 4;
+		if (lit_len == 15 && !read_length(&ip, end, &lit_len)) {
+			return false;
+		}
+
+		if (lit_len > (u64)(end - ip) || lit_len > (u64)(op_end - op)) {
+			return false;
+		}
+
+		memcpy(op, ip, lit_len);
+		op += lit_len;
+		ip += lit_len;
+
+		if (ip >= end) { break; }
+
+		if (end - ip < 2) { return false; }
+
+		u64 offset = (u64)ip[0] | ((u64)ip[1] << 8);
+		ip += 2;
+
+		if (offset == 0 || offset > (u64)(op - dst)) {
+			return false;
+		}
+
+		u64 match_len = token & 0xf;
+		if (match_len == 15 && !read_length(&ip, end, &match_len)) {
+			return false;
+		}
+		match_len += min_match;
+
+		if (match_len > (u64)(op_end - op)) {
+			return false;
+		}
+
+		const u8* ref = op - offset;
+		if (offset >= match_len) {
+			memcpy(op, ref, match_len);
+		} else {
+			/* The match overlaps the output, so it must be copied
+			 * forwards one byte at a time. */
+			for (u64 i = 0; i < match_len; i++) {
+				op[i] = ref[i];
+			}
+		}
+
+		op += match_len;
+	}
+
+	return op == op_end;
+}
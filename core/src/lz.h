@@ -0,0 +1,26 @@
+#pragma once
+
+#include "common.h"
+
+/* A small and fast LZ77 codec, in the spirit of LZ4.
+ *
+ * The compressed data is a series of sequences. Each one starts
+ * with a token byte; The high four bits store the amount of literal
+ * bytes that follow the token, and the low four bits store the length
+ * of the match that follows the literals, minus four. Either length
+ * is extended with extra bytes when its four bits are all set. The
+ * match is stored as a 16-bit little-endian offset back into the
+ * output. The last sequence consists of literals only.
+ *
+ * It trades compression ratio for decompression speed, which is
+ * what is wanted for game resources. */
+
+/* The largest size that compressing `size' bytes can produce. */
+API u64 lz_compress_bound(u64 size);
+
+/* Returns the compressed size, or zero if it doesn't fit into `capacity'. */
+API u64 lz_compress(const u8* src, u64 size, u8* dst, u64 capacity);
+
+/* Returns false if the data is corrupt or doesn't decompress
+ * to exactly `dst_size' bytes. */
+API bool lz_decompress(const u8* src, u64 size, u8* dst, u64 dst_size);
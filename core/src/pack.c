@@ -0,0 +1,69 @@
+#include <string.h>
+
+#include "core.h"
+#include "pack.h"
+
+u64 pack_hash(const char* path) {
+	return fnv1a_hash((const u8*)path, strlen(path));
+}
+
+/* Adler-32. */
+u32 pack_checksum(const u8* data, u64 size) {
+	u32 a = 1, b = 0;
+
+	while (size > 0) {
+		/* 5552 is the most bytes that can be summed before `b' could overflow. */
+		u64 block = size < 5552 ? size : 5552;
+		size -= block;
+
+		for (u64 i = 0; i < block; i++) {
+			a += *data++;
+			b += a;
+		}
+
+		a %= 65521;
+		b %= 65521;
+	}
+
+	return (b << 16) | a;
+}
+
+u64 pack_align(u64 offset) {
+	return (offset + pack_alignment - 1) & ~((u64)pack_alignment - 1);
+}
+
+struct pack_entry* pack_find(struct pack_entry* entries, u64 count, u64 hash) {
+	u64 low = 0, high = count;
+
+	while (low < high) {
+		u64 mid = low + (high - low) / 2;
+
+		if (entries[mid].hash < hash) {
+			low = mid + 1;
+		} else if (entries[mid].hash > hash) {
+			high = mid;
+		} else {
+			return entries + mid;
+		}
+	}
+
+	return null;
+}
+
+struct pack_atlas_region* pack_find_region(struct pack_atlas_region* regions, u64 count, u64 hash) {
+	u64 low = 0, high = count;
+
+	while (low < high) {
+		u64 mid = low + (high - low) / 2;
+
+		if (regions[mid].hash < hash) {
+			low = mid + 1;
+		} else if (regions[mid].hash > hash) {
+			high = mid;
+		} else {
+			return regions + mid;
+		}
+	}
+
+	return null;
+}
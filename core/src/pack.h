@@ -0,0 +1,116 @@
+#pragma once
+
+#include "common.h"
+
+/* The resource package format, as written by the packer and read
+ * by the resource manager in release builds.
+ *
+ * A package starts with a header, followed by an index of entries
+ * sorted by the 64-bit hash of their path, so that lookups can
+ * binary search it. The data for every entry starts on a
+ * pack_alignment boundary, so that it can be mapped straight into
+ * memory. Entries may be compressed using the codec in `lz.h'; The
+ * checksum is always of the uncompressed data. */
+
+#define pack_magic "OMVP"
+#define pack_version 2
+#define pack_alignment 4096
+
+enum {
+	pack_entry_compressed = 1 << 0
+};
+
+struct pack_header {
+	char magic[4];
+	u32 version;
+	u64 entry_count;
+	u64 index_offset;
+};
+
+struct pack_entry {
+	u64 hash;
+	u64 offset;
+	u64 size;     /* The size of the data as stored in the package. */
+	u64 raw_size; /* The size of the data once it has been decompressed. */
+	u32 flags;
+	u32 checksum;
+};
+
+/* Images that are marked with the `atlas' option in `packed.include'
+ * are baked into shared atlases by the packer, instead of being stored
+ * by themselves. The atlases are stored as entries named using
+ * pack_atlas_path, and the entry named pack_atlas_map_path is a table
+ * of pack_atlas_region, sorted by hash, that maps the path of each
+ * image to where it ended up. Atlases are always loaded with the
+ * sprite_texture flags. */
+
+#define pack_atlas_path "atlas/%u"
+#define pack_atlas_map_path "atlas/map"
+#define pack_atlas_size 1024
+
+struct pack_atlas_region {
+	u64 hash;
+	u32 atlas;
+	u32 x, y, w, h;
+};
+
+/* Bitmaps are cooked by the packer into a pack_texture header,
+ * followed by RGBA8 pixels that are already in the order that
+ * glTexImage2D expects, so that loading them needs no conversion.
+ * Atlases are stored the same way. 8-bit bitmaps are left as they
+ * are, because they are uploaded with a single channel. */
+
+#define pack_texture_magic "OMVT"
+
+struct pack_texture {
+	char magic[4];
+	u32 width, height;
+};
+
+/* Shaders are cooked by the packer into a pack_shader header,
+ * followed by the source of each of their stages, in the order
+ * vertex, fragment, geometry. `#include's are already resolved, and
+ * every stage is null terminated. A stage that the shader doesn't
+ * have has a size of zero. */
+
+#define pack_shader_magic "OMVS"
+
+struct pack_shader {
+	char magic[4];
+	u32 sizes[3];
+};
+
+/* Fonts can be given one or more `size=<pixels>' options in
+ * `packed.include', and optionally `page=<n>' options, which default
+ * to page zero (ASCII and Latin-1). For every size, the packer bakes
+ * the glyph sets of those pages ahead of time and stores them in an
+ * entry named using pack_font_path, with the path of the font and the
+ * size. The entry is a pack_font header followed by, for every set, a
+ * pack_glyph_set header, the metrics of its 256 glyphs, as
+ * stbtt_bakedchar, and its atlas, as RGBA8 pixels. The font itself
+ * is still stored, since it is needed to lay text out and to bake any
+ * other pages. */
+
+#define pack_font_magic "OMVF"
+#define pack_font_path "%s@%u"
+
+struct pack_font {
+	char magic[4];
+	u32 set_count;
+};
+
+struct pack_glyph_set {
+	u32 page;
+	u32 width, height;
+};
+
+API u64 pack_hash(const char* path);
+API u32 pack_checksum(const u8* data, u64 size);
+
+/* Round an offset up to the next pack_alignment boundary. */
+API u64 pack_align(u64 offset);
+
+/* Binary search a sorted index for an entry. Returns null if
+ * there is no entry with the hash. */
+API struct pack_entry* pack_find(struct pack_entry* entries, u64 count, u64 hash);
+API struct pack_atlas_region* pack_find_region(struct pack_atlas_region* regions, u64 count, u64 hash);
@@ -1,12 +1,10 @@
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "core.h"
 #include "physics.h"
 
-static i32 sort_cmp(const void* a, const void* b) {
-	return *(i32*)a > *(i32*)b;
-}
-
 bool rect_overlap(struct rect a, struct rect b, v2i* normal) {
 	if (!(
 		a.x + a.w > b.x &&
@@ -25,18 +23,20 @@ bool rect_overlap(struct rect a, struct rect b, v2i* normal) {
 		i32 top    = (b.y + b.h) - a.y;
 		i32 bottom = (a.y + a.h) - b.y;
 
-		i32 overlap[] = { right, left, top, bottom };
-
-		qsort(overlap, sizeof(overlap) / sizeof(*overlap), sizeof(i32), sort_cmp);
+		/* The normal is along the side with the smallest overlap. */
+		i32 smallest = right;
+		smallest = left   < smallest ? left   : smallest;
+		smallest = top    < smallest ? top    : smallest;
+		smallest = bottom < smallest ? bottom : smallest;
 
 		*normal = make_v2i(0, 0);
-		if (overlap[0]        == abs(right)) {
+		if (smallest        == right) {
 			normal->x =  1;
-		} else if (overlap[0] == abs(left)) {
+		} else if (smallest == left) {
 			normal->x = -1;
-		} else if (overlap[0] == abs(bottom)) {
+		} else if (smallest == bottom) {
 			normal->y =  1;
-		} else if (overlap[0] == abs(top)) {
+		} else if (smallest == top) {
 			normal->y = -1;
 		}
 	}
@@ -62,3 +62,472 @@ bool point_vs_rtri(v2i p, v2i a, v2i b) {
 
 	return point_vs_tri(p, a, b, c);
 }
+
+static i32 floor_div(i32 a, i32 b) {
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/* Works out the range of cells that a rectangle touches, clamped to
+ * the grid. Returns false if it is outside of the grid altogether.
+ * Empty rectangles are treated as being a unit wide, since they can
+ * still overlap something that contains them. */
+static bool rect_cells(const struct rect_grid* grid, struct rect rect, i32* x0, i32* y0, i32* x1, i32* y1) {
+	const i32 w = rect.w > 1 ? rect.w : 1;
+	const i32 h = rect.h > 1 ? rect.h : 1;
+
+	*x0 = floor_div(rect.x - grid->origin.x, grid->cell_size);
+	*y0 = floor_div(rect.y - grid->origin.y, grid->cell_size);
+	*x1 = floor_div(rect.x + w - 1 - grid->origin.x, grid->cell_size);
+	*y1 = floor_div(rect.y + h - 1 - grid->origin.y, grid->cell_size);
+
+	if (*x1 < 0 || *y1 < 0 || *x0 >= (i32)grid->w || *y0 >= (i32)grid->h) {
+		return false;
+	}
+
+	*x0 = *x0 < 0 ? 0 : *x0;
+	*y0 = *y0 < 0 ? 0 : *y0;
+	*x1 = *x1 >= (i32)grid->w ? (i32)grid->w - 1 : *x1;
+	*y1 = *y1 >= (i32)grid->h ? (i32)grid->h - 1 : *y1;
+
+	return true;
+}
+
+void init_rect_grid(struct rect_grid* grid, const struct rect* rects, u32 count, i32 cell_size) {
+	*grid = (struct rect_grid) { .cell_size = cell_size, .rect_count = count };
+
+	if (count == 0) { return; }
+
+	i32 min_x = rects[0].x, min_y = rects[0].y;
+	i32 max_x = rects[0].x, max_y = rects[0].y;
+	for (u32 i = 0; i < count; i++) {
+		const i32 w = rects[i].w > 1 ? rects[i].w : 1;
+		const i32 h = rects[i].h > 1 ? rects[i].h : 1;
+
+		min_x = rects[i].x < min_x ? rects[i].x : min_x;
+		min_y = rects[i].y < min_y ? rects[i].y : min_y;
+		max_x = rects[i].x + w > max_x ? rects[i].x + w : max_x;
+		max_y = rects[i].y + h > max_y ? rects[i].y + h : max_y;
+	}
+
+	grid->origin = make_v2i(min_x, min_y);
+	grid->w = (u32)((max_x - min_x + cell_size - 1) / cell_size);
+	grid->h = (u32)((max_y - min_y + cell_size - 1) / cell_size);
+
+	const u32 cell_count = grid->w * grid->h;
+
+	grid->cell_starts = core_calloc(cell_count + 1, sizeof(u32));
+
+	/* Count the rectangles in each cell, then turn the counts into
+	 * where each cell starts, and fill the cells in. */
+	for (u32 i = 0; i < count; i++) {
+		i32 x0, y0, x1, y1;
+		rect_cells(grid, rects[i], &x0, &y0, &x1, &y1);
+
+		for (i32 y = y0; y <= y1; y++) {
+			for (i32 x = x0; x <= x1; x++) {
+				grid->cell_starts[x + y * grid->w + 1]++;
+			}
+		}
+	}
+
+	for (u32 i = 0; i < cell_count; i++) {
+		grid->cell_starts[i + 1] += grid->cell_starts[i];
+	}
+
+	grid->items = core_alloc(grid->cell_starts[cell_count] * sizeof(u32));
+
+	u32* cursors = core_alloc(cell_count * sizeof(u32));
+	memcpy(cursors, grid->cell_starts, cell_count * sizeof(u32));
+
+	for (u32 i = 0; i < count; i++) {
+		i32 x0, y0, x1, y1;
+		rect_cells(grid, rects[i], &x0, &y0, &x1, &y1);
+
+		for (i32 y = y0; y <= y1; y++) {
+			for (i32 x = x0; x <= x1; x++) {
+				grid->items[cursors[x + y * grid->w]++] = i;
+			}
+		}
+	}
+
+	core_free(cursors);
+
+	grid->stamps = core_calloc(count, sizeof(u32));
+	grid->results = core_alloc(count * sizeof(u32));
+}
+
+void deinit_rect_grid(struct rect_grid* grid) {
+	if (grid->rect_count == 0) { return; }
+
+	core_free(grid->cell_starts);
+	core_free(grid->items);
+	core_free(grid->stamps);
+	core_free(grid->results);
+}
+
+u32 rect_grid_query(struct rect_grid* grid, struct rect rect, const u32** indices) {
+	*indices = grid->results;
+
+	i32 x0, y0, x1, y1;
+	if (grid->rect_count == 0 || !rect_cells(grid, rect, &x0, &y0, &x1, &y1)) {
+		return 0;
+	}
+
+	grid->stamp++;
+	if (grid->stamp == 0) {
+		memset(grid->stamps, 0, grid->rect_count * sizeof(u32));
+		grid->stamp = 1;
+	}
+
+	u32 count = 0;
+
+	for (i32 y = y0; y <= y1; y++) {
+		for (i32 x = x0; x <= x1; x++) {
+			const u32 cell = x + y * grid->w;
+
+			for (u32 i = grid->cell_starts[cell]; i < grid->cell_starts[cell + 1]; i++) {
+				const u32 item = grid->items[i];
+				if (grid->stamps[item] == grid->stamp) { continue; }
+
+				grid->stamps[item] = grid->stamp;
+
+				/* Insertion sort, since there are only ever a few. */
+				u32 j = count++;
+				for (; j > 0 && grid->results[j - 1] > item; j--) {
+					grid->results[j] = grid->results[j - 1];
+				}
+				grid->results[j] = item;
+			}
+		}
+	}
+
+	return count;
+}
+
+static bool map_bit(const struct solid_map* map, const u64* bits, u32 x, u32 y) {
+	return (bits[y * map->words_per_row + x / 64] >> (x % 64)) & 1;
+}
+
+static void set_map_bit(struct solid_map* map, u64* bits, u32 x, u32 y) {
+	bits[y * map->words_per_row + x / 64] |= (u64)1 << (x % 64);
+}
+
+static struct rect unit_rect(struct rect rect) {
+	rect.w = rect.w > 1 ? rect.w : 1;
+	rect.h = rect.h > 1 ? rect.h : 1;
+	return rect;
+}
+
+/* Like rect_cells, but for the tiles of a solid map. */
+static bool rect_tiles(const struct solid_map* map, struct rect rect, i32* x0, i32* y0, i32* x1, i32* y1) {
+	rect = unit_rect(rect);
+
+	*x0 = floor_div(rect.x - map->origin.x, map->tile_size);
+	*y0 = floor_div(rect.y - map->origin.y, map->tile_size);
+	*x1 = floor_div(rect.x + rect.w - 1 - map->origin.x, map->tile_size);
+	*y1 = floor_div(rect.y + rect.h - 1 - map->origin.y, map->tile_size);
+
+	if (*x1 < 0 || *y1 < 0 || *x0 >= (i32)map->w || *y0 >= (i32)map->h) {
+		return false;
+	}
+
+	*x0 = *x0 < 0 ? 0 : *x0;
+	*y0 = *y0 < 0 ? 0 : *y0;
+	*x1 = *x1 >= (i32)map->w ? (i32)map->w - 1 : *x1;
+	*y1 = *y1 >= (i32)map->h ? (i32)map->h - 1 : *y1;
+
+	return true;
+}
+
+/* Builds the run tables of either the rows or the columns. */
+static void build_runs(struct solid_map* map, bool columns, u32** starts, struct solid_run** runs) {
+	const u32 line_count = columns ? map->w : map->h;
+	const u32 line_length = columns ? map->h : map->w;
+
+	*starts = core_calloc(line_count + 1, sizeof(u32));
+
+	u32 capacity = 16, count = 0;
+	*runs = core_alloc(capacity * sizeof(struct solid_run));
+
+	for (u32 line = 0; line < line_count; line++) {
+		u32 i = 0;
+		while (i < line_length) {
+			const u32 x = columns ? line : i;
+			const u32 y = columns ? i : line;
+
+			if (!map_bit(map, map->solid, x, y) && !map_bit(map, map->mixed, x, y)) {
+				i++;
+				continue;
+			}
+
+			struct solid_run run = { i, i };
+			while (run.end < line_length &&
+				(map_bit(map, map->solid, columns ? line : run.end, columns ? run.end : line) ||
+				 map_bit(map, map->mixed, columns ? line : run.end, columns ? run.end : line))) {
+				run.end++;
+			}
+
+			if (count >= capacity) {
+				capacity *= 2;
+				*runs = core_realloc(*runs, capacity * sizeof(struct solid_run));
+			}
+
+			(*runs)[count++] = run;
+
+			i = run.end;
+		}
+
+		(*starts)[line + 1] = count;
+	}
+}
+
+void init_solid_map(struct solid_map* map, const struct rect* rects, u32 count, i32 tile_size) {
+	*map = (struct solid_map) { .rects = rects, .tile_size = tile_size };
+
+	init_rect_grid(&map->grid, rects, count, tile_size);
+
+	if (count == 0) { return; }
+
+	/* The grid already covers every rectangle. */
+	map->origin = map->grid.origin;
+	map->w = map->grid.w;
+	map->h = map->grid.h;
+	map->words_per_row = (map->w + 63) / 64;
+
+	map->solid = core_calloc(map->words_per_row * map->h, sizeof(u64));
+	map->mixed = core_calloc(map->words_per_row * map->h, sizeof(u64));
+
+	for (u32 i = 0; i < count; i++) {
+		const struct rect rect = rects[i];
+
+		i32 x0, y0, x1, y1;
+		rect_tiles(map, rect, &x0, &y0, &x1, &y1);
+
+		for (i32 y = y0; y <= y1; y++) {
+			for (i32 x = x0; x <= x1; x++) {
+				const i32 left = map->origin.x + x * tile_size;
+				const i32 top  = map->origin.y + y * tile_size;
+
+				if (rect.x <= left && rect.y <= top &&
+					rect.x + rect.w >= left + tile_size &&
+					rect.y + rect.h >= top + tile_size) {
+					set_map_bit(map, map->solid, x, y);
+				} else {
+					set_map_bit(map, map->mixed, x, y);
+				}
+			}
+		}
+	}
+
+	/* Nothing that is in a solid tile needs testing as it is, even if
+	 * other rectangles only cover part of it. */
+	for (u32 i = 0; i < map->words_per_row * map->h; i++) {
+		map->mixed[i] &= ~map->solid[i];
+	}
+
+	build_runs(map, false, &map->row_starts, &map->row_runs);
+	build_runs(map, true, &map->column_starts, &map->column_runs);
+}
+
+void deinit_solid_map(struct solid_map* map) {
+	deinit_rect_grid(&map->grid);
+
+	if (map->w == 0) { return; }
+
+	core_free(map->solid);
+	core_free(map->mixed);
+	core_free(map->row_starts);
+	core_free(map->row_runs);
+	core_free(map->column_starts);
+	core_free(map->column_runs);
+}
+
+bool solid_map_at(struct solid_map* map, v2i point) {
+	return solid_map_overlap(map, make_rect(point.x, point.y, 1, 1));
+}
+
+bool solid_map_overlap(struct solid_map* map, struct rect rect) {
+	rect = unit_rect(rect);
+
+	i32 x0, y0, x1, y1;
+	if (map->w == 0 || !rect_tiles(map, rect, &x0, &y0, &x1, &y1)) {
+		return false;
+	}
+
+	bool mixed = false;
+	for (i32 y = y0; y <= y1; y++) {
+		for (i32 x = x0; x <= x1; x++) {
+			if (map_bit(map, map->solid, x, y)) {
+				return true;
+			}
+
+			mixed = mixed || map_bit(map, map->mixed, x, y);
+		}
+	}
+
+	if (!mixed) { return false; }
+
+	const u32* near;
+	u32 near_count = rect_grid_query(&map->grid, rect, &near);
+	for (u32 i = 0; i < near_count; i++) {
+		if (rect_overlap(rect, unit_rect(map->rects[near[i]]), null)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Sweeps along one axis. `a' is the axis of the movement, and `b' the
+ * one across it, so that the same code works for both. */
+struct sweep_axis {
+	bool vertical;
+
+	i32 origin_a, origin_b;
+	u32 length_a, length_b;
+
+	const u32* starts;
+	const struct solid_run* runs;
+};
+
+static i32 rect_a(const struct sweep_axis* axis, struct rect r)  { return axis->vertical ? r.y : r.x; }
+static i32 rect_b(const struct sweep_axis* axis, struct rect r)  { return axis->vertical ? r.x : r.y; }
+static i32 rect_aw(const struct sweep_axis* axis, struct rect r) { return axis->vertical ? r.h : r.w; }
+static i32 rect_bw(const struct sweep_axis* axis, struct rect r) { return axis->vertical ? r.w : r.h; }
+
+static bool tile_bit(const struct solid_map* map, const struct sweep_axis* axis, const u64* bits, u32 a, u32 b) {
+	return axis->vertical ? map_bit(map, bits, b, a) : map_bit(map, bits, a, b);
+}
+
+/* Returns how far `rect' can move towards the rectangles that touch a
+ * mixed tile, or `best' if they don't get in the way any sooner. */
+static i32 sweep_mixed_tile(struct solid_map* map, const struct sweep_axis* axis, struct rect rect,
+	bool forward, u32 a, u32 b, i32 best) {
+
+	const i32 tile_a = axis->origin_a + (i32)a * map->tile_size;
+	const i32 tile_b = axis->origin_b + (i32)b * map->tile_size;
+
+	struct rect tile = axis->vertical ?
+		make_rect(tile_b, tile_a, map->tile_size, map->tile_size) :
+		make_rect(tile_a, tile_b, map->tile_size, map->tile_size);
+
+	const i32 lead = forward ? rect_a(axis, rect) + rect_aw(axis, rect) : rect_a(axis, rect);
+
+	const u32* near;
+	u32 near_count = rect_grid_query(&map->grid, tile, &near);
+	for (u32 i = 0; i < near_count; i++) {
+		const struct rect r = unit_rect(map->rects[near[i]]);
+
+		if (!(rect_b(axis, rect) < rect_b(axis, r) + rect_bw(axis, r) &&
+			rect_b(axis, rect) + rect_bw(axis, rect) > rect_b(axis, r))) {
+			continue;
+		}
+
+		i32 distance;
+		if (forward) {
+			if (rect_a(axis, r) + rect_aw(axis, r) <= lead) { continue; }
+			distance = rect_a(axis, r) - lead;
+		} else {
+			if (rect_a(axis, r) >= lead) { continue; }
+			distance = lead - (rect_a(axis, r) + rect_aw(axis, r));
+		}
+
+		distance = distance > 0 ? distance : 0;
+		best = distance < best ? distance : best;
+	}
+
+	return best;
+}
+
+static i32 sweep(struct solid_map* map, const struct sweep_axis* axis, struct rect rect, i32 delta) {
+	if (delta == 0 || map->w == 0) { return delta; }
+
+	rect = unit_rect(rect);
+
+	const bool forward = delta > 0;
+	i32 best = forward ? delta : -delta;
+
+	const i32 tile_size = map->tile_size;
+
+	/* The tiles across the movement. */
+	i32 b0 = floor_div(rect_b(axis, rect) - axis->origin_b, tile_size);
+	i32 b1 = floor_div(rect_b(axis, rect) + rect_bw(axis, rect) - 1 - axis->origin_b, tile_size);
+	if (b1 < 0 || b0 >= (i32)axis->length_b) { return delta; }
+
+	b0 = b0 < 0 ? 0 : b0;
+	b1 = b1 >= (i32)axis->length_b ? (i32)axis->length_b - 1 : b1;
+
+	/* The first pixel ahead of the rectangle, and the tile that it is in. */
+	const i32 lead = forward ? rect_a(axis, rect) + rect_aw(axis, rect) : rect_a(axis, rect);
+	const i32 first = floor_div((forward ? lead : lead - 1) - axis->origin_a, tile_size);
+
+	for (i32 b = b0; b <= b1; b++) {
+		const struct solid_run* runs = axis->runs + axis->starts[b];
+		const u32 run_count = axis->starts[b + 1] - axis->starts[b];
+
+		/* Find the first run that isn't behind the rectangle. */
+		u32 lo = 0, hi = run_count;
+		while (lo < hi) {
+			const u32 mid = lo + (hi - lo) / 2;
+
+			bool behind = forward ? (i32)runs[mid].end <= first : (i32)runs[run_count - 1 - mid].start > first;
+			if (behind) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+
+		bool done = false;
+		for (u32 r = lo; r < run_count && !done; r++) {
+			const struct solid_run run = forward ? runs[r] : runs[run_count - 1 - r];
+
+			for (u32 ii = 0; ii < run.end - run.start; ii++) {
+				const i32 a = forward ? (i32)(run.start + ii) : (i32)(run.end - 1 - ii);
+
+				if (forward ? a < first : a > first) { continue; }
+
+				const i32 tile_start = axis->origin_a + a * tile_size;
+				i32 distance = forward ? tile_start - lead : lead - (tile_start + tile_size);
+				distance = distance > 0 ? distance : 0;
+
+				if (distance >= best) {
+					done = true;
+					break;
+				}
+
+				if (tile_bit(map, axis, map->solid, a, b)) {
+					best = distance;
+					done = true;
+					break;
+				}
+
+				best = sweep_mixed_tile(map, axis, rect, forward, a, b, best);
+			}
+		}
+	}
+
+	return forward ? best : -best;
+}
+
+i32 solid_map_sweep_x(struct solid_map* map, struct rect rect, i32 dx) {
+	const struct sweep_axis axis = {
+		.vertical = false,
+		.origin_a = map->origin.x, .origin_b = map->origin.y,
+		.length_a = map->w, .length_b = map->h,
+		.starts = map->row_starts, .runs = map->row_runs
+	};
+
+	return sweep(map, &axis, rect, dx);
+}
+
+i32 solid_map_sweep_y(struct solid_map* map, struct rect rect, i32 dy) {
+	const struct sweep_axis axis = {
+		.vertical = true,
+		.origin_a = map->origin.y, .origin_b = map->origin.x,
+		.length_a = map->h, .length_b = map->w,
+		.starts = map->column_starts, .runs = map->column_runs
+	};
+
+	return sweep(map, &axis, rect, dy);
+}
@@ -7,3 +7,81 @@
 API bool rect_overlap(struct rect a, struct rect b, v2i* normal);
 API bool point_vs_tri(v2i p, v2i a, v2i b, v2i c);
 API bool point_vs_rtri(v2i p, v2i a, v2i b);
+
+/* A uniform grid over a set of rectangles that don't move, so that
+ * finding the ones near an area doesn't have to test every one of
+ * them. Each cell lists the rectangles that touch it. */
+struct rect_grid {
+	v2i origin;
+	i32 cell_size;
+	u32 w, h;
+
+	/* Cell `i' lists items[cell_starts[i]] up to items[cell_starts[i + 1]]. */
+	u32* cell_starts;
+	u32* items;
+
+	/* So that a rectangle that touches more than one cell is only
+	 * returned once by a query. */
+	u32 rect_count;
+	u32* stamps;
+	u32 stamp;
+	u32* results;
+};
+
+API void init_rect_grid(struct rect_grid* grid, const struct rect* rects, u32 count, i32 cell_size);
+API void deinit_rect_grid(struct rect_grid* grid);
+
+/* Finds the rectangles that might overlap `rect', sets `indices' to
+ * their indices, in ascending order, and returns how many there are.
+ * The indices are only valid until the next query. */
+API u32 rect_grid_query(struct rect_grid* grid, struct rect rect, const u32** indices);
+
+/* A bitmap over the tiles that a set of rectangles that don't move
+ * cover, for answering whether something is solid with a few bit
+ * tests, rather than by testing rectangles. A tile that is entirely
+ * inside one of the rectangles is solid. One that is only partly
+ * covered is mixed, and the rectangles that touch it are tested as
+ * they are, so the answers are always exact. Every row and column
+ * also has a table of its runs of tiles that are solid or mixed, so
+ * that sweeps can skip over empty space.
+ *
+ * Empty rectangles, and rectangles that are passed to queries, are
+ * treated as being at least a unit across. */
+struct solid_run {
+	u32 start, end;
+};
+
+struct solid_map {
+	const struct rect* rects;
+	struct rect_grid grid;
+
+	v2i origin;
+	i32 tile_size;
+	u32 w, h;
+
+	u32 words_per_row;
+	u64* solid;
+	u64* mixed;
+
+	/* Row `i' has row_runs[row_starts[i]] up to row_runs[row_starts[i + 1]],
+	 * and likewise for columns. */
+	u32* row_starts;
+	struct solid_run* row_runs;
+	u32* column_starts;
+	struct solid_run* column_runs;
+};
+
+/* `rects' must outlive the map. */
+API void init_solid_map(struct solid_map* map, const struct rect* rects, u32 count, i32 tile_size);
+API void deinit_solid_map(struct solid_map* map);
+
+API bool solid_map_at(struct solid_map* map, v2i point);
+API bool solid_map_overlap(struct solid_map* map, struct rect rect);
+
+/* Return how far, up to `dx' or `dy', `rect' can move along an axis
+ * before it would overlap one of the rectangles. Rectangles that are
+ * entirely behind the edge that leads the movement are ignored, so
+ * that something that is resting against a wall can move away from
+ * it. */
+API i32 solid_map_sweep_x(struct solid_map* map, struct rect rect, i32 dx);
+API i32 solid_map_sweep_y(struct solid_map* map, struct rect rect, i32 dy);
@@ -22,6 +22,10 @@ API bool window_should_close(struct window* window);
 API void set_window_should_close(struct window* window, bool close);
 API void window_make_context_current(struct window* window);
 
+/* Look up an OpenGL entry point that glad doesn't load, such as those
+ * from extensions. Returns null if the driver doesn't have it. */
+API void* get_gl_proc(const char* name);
+
 API void set_window_size(struct window* window, v2i size);
 API void set_window_fullscreen(struct window* window, bool fullscreen);
 
@@ -169,6 +173,15 @@ API bool file_is_regular(const char* name);
 API bool file_is_dir(const char* name);
 API u64 file_mod_time(const char* name);
 
+/* Returns true if the directory was created, or already exists. */
+API bool make_dir(const char* name);
+
+/* Map a whole file into memory, read-only. `data' is null for an
+ * empty file. Returns null if the file can't be opened. */
+struct file_mapping;
+API struct file_mapping* map_file(const char* name, const void** data, u64* size);
+API void unmap_file(struct file_mapping* mapping);
+
 API const char* get_file_name(const char* path);
 API const char* get_file_extension(const char* name);
 API char* get_file_path(const char* name);
@@ -194,3 +207,16 @@ API void free_mutex(struct mutex* mutex);
 API void lock_mutex(struct mutex* mutex);
 API void unlock_mutex(struct mutex* mutex);
 API void* mutex_get_ptr(struct mutex* mutex);
+
+struct semaphore;
+
+API struct semaphore* new_semaphore(u32 count);
+API void free_semaphore(struct semaphore* semaphore);
+API void semaphore_wait(struct semaphore* semaphore);
+API void semaphore_signal(struct semaphore* semaphore);
+
+API u32 get_cpu_count();
+API void thread_yield();
+
+/* Atomically add `value' to `target', returning the new value. */
+API i64 atomic_add(volatile i64* target, i64 value);
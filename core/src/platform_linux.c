@@ -3,7 +3,12 @@
 #include <string.h>
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 
@@ -129,6 +134,57 @@ u64 file_mod_time(const char* name) {
 	return 0;
 }
 
+bool make_dir(const char* name) {
+	return mkdir(name, 0755) == 0 || file_is_dir(name);
+}
+
+struct file_mapping {
+	void* data;
+	u64 size;
+};
+
+struct file_mapping* map_file(const char* name, const void** data, u64* size) {
+	i32 fd = open(name, O_RDONLY);
+	if (fd == -1) {
+		return null;
+	}
+
+	struct stat s;
+	if (fstat(fd, &s) == -1) {
+		close(fd);
+		return null;
+	}
+
+	void* ptr = null;
+	if (s.st_size > 0) {
+		ptr = mmap(null, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (ptr == MAP_FAILED) {
+			close(fd);
+			return null;
+		}
+	}
+
+	/* The mapping keeps the file alive by itself. */
+	close(fd);
+
+	struct file_mapping* mapping = core_alloc(sizeof(struct file_mapping));
+	mapping->data = ptr;
+	mapping->size = s.st_size;
+
+	*data = ptr;
+	*size = s.st_size;
+
+	return mapping;
+}
+
+void unmap_file(struct file_mapping* mapping) {
+	if (mapping->data) {
+		munmap(mapping->data, mapping->size);
+	}
+
+	core_free(mapping);
+}
+
 char* get_file_path(const char* name) {
 	char* r = core_alloc(256);
 
@@ -243,3 +299,42 @@ void unlock_mutex(struct mutex* mutex) {
 void* mutex_get_ptr(struct mutex* mutex) {
 	return mutex->data;
 }
+
+struct semaphore {
+	sem_t s;
+};
+
+struct semaphore* new_semaphore(u32 count) {
+	struct semaphore* semaphore = core_calloc(1, sizeof(struct semaphore));
+
+	sem_init(&semaphore->s, 0, count);
+
+	return semaphore;
+}
+
+void free_semaphore(struct semaphore* semaphore) {
+	sem_destroy(&semaphore->s);
+	core_free(semaphore);
+}
+
+void semaphore_wait(struct semaphore* semaphore) {
+	while (sem_wait(&semaphore->s) != 0) {}
+}
+
+void semaphore_signal(struct semaphore* semaphore) {
+	sem_post(&semaphore->s);
+}
+
+u32 get_cpu_count() {
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return count > 0 ? (u32)count : 1;
+}
+
+void thread_yield() {
+	sched_yield();
+}
+
+i64 atomic_add(volatile i64* target, i64 value) {
+	return __sync_add_and_fetch(target, value);
+}
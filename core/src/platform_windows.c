@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <stdio.h>
 
 #include <windows.h>
@@ -358,6 +359,10 @@ void window_make_context_current(struct window* window) {
 	wglMakeCurrent(window->device_context, window->render_context);
 }
 
+void* get_gl_proc(const char* name) {
+	return (void*)wglGetProcAddress(name);
+}
+
 void update_events(struct window* window) {
 	window->scroll = 0;
 
@@ -591,6 +596,68 @@ u64 file_mod_time(const char* name) {
 	return date.QuadPart / 10000000;
 }
 
+bool make_dir(const char* name) {
+	return CreateDirectoryA(name, null) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+struct file_mapping {
+	HANDLE file;
+	HANDLE mapping;
+	void* data;
+};
+
+struct file_mapping* map_file(const char* name, const void** data, u64* size) {
+	HANDLE file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, null, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, null);
+	if (file == INVALID_HANDLE_VALUE) {
+		return null;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size)) {
+		CloseHandle(file);
+		return null;
+	}
+
+	HANDLE handle = null;
+	void* ptr = null;
+
+	/* Empty files can't be mapped. */
+	if (file_size.QuadPart > 0) {
+		handle = CreateFileMappingA(file, null, PAGE_READONLY, 0, 0, null);
+		ptr = handle ? MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0) : null;
+
+		if (!ptr) {
+			if (handle) { CloseHandle(handle); }
+			CloseHandle(file);
+			return null;
+		}
+	}
+
+	struct file_mapping* mapping = core_alloc(sizeof(struct file_mapping));
+	mapping->file = file;
+	mapping->mapping = handle;
+	mapping->data = ptr;
+
+	*data = ptr;
+	*size = (u64)file_size.QuadPart;
+
+	return mapping;
+}
+
+void unmap_file(struct file_mapping* mapping) {
+	if (mapping->data) {
+		UnmapViewOfFile(mapping->data);
+	}
+
+	if (mapping->mapping) {
+		CloseHandle(mapping->mapping);
+	}
+
+	CloseHandle(mapping->file);
+
+	core_free(mapping);
+}
+
 u32 get_window_cursor(struct window* window) {
 	return window->cursor;
 }
@@ -756,4 +823,44 @@ void unlock_mutex(struct mutex* mutex) {
 
 void* mutex_get_ptr(struct mutex* mutex) {
 	return mutex->data;
-}
\ No newline at end of file
+}
+
+struct semaphore {
+	HANDLE handle;
+};
+
+struct semaphore* new_semaphore(u32 count) {
+	struct semaphore* semaphore = core_calloc(1, sizeof(struct semaphore));
+
+	semaphore->handle = CreateSemaphore(null, count, LONG_MAX, null);
+
+	return semaphore;
+}
+
+void free_semaphore(struct semaphore* semaphore) {
+	CloseHandle(semaphore->handle);
+	core_free(semaphore);
+}
+
+void semaphore_wait(struct semaphore* semaphore) {
+	WaitForSingleObject(semaphore->handle, INFINITE);
+}
+
+void semaphore_signal(struct semaphore* semaphore) {
+	ReleaseSemaphore(semaphore->handle, 1, null);
+}
+
+u32 get_cpu_count() {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+
+	return info.dwNumberOfProcessors > 0 ? (u32)info.dwNumberOfProcessors : 1;
+}
+
+void thread_yield() {
+	SwitchToThread();
+}
+
+i64 atomic_add(volatile i64* target, i64 value) {
+	return InterlockedExchangeAdd64(target, value) + value;
+}
@@ -290,6 +290,10 @@ void window_make_context_current(struct window* window) {
 	glXMakeCurrent(window->display, window->window, window->context);
 }
 
+void* get_gl_proc(const char* name) {
+	return (void*)glXGetProcAddress((const u8*)name);
+}
+
 i32 get_scroll(struct window* window) {
 	return window->scroll;
 }
@@ -1,23 +1,29 @@
 #include <math.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
 #include "core.h"
+#include "pack.h"
 #include "platform.h"
 #include "res.h"
 #include "util/stb_rect_pack.h"
 #include "util/stb_truetype.h"
 #include "video.h"
 
-#define batch_size 100
-#define els_per_vert 11
 #define verts_per_quad 4
 #define indices_per_quad 6
 
+#define quad_bytes (verts_per_quad * sizeof(struct quad_vertex))
+
+
 #define MAX_GLYPHSET 256
 
+/* Glyphs are pushed this many at a time. */
+#define text_batch_size 64
+
 struct color make_color(u32 rgb, u8 alpha) {
 	return (struct color) { (rgb >> 16) & 0xFF, (rgb >> 8) & 0xFF, rgb & 0xff, alpha };
 }
@@ -26,7 +32,172 @@ struct rect make_rect(i32 x, i32 y, i32 w, i32 h) {
 	return (struct rect) { x, y, w, h };
 }
 
-struct renderer* new_renderer(struct shader shader, v2i dimentions) {
+/* Expects the vertex buffer to be bound for editing. */
+static void configure_quad_vb(const struct vertex_buffer* vb) {
+	const u32 stride = sizeof(struct quad_vertex);
+
+	configure_vb_attrib(vb, 0, 2, vb_attrib_f32,      stride, offsetof(struct quad_vertex, x));     /* vec2 position */
+	configure_vb_attrib(vb, 1, 2, vb_attrib_u16_norm, stride, offsetof(struct quad_vertex, u));     /* vec2 uv */
+	configure_vb_attrib(vb, 2, 4, vb_attrib_u8_norm,  stride, offsetof(struct quad_vertex, color)); /* vec4 color */
+	configure_vb_attrib(vb, 3, 1, vb_attrib_u32,      stride, offsetof(struct quad_vertex, flags)); /* uint flags */
+}
+
+static u16 pack_uv(f32 t) {
+	t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+
+	return (u16)(t * 65535.0f + 0.5f);
+}
+
+static u32 quad_flags(i32 tidx, bool inverted, bool unlit) {
+	u32 flags = tidx < 0 ? quad_vertex_untextured : (u32)tidx;
+
+	if (inverted) { flags |= quad_vertex_inverted; }
+	if (unlit)    { flags |= quad_vertex_unlit; }
+
+	return flags;
+}
+
+static void write_quad_vertices(struct quad_vertex* verts, const f32* xs, const f32* ys,
+	f32 tx, f32 ty, f32 tw, f32 th, struct color color, u32 flags) {
+	const u16 u0 = pack_uv(tx), u1 = pack_uv(tx + tw);
+	const u16 v0 = pack_uv(ty), v1 = pack_uv(ty + th);
+
+	struct quad_vertex quad_verts[] = {
+		{ xs[0], ys[0], u0, v0, color, flags },
+		{ xs[1], ys[1], u1, v0, color, flags },
+		{ xs[2], ys[2], u1, v1, color, flags },
+		{ xs[3], ys[3], u0, v1, color, flags }
+	};
+
+	/* The batch may be mapped write-combined memory, so it is written
+	 * in one go, and never read back. */
+	memcpy(verts, quad_verts, sizeof quad_verts);
+}
+
+/* Quads that aren't rotated don't need a transform; Their corners are
+ * just offset from their position. The origin only matters to the
+ * rotation, but it is still applied the way the transform applies it,
+ * so that both give the same result. */
+static bool quad_axis_aligned(const struct textured_quad* quad) {
+	return quad->rotation == 0.0f;
+}
+
+static v2f quad_offset(const struct textured_quad* quad) {
+	if (quad->origin.x != 0.0f && quad->origin.y != 0.0f) {
+		return make_v2f(
+			quad->origin.x - (f32)quad->dimentions.x * quad->origin.x,
+			quad->origin.y - (f32)quad->dimentions.y * quad->origin.y);
+	}
+
+	return make_v2f(0.0f, 0.0f);
+}
+
+/* Writes the four vertices of a quad, as sampling from texture slot
+ * `tidx'. */
+static void quad_vertices(struct quad_vertex* verts, const struct textured_quad* quad, i32 tidx) {
+	f32 tx = 0, ty = 0, tw = 0, th = 0;
+
+	if (quad->texture) {
+		const struct texture* t = quad->texture;
+
+		tx = (f32)(quad->rect.x + (i32)t->x) / (f32)t->atlas_width;
+		ty = (f32)(quad->rect.y + (i32)t->y) / (f32)t->atlas_height;
+		tw = (f32)quad->rect.w / (f32)t->atlas_width;
+		th = (f32)quad->rect.h / (f32)t->atlas_height;
+	}
+
+	const u32 flags = quad_flags(tidx, quad->inverted, quad->unlit);
+
+	if (quad_axis_aligned(quad)) {
+		const v2f offset = quad_offset(quad);
+
+		const f32 x0 = (f32)quad->position.x + offset.x;
+		const f32 y0 = (f32)quad->position.y + offset.y;
+		const f32 x1 = x0 + (f32)quad->dimentions.x;
+		const f32 y1 = y0 + (f32)quad->dimentions.y;
+
+		const f32 xs[] = { x0, x1, x1, x0 };
+		const f32 ys[] = { y0, y0, y1, y1 };
+
+		write_quad_vertices(verts, xs, ys, tx, ty, tw, th, quad->color, flags);
+		return;
+	}
+
+	const bool use_origin = quad->origin.x != 0.0f && quad->origin.y != 0.0f;
+
+	m4f transform = m4f_translate(m4f_identity(), (v3f) { (f32)quad->position.x, (f32)quad->position.y, 0.0f });
+
+	transform = use_origin ? m4f_translate(transform, (v3f) { quad->origin.x, quad->origin.y, 0.0f }) : transform;
+
+	if (quad->rotation != 0.0f) {
+		transform = m4f_rotate(transform, toradf(quad->rotation), (v3f) { 0.0f, 0.0f, 1.0f });
+	}
+
+	transform = m4f_scale(transform, (v3f) { (f32)quad->dimentions.x, (f32)quad->dimentions.y, 0.0f });
+	transform = use_origin ? m4f_translate(transform, (v3f) {-quad->origin.x, -quad->origin.y, 0.0f }) : transform;
+
+	const v4f p0 = m4f_transform(transform, make_v4f(0.0f, 0.0f, 0.0f, 1.0f));
+	const v4f p1 = m4f_transform(transform, make_v4f(1.0f, 0.0f, 0.0f, 1.0f));
+	const v4f p2 = m4f_transform(transform, make_v4f(1.0f, 1.0f, 0.0f, 1.0f));
+	const v4f p3 = m4f_transform(transform, make_v4f(0.0f, 1.0f, 0.0f, 1.0f));
+
+	const f32 xs[] = { p0.x, p1.x, p2.x, p3.x };
+	const f32 ys[] = { p0.y, p1.y, p2.y, p3.y };
+
+	write_quad_vertices(verts, xs, ys, tx, ty, tw, th, quad->color, flags);
+}
+
+static void quad_indices(u32* indices, u32 quad_index) {
+	const u32 idx_off = quad_index * verts_per_quad;
+
+	indices[0] = idx_off + 3;
+	indices[1] = idx_off + 2;
+	indices[2] = idx_off + 1;
+	indices[3] = idx_off + 3;
+	indices[4] = idx_off + 1;
+	indices[5] = idx_off + 0;
+}
+
+/* Every quad is drawn with the same six indices, offset by where its
+ * vertices are, so one index buffer, long enough for the biggest batch,
+ * is shared by every renderer, quad mesh and post processor. It is made
+ * with the first of them and freed with the last. */
+static struct index_buffer quad_ib;
+static u32 quad_ib_users;
+
+static const struct index_buffer* retain_quad_ib() {
+	if (quad_ib_users++ == 0) {
+		u32* indices = core_alloc(renderer_max_batch_size * indices_per_quad * sizeof(u32));
+
+		for (u32 i = 0; i < renderer_max_batch_size; i++) {
+			quad_indices(indices + i * indices_per_quad, i);
+		}
+
+		init_ib(&quad_ib, indices, renderer_max_batch_size * indices_per_quad);
+
+		core_free(indices);
+	}
+
+	return &quad_ib;
+}
+
+static void release_quad_ib() {
+	if (--quad_ib_users == 0) {
+		deinit_ib(&quad_ib);
+	}
+}
+
+static void begin_batch(struct renderer* renderer) {
+	u32 capacity;
+	/* A batch is never started with room for fewer than a quarter of
+	 * the batch size. */
+	renderer->verts = stream_vb_begin(&renderer->stream, (renderer->batch_size / 4) * quad_bytes, &capacity);
+
+	capacity /= quad_bytes;
+	renderer->batch_capacity = capacity < renderer->batch_size ? capacity : renderer->batch_size;
+}
+
+struct renderer* new_renderer(struct shader shader, v2i dimentions, u32 batch_size) {
 	struct renderer* renderer = core_calloc(1, sizeof(struct renderer));
 
 	renderer->quad_count = 0;
@@ -34,18 +205,20 @@ struct renderer* new_renderer(struct shader shader, v2i dimentions) {
 
 	renderer->ambient_light = 1.0f;
 
-	init_vb(&renderer->vb, vb_dynamic | vb_tris);
-	bind_vb_for_edit(&renderer->vb);
-	push_vertices(&renderer->vb, null, els_per_vert * verts_per_quad * batch_size);
-	push_indices(&renderer->vb, null, indices_per_quad * batch_size);
-	configure_vb(&renderer->vb, 0, 2, els_per_vert, 0);  /* vec2 position */
-	configure_vb(&renderer->vb, 1, 2, els_per_vert, 2);  /* vec2 uv */
-	configure_vb(&renderer->vb, 2, 4, els_per_vert, 4);  /* vec4 color */
-	configure_vb(&renderer->vb, 3, 1, els_per_vert, 8);  /* f32 texture_id */
-	configure_vb(&renderer->vb, 4, 1, els_per_vert, 9);  /* f32 inverted */
-	configure_vb(&renderer->vb, 5, 1, els_per_vert, 10); /* f32 unlit */
+	if (batch_size == 0 || batch_size > renderer_max_batch_size) {
+		batch_size = renderer_max_batch_size;
+	}
+
+	renderer->batch_size = batch_size;
+
+	init_stream_vb(&renderer->stream, vb_dynamic | vb_tris, batch_size * quad_bytes);
+	bind_vb_for_edit(&renderer->stream.vb);
+	use_shared_ib(&renderer->stream.vb, retain_quad_ib());
+	configure_quad_vb(&renderer->stream.vb);
 	bind_vb_for_edit(null);
 
+	begin_batch(renderer);
+
 	renderer->clip_enable = false;
 	renderer->camera_enable = false;
 
@@ -62,14 +235,15 @@ struct renderer* new_renderer(struct shader shader, v2i dimentions) {
 }
 
 void free_renderer(struct renderer* renderer) {
-	deinit_vb(&renderer->vb);
+	deinit_stream_vb(&renderer->stream);
+	release_quad_ib();
 
 	core_free(renderer);
 }
 
-void renderer_flush(struct renderer* renderer) {
-	if (renderer->quad_count == 0) { return; }
-
+/* Binds the shader of the renderer, and sets everything that it needs
+ * to draw quads that sample from `textures'. */
+static void bind_renderer_state(struct renderer* renderer, struct texture* const* textures, u32 texture_count) {
 	if (renderer->clip_enable) {
 		video_enable(vt_clip);
 		video_clip((struct rect) { renderer->clip.x, renderer->dimentions.y - (renderer->clip.y + renderer->clip.h),
@@ -80,8 +254,8 @@ void renderer_flush(struct renderer* renderer) {
 
 	bind_shader(&renderer->shader);
 
-	for (u32 i = 0; i < renderer->texture_count; i++) {
-		bind_texture(renderer->textures[i], i);
+	for (u32 i = 0; i < texture_count; i++) {
+		bind_texture(textures[i], i);
 
 		char name[32];
 		sprintf(name, "textures[%u]", i);
@@ -116,20 +290,27 @@ void renderer_flush(struct renderer* renderer) {
 	} else {
 		shader_set_m4f(&renderer->shader, "view", m4f_identity());
 	}
+}
 
-	bind_vb_for_edit(&renderer->vb);
-	update_vertices(&renderer->vb, renderer->verts, 0, renderer->quad_count * els_per_vert * verts_per_quad);
-	update_indices(&renderer->vb, renderer->indices, 0, renderer->quad_count * indices_per_quad);
+void renderer_flush(struct renderer* renderer) {
+	if (renderer->quad_count == 0) { return; }
+
+	bind_renderer_state(renderer, renderer->textures, renderer->texture_count);
+
+	bind_vb_for_edit(&renderer->stream.vb);
+	u32 offset = stream_vb_commit(&renderer->stream, renderer->quad_count * quad_bytes);
 	bind_vb_for_edit(null);
 
-	bind_vb_for_draw(&renderer->vb);
-	draw_vb_n(&renderer->vb, renderer->quad_count * indices_per_quad);
+	bind_vb_for_draw(&renderer->stream.vb);
+	draw_vb_n_base(&renderer->stream.vb, renderer->quad_count * indices_per_quad, offset / (quad_bytes / verts_per_quad));
 	bind_vb_for_draw(null);
 	bind_shader(null);
 
 	renderer->quad_count = 0;
 	renderer->texture_count = 0;
 
+	begin_batch(renderer);
+
 	video_disable(vt_clip);
 }
 
@@ -147,86 +328,46 @@ void renderer_push_light(struct renderer* renderer, struct light light) {
 	renderer->lights[renderer->light_count++] = light;
 }
 
-void renderer_push(struct renderer* renderer, struct textured_quad* quad) {
-	f32 tx = 0, ty = 0, tw = 0, th = 0;
+/* Finds the slot of a texture in the batch, or gives it a new one.
+ * Returns false if every slot is taken. */
+static bool texture_slot(struct renderer* renderer, struct texture* texture, i32* tidx) {
+	*tidx = -1;
+	if (!texture) { return true; }
 
-	i32 tidx = -1;
-	if (quad->texture) {
-		for (u32 i = 0; i < renderer->texture_count; i++) {
-			if (renderer->textures[i] == quad->texture) {
-				tidx = (i32)i;
-				break;
-			}
-		}
-
-		if (tidx == -1) {
-			renderer->textures[renderer->texture_count] = quad->texture;
-			tidx = renderer->texture_count;
-
-			renderer->texture_count++;
-
-			if (renderer->texture_count >= 32) {
-				renderer_flush(renderer);
-				tidx = 0;
-				renderer->textures[0] = quad->texture;
-			}
+	/* Compare by ID rather than by pointer, so that textures that
+	 * share an atlas also share a slot. */
+	for (u32 i = 0; i < renderer->texture_count; i++) {
+		if (renderer->textures[i]->id == texture->id) {
+			*tidx = (i32)i;
+			return true;
 		}
-
-		tx = (f32)quad->rect.x/ (f32)quad->texture->width;
-		ty = (f32)quad->rect.y/ (f32)quad->texture->height;
-		tw = (f32)quad->rect.w/ (f32)quad->texture->width;
-		th = (f32)quad->rect.h/ (f32)quad->texture->height;
 	}
 
-	const f32 r = (f32)quad->color.r / 255.0f;
-	const f32 g = (f32)quad->color.g / 255.0f;
-	const f32 b = (f32)quad->color.b / 255.0f;
-	const f32 a = (f32)quad->color.a / 255.0f;
+	if (renderer->texture_count >= 32) { return false; }
 
-	const f32 w = (f32)quad->dimentions.x;
-	const f32 h = (f32)quad->dimentions.y;
-	const f32 x = (f32)quad->position.x;
-	const f32 y = (f32)quad->position.y;
+	*tidx = (i32)renderer->texture_count;
+	renderer->textures[renderer->texture_count++] = texture;
 
-	const bool use_origin = quad->origin.x != 0.0f && quad->origin.y != 0.0f;
-
-	m4f transform = m4f_translate(m4f_identity(), (v3f) { (f32)quad->position.x, (f32)quad->position.y, 0.0f });
-
-	transform = use_origin ? m4f_translate(transform, (v3f) { quad->origin.x, quad->origin.y, 0.0f }) : transform;
-
-	if (quad->rotation != 0.0f) {
-		transform = m4f_rotate(transform, toradf(quad->rotation), (v3f) { 0.0f, 0.0f, 1.0f });
-	}
-
-	transform = m4f_scale(transform, (v3f) { (f32)quad->dimentions.x, (f32)quad->dimentions.y, 0.0f });
-	transform = use_origin ? m4f_translate(transform, (v3f) {-quad->origin.x, -quad->origin.y, 0.0f }) : transform;
-
-	const v4f p0 = m4f_transform(transform, make_v4f(0.0f, 0.0f, 0.0f, 1.0f));
-	const v4f p1 = m4f_transform(transform, make_v4f(1.0f, 0.0f, 0.0f, 1.0f));
-	const v4f p2 = m4f_transform(transform, make_v4f(1.0f, 1.0f, 0.0f, 1.0f));
-	const v4f p3 = m4f_transform(transform, make_v4f(0.0f, 1.0f, 0.0f, 1.0f));
-
-	f32 verts[] = {
-		p0.x, p0.y, tx, ty,           r, g, b, a, (f32)tidx, (f32)quad->inverted, (f32)quad->unlit,
-		p1.x, p1.y, tx + tw, ty,      r, g, b, a, (f32)tidx, (f32)quad->inverted, (f32)quad->unlit,
-		p2.x, p2.y, tx + tw, ty + th, r, g, b, a, (f32)tidx, (f32)quad->inverted, (f32)quad->unlit,
-		p3.x, p3.y, tx, ty + th,      r, g, b, a, (f32)tidx, (f32)quad->inverted, (f32)quad->unlit
-	};
-
-	const u32 idx_off = renderer->quad_count * verts_per_quad;
+	return true;
+}
 
-	u32 indices[] = {
-		idx_off + 3, idx_off + 2, idx_off + 1,
-		idx_off + 3, idx_off + 1, idx_off + 0
-	};
+void renderer_push(struct renderer* renderer, struct textured_quad* quad) {
+	renderer_push_n(renderer, quad, 1);
+}
 
-	memcpy(renderer->verts + (renderer->quad_count * els_per_vert * verts_per_quad), verts, els_per_vert * verts_per_quad * sizeof(f32));
-	memcpy(renderer->indices + (renderer->quad_count * indices_per_quad), indices, indices_per_quad * sizeof(u32));
+void renderer_push_n(struct renderer* renderer, const struct textured_quad* quads, u32 count) {
+	for (u32 i = 0; i < count; i++) {
+		i32 tidx;
+		if (!texture_slot(renderer, quads[i].texture, &tidx)) {
+			renderer_flush(renderer);
+			texture_slot(renderer, quads[i].texture, &tidx);
+		}
 
-	renderer->quad_count++;
+		quad_vertices(renderer->verts + renderer->quad_count * verts_per_quad, quads + i, tidx);
 
-	if (renderer->quad_count >= batch_size) {
-		renderer_flush(renderer);
+		if (++renderer->quad_count >= renderer->batch_capacity) {
+			renderer_flush(renderer);
+		}
 	}
 }
 
@@ -252,6 +393,103 @@ void renderer_fit_to_main_window(struct renderer* renderer) {
 	renderer_resize(renderer, make_v2i(win_w, win_h));
 }
 
+void init_quad_mesh(struct quad_mesh* mesh, const struct textured_quad* quads, u32 count) {
+	memset(mesh, 0, sizeof(struct quad_mesh));
+
+	if (count == 0) { return; }
+
+	struct quad_vertex* verts = core_alloc(count * quad_bytes);
+
+	for (u32 i = 0; i < count; i++) {
+		const struct textured_quad* quad = quads + i;
+
+		i32 tidx = -1;
+		if (quad->texture) {
+			for (u32 ii = 0; ii < mesh->texture_count; ii++) {
+				if (mesh->textures[ii]->id == quad->texture->id) {
+					tidx = (i32)ii;
+					break;
+				}
+			}
+
+			if (tidx == -1) {
+				if (mesh->texture_count >= 32) {
+					fprintf(stderr, "Too many textures in one mesh! Max: 32\n");
+				} else {
+					tidx = mesh->texture_count;
+					mesh->textures[mesh->texture_count++] = quad->texture;
+				}
+			}
+		}
+
+		quad_vertices(verts + i * verts_per_quad, quad, tidx);
+	}
+
+	mesh->quad_count = count;
+
+	init_vb(&mesh->vb, vb_static | vb_tris);
+	bind_vb_for_edit(&mesh->vb);
+	push_vertices(&mesh->vb, (f32*)verts, count * quad_bytes / sizeof(f32));
+
+	/* Only a mesh that is bigger than the biggest batch needs indices
+	 * of its own. */
+	if (count <= renderer_max_batch_size) {
+		use_shared_ib(&mesh->vb, retain_quad_ib());
+	} else {
+		u32* indices = core_alloc(count * indices_per_quad * sizeof(u32));
+
+		for (u32 i = 0; i < count; i++) {
+			quad_indices(indices + i * indices_per_quad, i);
+		}
+
+		push_indices(&mesh->vb, indices, count * indices_per_quad);
+
+		core_free(indices);
+	}
+
+	configure_quad_vb(&mesh->vb);
+	bind_vb_for_edit(null);
+
+	core_free(verts);
+}
+
+void deinit_quad_mesh(struct quad_mesh* mesh) {
+	if (mesh->quad_count > 0) {
+		if (mesh->vb.flags & vb_shared_indices) {
+			release_quad_ib();
+		}
+
+		deinit_vb(&mesh->vb);
+	}
+
+	mesh->quad_count = 0;
+}
+
+u64 quad_mesh_size(const struct quad_mesh* mesh) {
+	u64 size = (u64)mesh->quad_count * quad_bytes;
+
+	if (!(mesh->vb.flags & vb_shared_indices)) {
+		size += (u64)mesh->quad_count * indices_per_quad * sizeof(u32);
+	}
+
+	return size;
+}
+
+void renderer_draw_quad_mesh(struct renderer* renderer, const struct quad_mesh* mesh) {
+	if (mesh->quad_count == 0) { return; }
+
+	renderer_flush(renderer);
+
+	bind_renderer_state(renderer, mesh->textures, mesh->texture_count);
+
+	bind_vb_for_draw(&mesh->vb);
+	draw_vb_n(&mesh->vb, mesh->quad_count * indices_per_quad);
+	bind_vb_for_draw(null);
+	bind_shader(null);
+
+	video_disable(vt_clip);
+}
+
 struct post_processor* new_post_processor(struct shader shader) {
 	struct post_processor* p = core_calloc(1, sizeof(struct post_processor));
 
@@ -271,15 +509,10 @@ struct post_processor* new_post_processor(struct shader shader) {
 		-1.0f,  1.0f, 0.0f, 1.0f
 	};
 
-	u32 indices[] = {
-		3, 2, 1,
-		3, 1, 0
-	};
-
 	init_vb(&p->vb, vb_static | vb_tris);
 	bind_vb_for_edit(&p->vb);
 	push_vertices(&p->vb, verts, 4 * 4);
-	push_indices(&p->vb, indices, 6);
+	use_shared_ib(&p->vb, retain_quad_ib());
 	configure_vb(&p->vb, 0, 2, 4, 0);
 	configure_vb(&p->vb, 1, 2, 4, 2);
 	bind_vb_for_edit(null);
@@ -290,6 +523,7 @@ struct post_processor* new_post_processor(struct shader shader) {
 void free_post_processor(struct post_processor* p) {
 	deinit_render_target(&p->target);
 	deinit_vb(&p->vb);
+	release_quad_ib();
 
 	core_free(p);
 }
@@ -326,7 +560,7 @@ void flush_post_processor(struct post_processor* p, bool default_rt) {
 	bind_render_target_output(&p->target, 0);
 
 	bind_vb_for_draw(&p->vb);
-	draw_vb(&p->vb);
+	draw_vb_n(&p->vb, indices_per_quad);
 	bind_vb_for_draw(null);
 
 	bind_shader(null);
@@ -335,6 +569,9 @@ void flush_post_processor(struct post_processor* p, bool default_rt) {
 struct glyph_set {
 	struct texture atlas;
 	stbtt_bakedchar glyphs[256];
+
+	/* Baked, but not yet uploaded to the atlas. */
+	struct image image;
 };
 
 struct font {
@@ -361,7 +598,7 @@ static const char* utf8_to_codepoint(const char* p, u32* dst) {
 	return p + 1;
 }
 
-static struct glyph_set* load_glyph_set(struct font* font, i32 idx) {
+static struct glyph_set* bake_glyph_set(struct font* font, i32 idx) {
 	i32 width, height, r, ascent, descent, linegap, scaled_ascent, i;
 	unsigned char n;
 	f32 scale, s;
@@ -402,58 +639,224 @@ retry:
 		pixels[i] = (struct color) {255, 255, 255, n};
 	}
 
-	init_texture_no_bmp(&set->atlas, (u8*)pixels, width, height, sprite_texture | texture_rgba);
-
-	core_free(pixels);
+	set->image = (struct image) {
+		.pixels = (u8*)pixels,
+		.width = width,
+		.height = height,
+		.flags = sprite_texture | texture_rgba
+	};
 
 	return set;
 }
 
+static void upload_glyph_set(struct glyph_set* set) {
+	if (!set->image.pixels) { return; }
+
+	init_texture_from_image(&set->atlas, &set->image);
+	deinit_image(&set->image);
+}
+
+/* Glyph sets other than the first are baked on demand, when text
+ * that needs them is drawn or measured. */
 static struct glyph_set* get_glyph_set(struct font* font, i32 code_poi32) {
 	i32 idx;
 	
 	idx = (code_poi32 >> 8) % MAX_GLYPHSET;
 	if (!font->sets[idx]) {
-		font->sets[idx] = load_glyph_set(font, idx);
+		font->sets[idx] = bake_glyph_set(font, idx);
+		upload_glyph_set(font->sets[idx]);
 	}
 	return font->sets[idx];
 }
 
 struct font* load_font_from_memory(void* data, u64 filesize, f32 size) {
-	struct font* font;
-	i32 r, ascent, descent, linegap;
-	f32 scale;
+	struct font* font = decode_font(data, filesize, size);
+	if (font) {
+		upload_font(font);
+	}
 
-	font = core_calloc(1, sizeof(struct font));
-	font->data = data;
+	return font;
+}
+
+void upload_font(struct font* font) {
+	for (i32 i = 0; i < MAX_GLYPHSET; i++) {
+		if (font->sets[i]) {
+			upload_glyph_set(font->sets[i]);
+		}
+	}
+}
 
+/* Set up a font without baking any glyphs. */
+static struct font* new_font(void* data, f32 size) {
+	i32 ascent, descent, linegap;
+
+	struct font* font = core_calloc(1, sizeof(struct font));
+	font->data = data;
 	font->size = size;
 
-	r = stbtt_InitFont(&font->info, font->data, 0);
-	if (!r) {
-		goto fail;
+	if (!stbtt_InitFont(&font->info, font->data, 0)) {
+		core_free(font->data);
+		core_free(font);
+		return null;
 	}
 
 	stbtt_GetFontVMetrics(&font->info, &ascent, &descent, &linegap);
-	scale = stbtt_ScaleForMappingEmToPixels(&font->info, size);
+	f32 scale = stbtt_ScaleForMappingEmToPixels(&font->info, size);
 	font->height = (i32)((ascent - descent + linegap) * scale + 0.5);
 
-	stbtt_bakedchar* g = get_glyph_set(font, '\n')->glyphs;
+	return font;
+}
+
+static void finish_font(struct font* font) {
+	stbtt_bakedchar* g = font->sets[0]->glyphs;
 	g['\t'].x1 = g['\t'].x0;
 	g['\n'].x1 = g['\n'].x0;
 
 	set_font_tab_size(font, 8);
+}
+
+struct font* decode_font(void* data, u64 filesize, f32 size) {
+	struct font* font = new_font(data, size);
+	if (!font) { return null; }
+
+	font->sets[0] = bake_glyph_set(font, 0);
+
+	finish_font(font);
 
 	return font;
+}
+
+/* Read the glyph sets that the packer baked. Anything that isn't
+ * well formed is left for bake_glyph_set. */
+static void read_cooked_glyph_sets(struct font* font, const u8* cooked, u64 cooked_size) {
+	struct pack_font header;
+	if (cooked_size < sizeof(header)) { return; }
+
+	memcpy(&header, cooked, sizeof(header));
+	if (memcmp(header.magic, pack_font_magic, sizeof(header.magic)) != 0) { return; }
+
+	const u8* cur = cooked + sizeof(header);
+	const u8* end = cooked + cooked_size;
+
+	for (u32 i = 0; i < header.set_count; i++) {
+		struct pack_glyph_set set_header;
+		if ((u64)(end - cur) < sizeof(set_header)) { return; }
+
+		memcpy(&set_header, cur, sizeof(set_header));
+		cur += sizeof(set_header);
+
+		u64 pixels_size = (u64)set_header.width * set_header.height * sizeof(struct color);
+		u64 glyphs_size = sizeof(((struct glyph_set*)null)->glyphs);
+
+		if (set_header.page >= MAX_GLYPHSET || (u64)(end - cur) < glyphs_size + pixels_size) { return; }
+
+		struct glyph_set* set = core_calloc(1, sizeof(struct glyph_set));
+
+		memcpy(set->glyphs, cur, glyphs_size);
+		cur += glyphs_size;
+
+		set->image = (struct image) {
+			.pixels = core_alloc(pixels_size),
+			.width = set_header.width,
+			.height = set_header.height,
+			.flags = sprite_texture | texture_rgba
+		};
+
+		memcpy(set->image.pixels, cur, pixels_size);
+		cur += pixels_size;
+
+		if (font->sets[set_header.page]) {
+			deinit_image(&font->sets[set_header.page]->image);
+			core_free(font->sets[set_header.page]);
+		}
+
+		font->sets[set_header.page] = set;
+	}
+}
+
+struct font* decode_cooked_font(void* data, u64 filesize, f32 size, u8* cooked, u64 cooked_size) {
+	struct font* font = new_font(data, size);
 
-fail:
 	if (font) {
-		if (font->data) {
-			core_free(font->data);
+		read_cooked_glyph_sets(font, cooked, cooked_size);
+
+		if (!font->sets[0]) {
+			font->sets[0] = bake_glyph_set(font, 0);
 		}
-		core_free(font);
+
+		finish_font(font);
 	}
-	return null;
+
+	core_free(cooked);
+
+	return font;
+}
+
+u8* cook_font(void* data, u64 filesize, f32 size, const u32* pages, u32 page_count, u64* cooked_size) {
+	*cooked_size = 0;
+
+	u8* copy = core_alloc(filesize);
+	memcpy(copy, data, filesize);
+
+	struct font* font = new_font(copy, size);
+	if (!font) { return null; }
+
+	u64 total = sizeof(struct pack_font);
+
+	for (u32 i = 0; i < page_count; i++) {
+		u32 page = pages[i] % MAX_GLYPHSET;
+		if (!font->sets[page]) {
+			font->sets[page] = bake_glyph_set(font, page);
+			total += sizeof(struct pack_glyph_set) + sizeof(font->sets[page]->glyphs) +
+				(u64)font->sets[page]->image.width * font->sets[page]->image.height * sizeof(struct color);
+		}
+	}
+
+	u8* cooked = core_alloc(total);
+	u8* cur = cooked;
+
+	struct pack_font header = { .magic = pack_font_magic };
+	for (u32 i = 0; i < MAX_GLYPHSET; i++) {
+		header.set_count += font->sets[i] != null;
+	}
+
+	memcpy(cur, &header, sizeof(header));
+	cur += sizeof(header);
+
+	for (u32 i = 0; i < MAX_GLYPHSET; i++) {
+		struct glyph_set* set = font->sets[i];
+		if (!set) { continue; }
+
+		struct pack_glyph_set set_header = {
+			.page = i,
+			.width = set->image.width,
+			.height = set->image.height
+		};
+
+		u64 pixels_size = (u64)set->image.width * set->image.height * sizeof(struct color);
+
+		memcpy(cur, &set_header, sizeof(set_header));
+		cur += sizeof(set_header);
+		memcpy(cur, set->glyphs, sizeof(set->glyphs));
+		cur += sizeof(set->glyphs);
+		memcpy(cur, set->image.pixels, pixels_size);
+		cur += pixels_size;
+	}
+
+	/* Nothing was uploaded, and there might not be a GPU to free it
+	 * from, so free_font can't be used. */
+	for (u32 i = 0; i < MAX_GLYPHSET; i++) {
+		if (font->sets[i]) {
+			deinit_image(&font->sets[i]->image);
+			core_free(font->sets[i]);
+		}
+	}
+
+	core_free(font->data);
+	core_free(font);
+
+	*cooked_size = total;
+	return cooked;
 }
 
 void free_font(struct font* font) {
@@ -464,6 +867,7 @@ void free_font(struct font* font) {
 		set = font->sets[i];
 		if (set) {
 			deinit_texture(&set->atlas);
+			deinit_image(&set->image);
 			core_free(set);
 		}
 	}
@@ -490,6 +894,19 @@ f32 get_font_size(struct font* font) {
 	return font->size;
 }
 
+u64 get_font_atlas_size(struct font* font) {
+	u64 size = 0;
+
+	for (i32 i = 0; i < MAX_GLYPHSET; i++) {
+		struct glyph_set* set = font->sets[i];
+		if (set) {
+			size += (u64)set->atlas.width * set->atlas.height * 4;
+		}
+	}
+
+	return size;
+}
+
 i32 font_height(struct font* font) {
 	return font->height;
 }
@@ -586,6 +1003,9 @@ i32 render_text(struct renderer* renderer, struct font* font,
 	stbtt_bakedchar* g;
 	i32 ori_x = x;
 
+	struct textured_quad quads[text_batch_size];
+	u32 quad_count = 0;
+
 	p = text;
 	while (*p) {
 		if (*p == '\n') {
@@ -604,7 +1024,12 @@ i32 render_text(struct renderer* renderer, struct font* font,
 		i32 w = g->x1 - g->x0;
 		i32 h = g->y1 - g->y0;
 		
-		struct textured_quad quad = {
+		if (quad_count >= text_batch_size) {
+			renderer_push_n(renderer, quads, quad_count);
+			quad_count = 0;
+		}
+
+		quads[quad_count++] = (struct textured_quad) {
 			.texture = &set->atlas,
 			.position = { x + (i32)g->xoff, y + (i32)g->yoff },
 			.dimentions = { w, h },
@@ -613,10 +1038,11 @@ i32 render_text(struct renderer* renderer, struct font* font,
 			.unlit = true
 		};
 
-		renderer_push(renderer, &quad);
 		x += (i32)g->xadvance;
 	}
 
+	renderer_push_n(renderer, quads, quad_count);
+
 	return x;
 }
 
@@ -628,6 +1054,9 @@ i32 render_text_n(struct renderer* renderer, struct font* font,
 	stbtt_bakedchar* g;
 	i32 ori_x = x;
 
+	struct textured_quad quads[text_batch_size];
+	u32 quad_count = 0;
+
 	p = text;
 	for (u32 i = 0; i < n && *p; i++) {
 		if (*p == '\n') {
@@ -646,7 +1075,12 @@ i32 render_text_n(struct renderer* renderer, struct font* font,
 		i32 w = g->x1 - g->x0;
 		i32 h = g->y1 - g->y0;
 		
-		struct textured_quad quad = {
+		if (quad_count >= text_batch_size) {
+			renderer_push_n(renderer, quads, quad_count);
+			quad_count = 0;
+		}
+
+		quads[quad_count++] = (struct textured_quad) {
 			.texture = &set->atlas,
 			.position = { x + (i32)g->xoff, y + (i32)g->yoff },
 			.dimentions = { w, h },
@@ -655,10 +1089,11 @@ i32 render_text_n(struct renderer* renderer, struct font* font,
 			.unlit = true
 		};
 
-		renderer_push(renderer, &quad);
 		x += (i32)g->xadvance;
 	}
 
+	renderer_push_n(renderer, quads, quad_count);
+
 	return x;
 }
 
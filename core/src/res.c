@@ -3,8 +3,14 @@
 #include <string.h>
 
 #include "core.h"
+#include "jobs.h"
+#include "lz.h"
+#include "pack.h"
+#include "platform.h"
 #include "res.h"
+#include "video.h"
 #include "table.h"
+#include "vector.h"
 
 static const char* package_path = "res.pck";
 
@@ -41,156 +47,566 @@ bool read_raw_no_pck(const char* path, u8** buf, u64* size, bool term) {
 	return true;
 }
 
+/* The trace is written to from any thread that reads files, so it is
+ * guarded by its own mutex, which lives until res_deinit. */
+static struct mutex* trace_mutex;
+static FILE* trace_file;
+static struct table* trace_seen;
+
+bool res_trace_begin(const char* path) {
+	if (!trace_mutex) {
+		trace_mutex = new_mutex(0);
+	}
+
+	res_trace_end();
+
+	FILE* file = fopen(path, "a");
+	if (!file) {
+		fprintf(stderr, "Failed to open `%s' for writing.\n", path);
+		return false;
+	}
+
+	lock_mutex(trace_mutex);
+	trace_file = file;
+	trace_seen = new_table(sizeof(bool));
+	unlock_mutex(trace_mutex);
+
+	return true;
+}
+
+void res_trace_end() {
+	if (!trace_mutex) { return; }
+
+	lock_mutex(trace_mutex);
+
+	if (trace_file) {
+		fclose(trace_file);
+		free_table(trace_seen);
+
+		trace_file = null;
+		trace_seen = null;
+	}
+
+	unlock_mutex(trace_mutex);
+}
+
+void res_trace_group(const char* name) {
+	if (!trace_mutex) { return; }
+
+	lock_mutex(trace_mutex);
+
+	if (trace_file) {
+		fprintf(trace_file, "> %s\n", name);
+	}
+
+	unlock_mutex(trace_mutex);
+}
+
+static void trace_access(const char* path) {
+	if (!trace_mutex) { return; }
+
+	lock_mutex(trace_mutex);
+
+	if (trace_file && !table_get(trace_seen, path)) {
+		bool seen = true;
+		table_set(trace_seen, path, &seen);
+
+		fprintf(trace_file, "%s\n", path);
+	}
+
+	unlock_mutex(trace_mutex);
+}
+
 #if DEBUG
 bool read_raw(const char* path, u8** buf, u64* size, bool term) {
+	trace_access(path);
+
 	return read_raw_no_pck(path, buf, size, term);
 }
 
 struct file file_open(const char* path) {
-	FILE* handle = fopen(path, "rb");
-	if (!handle) {
+	trace_access(path);
+
+	const void* data;
+	u64 size;
+	struct file_mapping* mapping = map_file(path, &data, &size);
+	if (!mapping) {
 		return (struct file) { 0 };
 	}
 
-	fseek(handle, 0, SEEK_END);
-	u64 size = ftell(handle);
-	fseek(handle, 0, SEEK_SET);
-
-	return (struct file) { handle, 0, 0, size };
+	return (struct file) { .data = data, .size = size, .mapping = mapping };
 }
 
-bool file_good(struct file* file) {
-	return file->handle != null;
+/* Atlases are only baked by the packer. */
+static struct pack_atlas_region* find_region(const char* path) {
+	return null;
 }
 
-void file_close(struct file* file) {
-	fclose(file->handle);
-	file->handle = null;
+/* Neither are fonts. */
+static bool read_cooked_font(const char* path, f32 size, u8** buf, u64* buf_size) {
+	return false;
 }
 
-u64 file_seek(struct file* file, u64 offset) {
-	file->cursor = offset;
-	return file->cursor;
+/* There is no package to read from, so there is always a copy. */
+static bool view_raw(const char* path, const u8** data, u64* size, u8** owned) {
+	bool ok = read_raw(path, owned, size, false);
+	*data = *owned;
+
+	return ok;
 }
+#else
+struct package {
+	struct file_mapping* mapping;
+	const u8* data;
+	u64 size;
 
-u64 file_read(void* buf, u64 size, u64 count, struct file* file) {
-	fseek(file->handle, (i32)(file->pk_offset + file->cursor), SEEK_SET);
+	const struct pack_entry* entries;
+	u64 entry_count;
 
-	file->cursor += size * count;
+	bool regions_loaded;
+	struct pack_atlas_region* regions;
+	u64 region_count;
+};
+
+static struct package package;
+
+/* The package is mapped into memory, so once it is open, any thread
+ * can read from it without locking. Opening it happens on first use,
+ * which can be on a worker thread. read_raw can be used before
+ * res_init, on the main thread, in which case there is nothing to
+ * lock. */
+static struct mutex* package_mutex;
 
-	return fread(buf, size, count, file->handle);
+static void lock_package() {
+	if (package_mutex) { lock_mutex(package_mutex); }
 }
-#else
-bool read_raw(const char* path, u8** buf, u64* size, bool term) {
-	FILE* file = fopen(package_path, "rb");
-	if (!file) {
+
+static void unlock_package() {
+	if (package_mutex) { unlock_mutex(package_mutex); }
+}
+
+static bool open_package() {
+	if (package.mapping) { return true; }
+
+	const void* data;
+	u64 size;
+	struct file_mapping* mapping = map_file(package_path, &data, &size);
+	if (!mapping) {
 		fprintf(stderr, "Failed to open `%s'\n", package_path);
 		return false;
 	}
 
-	fseek(file, 0, SEEK_SET);
+	struct pack_header header = { 0 };
+	if (size >= sizeof(header)) {
+		memcpy(&header, data, sizeof(header));
+	}
+
+	if (memcmp(header.magic, pack_magic, sizeof(header.magic)) != 0) {
+		fprintf(stderr, "`%s' is not a valid package.\n", package_path);
+		unmap_file(mapping);
+		return false;
+	}
+
+	if (header.version != pack_version) {
+		fprintf(stderr, "`%s' has version %u; Expected version %u. Re-run the packer.\n",
+			package_path, header.version, pack_version);
+		unmap_file(mapping);
+		return false;
+	}
 
-	u64 header_el_size = sizeof(u64) * 3;
-	u64 header_size;
-	fread(&header_size, sizeof(header_size), 1, file);
-	u64 header_count = header_size / header_el_size;
+	/* The index is used straight from the mapping. */
+	if (header.index_offset % sizeof(u64) != 0 ||
+		header.index_offset + header.entry_count * sizeof(struct pack_entry) > size) {
+		fprintf(stderr, "The index of `%s' is corrupt.\n", package_path);
+		unmap_file(mapping);
+		return false;
+	}
 
-	u64 name_hash = elf_hash((const u8*)path, strlen(path));
+	package.data = data;
+	package.size = size;
+	package.entries = (const struct pack_entry*)(package.data + header.index_offset);
+	package.entry_count = header.entry_count;
+	package.mapping = mapping;
 
-	for (u64 i = 0; i < header_count; i++) {
-		u64 hash, offset, f_size;
+	return true;
+}
 
-		fread(&hash, sizeof(hash), 1, file);
-		fread(&offset, sizeof(offset), 1, file);
-		fread(&f_size, sizeof(f_size), 1, file);
+static void close_package() {
+	if (!package.mapping) { return; }
 
-		if (hash == name_hash) {
-			if (size) {
-				*size = f_size;
-			}
-			*buf = core_alloc(f_size + (term ? 1 : 0));
+	unmap_file(package.mapping);
+	core_free(package.regions);
 
-			fseek(file, offset, SEEK_SET);
-			fread(*buf, 1, f_size, file);
+	package = (struct package) { 0 };
+}
 
-			if (term) {
-					*((*buf) + f_size) = '\0';
-			}
+static const struct pack_entry* find_entry(const char* path) {
+	lock_package();
+	bool ok = open_package();
+	unlock_package();
 
-			fclose(file);
-			return true;
-		}
+	if (!ok) { return null; }
+
+	const struct pack_entry* entry = pack_find((struct pack_entry*)package.entries,
+		package.entry_count, pack_hash(path));
+
+	if (entry && entry->offset + entry->size > package.size) {
+		fprintf(stderr, "Package entry `%s' is out of bounds.\n", path);
+		return null;
 	}
-	
-	fprintf(stderr, "Failed to read file from package: %s\n", path);
 
-	fclose(file);
-	return false;
+	return entry;
 }
 
-struct file file_open(const char* path) {
-	FILE* handle = fopen(package_path, "rb");
-	if (!handle) {
-		return (struct file) { 0 };
+/* Copy an entry into a new buffer, decompressing it if required,
+ * and verify its checksum. */
+static u8* read_entry(const struct pack_entry* entry, const char* path, bool term) {
+	u8* buf = core_alloc(entry->raw_size + (term ? 1 : 0));
+
+	const u8* stored = package.data + entry->offset;
+
+	bool ok = true;
+	if (entry->flags & pack_entry_compressed) {
+		ok = lz_decompress(stored, entry->size, buf, entry->raw_size);
+	} else {
+		memcpy(buf, stored, entry->raw_size);
+	}
+
+	if (ok && pack_checksum(buf, entry->raw_size) != entry->checksum) {
+		ok = false;
 	}
 
-	u64 header_el_size = sizeof(u64) * 3;
-	u64 header_size;
-	fread(&header_size, sizeof(header_size), 1, handle);
-	u64 header_count = header_size / header_el_size;
+	if (!ok) {
+		fprintf(stderr, "Package entry `%s' is corrupt.\n", path);
+		core_free(buf);
+		return null;
+	}
 
-	u64 name_hash = elf_hash((const u8*)path, strlen(path));
+	if (term) {
+		buf[entry->raw_size] = '\0';
+	}
 
-	for (u64 i = 0; i < header_count; i++) {
-		u64 hash, offset, f_size;
+	return buf;
+}
+
+/* Like read_entry, but an entry that isn't compressed is verified and
+ * returned straight from the mapping. `owned' is set to the buffer
+ * that has to be freed, or null if nothing was copied. */
+static const u8* view_entry(const struct pack_entry* entry, const char* path, u8** owned) {
+	*owned = null;
 
-		fread(&hash, sizeof(hash), 1, handle);
-		fread(&offset, sizeof(offset), 1, handle);
-		fread(&f_size, sizeof(f_size), 1, handle);
+	if (entry->flags & pack_entry_compressed) {
+		*owned = read_entry(entry, path, false);
+		return *owned;
+	}
 
-		if (hash == name_hash) {
-			return (struct file) { handle, offset, 0, f_size };
+	const u8* stored = package.data + entry->offset;
+	if (pack_checksum(stored, entry->raw_size) != entry->checksum) {
+		fprintf(stderr, "Package entry `%s' is corrupt.\n", path);
+		return null;
+	}
+
+	return stored;
+}
+
+static bool view_raw(const char* path, const u8** data, u64* size, u8** owned) {
+	*data = null;
+	*owned = null;
+	*size = 0;
+
+	trace_access(path);
+
+	const struct pack_entry* entry = find_entry(path);
+	if (!entry) {
+		fprintf(stderr, "Failed to read file from package: %s\n", path);
+		return false;
+	}
+
+	*data = view_entry(entry, path, owned);
+	if (!*data) {
+		return false;
+	}
+
+	*size = entry->raw_size;
+
+	return true;
+}
+
+bool read_raw(const char* path, u8** buf, u64* size, bool term) {
+	*buf = null;
+	size ? *size = 0 : 0;
+
+	trace_access(path);
+
+	const struct pack_entry* entry = find_entry(path);
+	if (!entry) {
+		fprintf(stderr, "Failed to read file from package: %s\n", path);
+		return false;
+	}
+
+	*buf = read_entry(entry, path, term);
+	if (!*buf) {
+		return false;
+	}
+
+	if (size) {
+		*size = entry->raw_size + (term ? 1 : 0);
+	}
+
+	return true;
+}
+
+/* Find where the packer put an image that it baked into an atlas.
+ * The table is read on first use. Only used from the main thread. */
+static struct pack_atlas_region* find_region(const char* path) {
+	/* Images in atlases are never read by themselves, but the packer
+	 * needs to know when they were first used to place their atlas. */
+	trace_access(path);
+
+	if (!package.regions_loaded) {
+		package.regions_loaded = true;
+
+		const struct pack_entry* entry = find_entry(pack_atlas_map_path);
+		if (entry) {
+			package.regions = (struct pack_atlas_region*)read_entry(entry, pack_atlas_map_path, false);
+			package.region_count = package.regions ? entry->raw_size / sizeof(struct pack_atlas_region) : 0;
 		}
 	}
 
-	fclose(handle);
+	return pack_find_region(package.regions, package.region_count, pack_hash(path));
+}
 
-	return (struct file) { 0 };
+/* Read the glyph sets that the packer baked for a font, if it baked
+ * any at this size. */
+static bool read_cooked_font(const char* path, f32 size, u8** buf, u64* buf_size) {
+	if (size != (f32)(u32)size) { return false; }
+
+	char cooked_path[300];
+	snprintf(cooked_path, sizeof(cooked_path), pack_font_path, path, (u32)size);
+
+	const struct pack_entry* entry = find_entry(cooked_path);
+	if (!entry) { return false; }
+
+	trace_access(cooked_path);
+
+	*buf = read_entry(entry, cooked_path, false);
+	*buf_size = entry->raw_size;
+
+	return *buf != null;
 }
 
+struct file file_open(const char* path) {
+	trace_access(path);
+
+	const struct pack_entry* entry = find_entry(path);
+	if (!entry) {
+		return (struct file) { 0 };
+	}
+
+	/* Compressed entries can't be read in pieces, so they are
+	 * decompressed up-front. Anything else is read straight out of
+	 * the package. */
+	if (entry->flags & pack_entry_compressed) {
+		u8* buffer = read_entry(entry, path, false);
+		if (!buffer) {
+			return (struct file) { 0 };
+		}
+
+		return (struct file) { .data = buffer, .size = entry->raw_size, .buffer = buffer };
+	}
+
+	return (struct file) { .data = package.data + entry->offset, .size = entry->size };
+}
+#endif
+
 bool file_good(struct file* file) {
-	return file->handle != null;
+	return file->data != null || file->mapping != null;
 }
 
 void file_close(struct file* file) {
-	fclose(file->handle);
-	file->handle = null;
+	if (file->mapping) {
+		unmap_file(file->mapping);
+	}
+
+	core_free(file->buffer);
+
+	*file = (struct file) { 0 };
 }
 
 u64 file_seek(struct file* file, u64 offset) {
-	file->cursor = offset;
+	file->cursor = offset < file->size ? offset : file->size;
 	return file->cursor;
 }
 
 u64 file_read(void* buf, u64 size, u64 count, struct file* file) {
-	fseek(file->handle, file->pk_offset + file->cursor, SEEK_SET);
+	u64 avail = size > 0 ? (file->size - file->cursor) / size : 0;
+	count = count < avail ? count : avail;
 
+	memcpy(buf, file->data + file->cursor, size * count);
 	file->cursor += size * count;
 
-	return fread(buf, size, count, file->handle);
+	return count;
 }
-#endif
+
+void* file_read_array(struct file* file, u64 size, u64 count) {
+	if (size == 0 || count > (file->size - file->cursor) / size) {
+		return null;
+	}
+
+	void* array = core_alloc(size * count);
+	file_read(array, size, count, file);
+
+	return array;
+}
+
+const void* file_map_range(struct file* file, u64 size) {
+	if (size > file->size - file->cursor) {
+		return null;
+	}
+
+	const void* range = file->data + file->cursor;
+	file->cursor += size;
+
+	return range;
+}
+
+/* Asynchronous loads are decoded by at most this many workers. */
+#define max_res_workers 4
+
+#define max_include_depth 16
+
+struct text_buffer {
+	char* data;
+	u64 size;
+	u64 capacity;
+};
+
+static void text_append(struct text_buffer* buffer, const char* text, u64 size) {
+	if (buffer->size + size + 1 > buffer->capacity) {
+		buffer->capacity = (buffer->size + size + 1) * 2;
+		buffer->data = core_realloc(buffer->data, buffer->capacity);
+	}
+
+	memcpy(buffer->data + buffer->size, text, size);
+	buffer->size += size;
+	buffer->data[buffer->size] = '\0';
+}
+
+static char* resolve_includes(char* source, const char* path, bool no_pck, u32 depth) {
+	if (!strstr(source, "#include")) { return source; }
+
+	if (depth >= max_include_depth) {
+		fprintf(stderr, "`%s': Includes are nested too deeply.\n", path);
+		return source;
+	}
+
+	/* Includes are relative to the file that includes them. */
+	const char* slash = strrchr(path, '/');
+	u64 dir_len = slash ? (u64)(slash - path) + 1 : 0;
+
+	struct text_buffer buffer = { 0 };
+
+	const char* end = source + strlen(source);
+	for (const char* line = source; line < end;) {
+		const char* next = strchr(line, '\n');
+		next = next ? next + 1 : end;
+
+		const char* directive = line;
+		while (*directive == ' ' || *directive == '\t') { directive++; }
+
+		const char* name = null;
+		const char* name_end = null;
+		if (strncmp(directive, "#include", 8) == 0) {
+			name = strchr(directive, '"');
+			name_end = name && name < next ? strchr(name + 1, '"') : null;
+		}
+
+		if (!name_end || name_end >= next) {
+			text_append(&buffer, line, (u64)(next - line));
+			line = next;
+			continue;
+		}
+
+		name++;
+
+		char include_path[256];
+		snprintf(include_path, sizeof(include_path), "%.*s%.*s",
+			(i32)dir_len, path, (i32)(name_end - name), name);
+
+		u8* included;
+		bool ok = no_pck ?
+			read_raw_no_pck(include_path, &included, null, true) :
+			read_raw(include_path, &included, null, true);
+
+		if (ok) {
+			char* resolved = resolve_includes((char*)included, include_path, no_pck, depth + 1);
+			text_append(&buffer, resolved, strlen(resolved));
+			text_append(&buffer, "\n", 1);
+			core_free(resolved);
+		} else {
+			fprintf(stderr, "`%s': Failed to include `%s'.\n", path, include_path);
+		}
+
+		line = next;
+	}
+
+	core_free(source);
+
+	return buffer.data ? buffer.data : copy_string("");
+}
+
+char* resolve_shader_includes(char* source, const char* path, bool no_pck) {
+	return resolve_includes(source, path, no_pck, 0);
+}
+
+#define default_cpu_budget (64 * 1024 * 1024)
+#define default_gpu_budget (128 * 1024 * 1024)
 
 enum {
-	res_shader,
-	res_texture,
-	res_font,
-	res_audio_clip
+	res_state_decoding = 0,
+	res_state_uploading,
+	res_state_ready,
+	res_state_failed
 };
 
 struct res {
+	char* key;
 	char* path;
 	u32 type;
+	u32 flags;
+	f32 size;
+	bool no_pck;
+
+	u32 state;
+
+	/* For textures that were baked into an atlas. */
+	bool baked;
+	struct res* atlas;
+	struct pack_atlas_region region;
+
+	u32 refs;
+	u64 cpu_size;
+
+	/* Set once the resource is in res_owners. */
+	bool owned;
+	u64 gpu_size;
+
+	/* Only linked in while there are no references. */
+	struct res* lru_prev;
+	struct res* lru_next;
+
+	struct job job;
+
+	/* Decoded data, waiting to be uploaded. */
+	struct shader_stages stages;
+	struct image image;
+
+	/* What `image' was decoded into; Null if its pixels are read
+	 * straight from the package. */
+	u8* image_data;
+
+	struct res* next_upload;
+
 	union {
 		struct texture* texture;
 		struct shader shader;
@@ -201,154 +617,851 @@ struct res {
 
 struct table* res_table;
 
-static struct res _res_load(const char* path, u32 type, void* udata, u8* raw, u32 raw_size) {
-	struct res new_res = { 0 };
+/* Maps the textures, fonts and audio clips that have been handed out
+ * back to their resources, so that they can be released without
+ * searching the whole cache. Keyed by address; See owner_key. */
+static struct table* res_owners;
+
+static struct job_pool* res_pool;
+
+/* Guards the state of every resource, the upload queue and the
+ * memory usage. */
+static struct mutex* res_mutex;
+
+static struct res* upload_head;
+static struct res* upload_tail;
+
+static u64 cpu_budget = default_cpu_budget;
+static u64 gpu_budget = default_gpu_budget;
+static u64 cpu_usage;
+static u64 gpu_usage;
+
+/* Unreferenced resources, from most to least recently released. */
+static struct res* lru_head;
+static struct res* lru_tail;
+
+static void lru_push(struct res* res) {
+	res->lru_prev = null;
+	res->lru_next = lru_head;
+
+	if (lru_head) {
+		lru_head->lru_prev = res;
+	} else {
+		lru_tail = res;
+	}
+
+	lru_head = res;
+}
+
+static void lru_unlink(struct res* res) {
+	if (res->lru_prev) {
+		res->lru_prev->lru_next = res->lru_next;
+	} else if (lru_head == res) {
+		lru_head = res->lru_next;
+	}
+
+	if (res->lru_next) {
+		res->lru_next->lru_prev = res->lru_prev;
+	} else if (lru_tail == res) {
+		lru_tail = res->lru_prev;
+	}
+
+	res->lru_prev = null;
+	res->lru_next = null;
+}
+
+/* Must be called with res_mutex locked. */
+static void push_upload(struct res* res) {
+	res->next_upload = null;
+
+	if (upload_tail) {
+		upload_tail->next_upload = res;
+	} else {
+		upload_head = res;
+	}
+
+	upload_tail = res;
+}
+
+/* Must be called with res_mutex locked. */
+static void unlink_upload(struct res* res) {
+	struct res* prev = null;
+
+	for (struct res* r = upload_head; r; prev = r, r = r->next_upload) {
+		if (r != res) { continue; }
+
+		if (prev) {
+			prev->next_upload = r->next_upload;
+		} else {
+			upload_head = r->next_upload;
+		}
+
+		if (upload_tail == r) {
+			upload_tail = prev;
+		}
+
+		break;
+	}
+
+	res->next_upload = null;
+}
+
+static void res_decoded(struct res* res, u32 state) {
+	lock_mutex(res_mutex);
+
+	res->state = state;
+	cpu_usage += res->cpu_size;
+
+	if (state == res_state_uploading) {
+		push_upload(res);
+	}
+
+	unlock_mutex(res_mutex);
+}
+
+/* Read and decode a resource; Everything that can be done without
+ * the GPU. This runs on a worker for asynchronous loads, and on the
+ * main thread otherwise. */
+static void res_decode(struct job* job) {
+	struct res* res = job->udata;
+
+	u8* raw;
+	u64 raw_size;
+
+	/* Textures are decoded from the package where they can be, in
+	 * which case `raw' is null and `view' points into the package. */
+	const u8* view;
+	bool ok;
+	if (res->no_pck) {
+		ok = read_raw_no_pck(res->path, &raw, &raw_size, res->type == res_shader);
+		view = raw;
+	} else if (res->type == res_texture) {
+		ok = view_raw(res->path, &view, &raw_size, &raw);
+	} else {
+		ok = read_raw(res->path, &raw, &raw_size, res->type == res_shader);
+		view = raw;
+	}
+
+	u32 state = res_state_failed;
+
+	if (ok) {
+		switch (res->type) {
+			case res_shader:
+				/* Shaders in the package are cooked by the packer;
+				 * Anything else still has to be preprocessed. */
+				if (!decode_cooked_shader(&res->stages, raw, raw_size)) {
+					char* source = resolve_shader_includes((char*)raw, res->path, res->no_pck);
+					split_shader(&res->stages, source);
+				}
+				state = res_state_uploading;
+				break;
+			case res_texture:
+				if (decode_cooked_texture(&res->image, view, raw_size, res->flags)) {
+					res->image_data = raw;
+					state = res_state_uploading;
+					break;
+				}
+
+				if (decode_bitmap(&res->image, view, raw_size, res->flags)) {
+					res->image_data = res->image.pixels;
+					state = res_state_uploading;
+				}
+				core_free(raw);
+				break;
+			case res_font: {
+				/* The font takes ownership of the data. */
+				u8* cooked;
+				u64 cooked_size;
+				if (!res->no_pck && read_cooked_font(res->path, res->size, &cooked, &cooked_size)) {
+					res->as.font = decode_cooked_font(raw, raw_size, res->size, cooked, cooked_size);
+				} else {
+					res->as.font = decode_font(raw, raw_size, res->size);
+				}
+
+				if (res->as.font) {
+					res->cpu_size = raw_size;
+					state = res_state_uploading;
+				}
+			} break;
+			case res_audio_clip:
+				res->as.audio_clip = new_audio_clip(raw, raw_size);
+				if (res->as.audio_clip) {
+					res->cpu_size = raw_size;
+					state = res_state_ready;
+				} else {
+					core_free(raw);
+				}
+				break;
+			default:
+				core_free(raw);
+				break;
+		}
+	}
+
+	if (state == res_state_failed) {
+		fprintf(stderr, "Failed to load `%s'.\n", res->path);
+	}
+
+	res_decoded(res, state);
+}
+
+/* Textures that were baked into an atlas have nothing to decode;
+ * They are filled in from the atlas when they are uploaded. */
+static void res_decode_baked(struct job* job) {
+	res_decoded(job->udata, res_state_uploading);
+}
+
+static void res_evict();
+
+static void free_image_data(struct res* res) {
+	core_free(res->image_data);
+
+	res->image_data = null;
+	res->image = (struct image) { 0 };
+}
+
+static void owner_key(char* key, const void* ptr) {
+	sprintf(key, "%p", ptr);
+}
 
-	new_res.type = type;
-	
-	switch (new_res.type) {
+/* Remember which resource a texture, font or audio clip came from,
+ * the first time that it is handed out. Main thread only. */
+static void res_own(struct res* res, const void* ptr) {
+	if (res->owned || !ptr) { return; }
+
+	char key[32];
+	owner_key(key, ptr);
+	table_set(res_owners, key, &res);
+
+	res->owned = true;
+}
+
+/* Finish loading a decoded resource. Main thread only. */
+static void res_upload(struct res* res) {
+	u32 state = res_state_ready;
+
+	switch (res->type) {
 		case res_shader:
-			init_shader(&new_res.as.shader, (const char*)raw, path);
-			core_free(raw);
-			break;
-		case res_texture:
-			new_res.as.texture = core_calloc(1, sizeof(struct texture));
-			init_texture(new_res.as.texture, raw, raw_size, *(u32*)udata);
-			core_free(raw);
+			init_shader_from_stages(&res->as.shader, &res->stages, res->path);
+			deinit_shader_stages(&res->stages);
 			break;
+		case res_texture: {
+			if (res->baked) {
+				struct texture* atlas = res_get_texture(res->atlas);
+				if (!atlas) {
+					state = res_state_failed;
+					break;
+				}
+
+				res->as.texture = core_alloc(sizeof(struct texture));
+				*res->as.texture = *atlas;
+				res->as.texture->x = res->region.x;
+				res->as.texture->y = res->region.y;
+				res->as.texture->width = res->region.w;
+				res->as.texture->height = res->region.h;
+
+				break;
+			}
+
+			res->as.texture = core_calloc(1, sizeof(struct texture));
+			init_texture_from_image(res->as.texture, &res->image);
+
+			u32 bpp = 3;
+			if (res->image.flags & texture_rgba) {
+				bpp = 4;
+			} else if (res->image.flags & texture_mono) {
+				bpp = 1;
+			}
+
+			res->gpu_size = (u64)res->image.width * res->image.height * bpp;
+
+			free_image_data(res);
+		} break;
 		case res_font:
-			new_res.as.font = load_font_from_memory(raw, raw_size, *(f32*)udata);
-			break;
-		case res_audio_clip:
-			new_res.as.audio_clip = new_audio_clip(raw, raw_size);
+			upload_font(res->as.font);
+			res->gpu_size = get_font_atlas_size(res->as.font);
 			break;
 		default: break;
 	}
 
-	return new_res;
+	lock_mutex(res_mutex);
+	res->state = state;
+	gpu_usage += res->gpu_size;
+	unlock_mutex(res_mutex);
+
+	res_evict();
 }
 
-static struct res* res_load(const char* path, u32 type, void* udata) {
+static struct res* res_find_or_create(const char* path, u32 type, u32 flags, f32 size, bool no_pck, bool* created) {
 	char cache_name[256];
 
 	if (type == res_font) {
-		sprintf(cache_name, "%s%g", path, *(f32*)udata);
+		sprintf(cache_name, "%s%g", path, size);
 	} else {
 		strcpy(cache_name, path);
 	}
 
-	struct res* got = table_get(res_table, cache_name);
+	*created = false;
+
+	struct res** got = table_get(res_table, cache_name);
 	if (got) {
-		return got;
+		struct res* res = *got;
+
+		if (res->refs++ == 0) {
+			lru_unlink(res);
+		}
+
+		return res;
 	}
 
-	u8* raw;
-	u64 raw_size;
-	read_raw(path, &raw, &raw_size, type == res_shader);
+	struct res* res = core_calloc(1, sizeof(struct res));
 
-	struct res res = _res_load(path, type, udata, raw, raw_size);
+	res->key = copy_string(cache_name);
+	res->path = copy_string(path);
+	res->refs = 1;
+	res->type = type;
+	res->flags = flags;
+	res->size = size;
+	res->no_pck = no_pck;
+	res->state = res_state_decoding;
+
+	res->job.func = res_decode;
+	res->job.udata = res;
 
 	table_set(res_table, cache_name, &res);
 
-	return table_get(res_table, cache_name);
+	*created = true;
+
+	return res;
 }
 
-static struct res* res_load_no_pck(const char* path, u32 type, void* udata) {
-	char cache_name[256];
+/* Start loading a resource that has just been added to the cache,
+ * either on the pool or right away. */
+static void res_start(struct res* res, bool async) {
+	struct pack_atlas_region* region = null;
+	if (res->type == res_texture && !res->no_pck) {
+		region = find_region(res->path);
+	}
 
-	if (type == res_font) {
-		sprintf(cache_name, "%s%g", path, *(f32*)udata);
-	} else {
-		strcpy(cache_name, path);
+	if (region) {
+		char atlas_path[64];
+		sprintf(atlas_path, pack_atlas_path, region->atlas);
+
+		bool created;
+		res->atlas = res_find_or_create(atlas_path, res_texture, sprite_texture, 0.0f, false, &created);
+		if (created) {
+			res_start(res->atlas, async);
+		}
+
+		res->baked = true;
+		res->region = *region;
+		res->job.func = res_decode_baked;
 	}
 
-	struct res* got = table_get(res_table, cache_name);
-	if (got) {
-		return got;
+	if (async) {
+		job_submit(res_pool, &res->job);
+	} else {
+		res->job.func(&res->job);
 	}
+}
 
-	u8* raw;
-	u64 raw_size;
-	read_raw_no_pck(path, &raw, &raw_size, type == res_shader);
+static struct res* res_load(const char* path, u32 type, u32 flags, f32 size, bool no_pck) {
+	bool created;
+	struct res* res = res_find_or_create(path, type, flags, size, no_pck, &created);
 
-	struct res res = _res_load(path, type, udata, raw, raw_size);
+	if (created) {
+		res_start(res, false);
+	}
 
-	table_set(res_table, cache_name, &res);
+	res_wait(res);
 
-	return table_get(res_table, cache_name);
+	return res;
+}
+
+/* Make sure that no worker is using a resource, and that it isn't
+ * waiting to be uploaded, so that it can be freed. */
+static void res_detach(struct res* res) {
+	if (!job_cancel(res_pool, &res->job)) {
+		job_join(res_pool, &res->job);
+	}
 
+	lock_mutex(res_mutex);
+	if (res->state == res_state_uploading) {
+		unlink_upload(res);
+	}
+	unlock_mutex(res_mutex);
 }
 
 static void res_free(struct res* res) {
+	if (res->owned) {
+		char key[32];
+		owner_key(key, (const void*)res->as.texture);
+		table_delete(res_owners, key);
+	}
+
 	switch (res->type) {
 		case res_shader:
-			deinit_shader(&res->as.shader);
+			if (res->state == res_state_ready) {
+				deinit_shader(&res->as.shader);
+			}
 			break;
 		case res_texture:
-			deinit_texture(res->as.texture);
-			core_free(res->as.texture);
+			if (res->as.texture) {
+				if (!res->baked) {
+					deinit_texture(res->as.texture);
+				}
+
+				core_free(res->as.texture);
+			}
 			break;
 		case res_font:
-			free_font(res->as.font);
+			if (res->as.font) {
+				free_font(res->as.font);
+			}
 			break;
 		case res_audio_clip:
-			free_audio_clip(res->as.audio_clip);
+			if (res->as.audio_clip) {
+				free_audio_clip(res->as.audio_clip);
+			}
 			break;
 		default: break;
 	}
+
+	deinit_shader_stages(&res->stages);
+	free_image_data(res);
+
+	lock_mutex(res_mutex);
+	cpu_usage -= res->cpu_size;
+	gpu_usage -= res->gpu_size;
+	unlock_mutex(res_mutex);
+
+	if (res->atlas) {
+		res_release(res->atlas);
+	}
+
+	core_free(res->key);
+	core_free(res->path);
+	core_free(res);
+}
+
+/* Remove a resource from the cache and free it. */
+static void res_destroy(struct res* res) {
+	res_detach(res);
+
+	if (res->refs == 0) {
+		lru_unlink(res);
+	}
+
+	table_delete(res_table, res->key);
+
+	res_free(res);
+}
+
+/* Free unreferenced resources, least recently released first, until
+ * the cache is back within its budgets. Resources that don't use any
+ * of the memory that is over budget are kept, as are ones that are
+ * still loading; One of those might be in the middle of its own upload
+ * (a baked texture uploading its atlas, say) when this is called. */
+static void res_evict() {
+	/* Freeing a baked texture releases its atlas, which would
+	 * otherwise start evicting from underneath this loop. */
+	static bool evicting = false;
+	if (evicting) { return; }
+
+	evicting = true;
+
+	struct res* res = lru_tail;
+
+	while (res) {
+		lock_mutex(res_mutex);
+		bool cpu_over = cpu_usage > cpu_budget;
+		bool gpu_over = gpu_usage > gpu_budget;
+		bool loaded = res->state == res_state_ready || res->state == res_state_failed;
+		unlock_mutex(res_mutex);
+
+		if (!cpu_over && !gpu_over) { break; }
+
+		struct res* prev = res->lru_prev;
+
+		/* Baked textures take up no memory of their own, but they keep
+		 * their atlas alive. */
+		if (loaded && ((cpu_over && res->cpu_size > 0) || (gpu_over && (res->gpu_size > 0 || res->baked)))) {
+			res_destroy(res);
+		}
+
+		res = prev;
+	}
+
+	evicting = false;
 }
 
 void res_init() {
-	res_table = new_table(sizeof(struct res));
+	res_table = new_table(sizeof(struct res*));
+	res_owners = new_table(sizeof(struct res*));
+
+	res_mutex = new_mutex(0);
+
+	u32 workers = get_cpu_count() - 1;
+	workers = workers < 1 ? 1 : workers;
+	workers = workers > max_res_workers ? max_res_workers : workers;
+	res_pool = new_job_pool(workers);
+
+#ifndef DEBUG
+	package_mutex = new_mutex(0);
+#endif
 }
 
 void res_deinit() {
 	for (struct table_iter i = new_table_iter(res_table); table_iter_next(&i);) {
-		res_free(i.value);
+		res_detach(*(struct res**)i.value);
+	}
+
+	/* Everything is freed regardless of references, so baked textures
+	 * mustn't give theirs back to atlases that might already be gone. */
+	for (struct table_iter i = new_table_iter(res_table); table_iter_next(&i);) {
+		struct res* res = *(struct res**)i.value;
+
+		res->atlas = null;
+		res_free(res);
 	}
 
 	free_table(res_table);
+	free_table(res_owners);
+
+	free_job_pool(res_pool);
+	free_mutex(res_mutex);
+
+	upload_head = null;
+	upload_tail = null;
+	lru_head = null;
+	lru_tail = null;
+
+#ifndef DEBUG
+	close_package();
+
+	free_mutex(package_mutex);
+	package_mutex = null;
+#endif
+
+	if (trace_mutex) {
+		res_trace_end();
+
+		free_mutex(trace_mutex);
+		trace_mutex = null;
+	}
 }
 
 void res_unload(const char* path) {
-	struct res* res = table_get(res_table, path);
-	if (!res) {
+	/* Fonts are cached once per size, under a key that includes the
+	 * size, so the whole cache has to be searched for them. */
+	vector(struct res*) found = null;
+
+	for (struct table_iter i = new_table_iter(res_table); table_iter_next(&i);) {
+		struct res* res = *(struct res**)i.value;
+
+		if (strcmp(res->path, path) == 0) {
+			vector_push(found, res);
+		}
+	}
+
+	for (u32 i = 0; i < vector_count(found); i++) {
+		res_destroy(found[i]);
+	}
+
+	free_vector(found);
+}
+
+struct res* res_load_async(const char* path, u32 type, u32 flags) {
+	bool created;
+	struct res* res = res_find_or_create(path, type, flags, (f32)flags, false, &created);
+
+	if (created) {
+		res_start(res, true);
+	}
+
+	return res;
+}
+
+void res_release(struct res* res) {
+	if (!res || res->refs == 0) {
+		fprintf(stderr, "Resource released more times than it was acquired.\n");
 		return;
 	}
 
-	res_free(res);
+	if (--res->refs == 0) {
+		lru_push(res);
+		res_evict();
+	}
+}
+
+static struct res* find_res(u32 type, const void* ptr) {
+	if (!ptr) { return null; }
+
+	char key[32];
+	owner_key(key, ptr);
+
+	struct res** got = table_get(res_owners, key);
+	if (!got || (*got)->type != type) {
+		return null;
+	}
+
+	return *got;
+}
+
+void res_release_texture(struct texture* texture) {
+	if (texture) {
+		res_release(find_res(res_texture, texture));
+	}
+}
+
+void res_release_font(struct font* font) {
+	if (font) {
+		res_release(find_res(res_font, font));
+	}
+}
+
+void res_release_audio_clip(struct audio_clip* clip) {
+	if (clip) {
+		res_release(find_res(res_audio_clip, clip));
+	}
+}
+
+void res_set_budget(u64 cpu, u64 gpu) {
+	lock_mutex(res_mutex);
+	cpu_budget = cpu;
+	gpu_budget = gpu;
+	unlock_mutex(res_mutex);
+
+	res_evict();
+}
+
+void res_get_usage(u64* cpu, u64* gpu) {
+	lock_mutex(res_mutex);
+	cpu ? *cpu = cpu_usage : 0;
+	gpu ? *gpu = gpu_usage : 0;
+	unlock_mutex(res_mutex);
+}
+
+bool res_ready(struct res* res) {
+	lock_mutex(res_mutex);
+	bool ready = res->state == res_state_ready || res->state == res_state_failed;
+	unlock_mutex(res_mutex);
+
+	return ready;
+}
+
+void res_wait(struct res* res) {
+	job_join(res_pool, &res->job);
+
+	lock_mutex(res_mutex);
+
+	bool upload = res->state == res_state_uploading;
+	if (upload) {
+		unlink_upload(res);
+	}
+
+	unlock_mutex(res_mutex);
+
+	if (upload) {
+		res_upload(res);
+	}
+}
+
+struct shader res_get_shader(struct res* res) {
+	res_wait(res);
+	return res->as.shader;
+}
 
-	table_delete(res_table, path);
+struct texture* res_get_texture(struct res* res) {
+	res_wait(res);
+	res_own(res, res->as.texture);
+	return res->as.texture;
+}
+
+struct font* res_get_font(struct res* res) {
+	res_wait(res);
+	res_own(res, res->as.font);
+	return res->as.font;
+}
+
+struct audio_clip* res_get_audio_clip(struct res* res) {
+	res_wait(res);
+	res_own(res, res->as.audio_clip);
+	return res->as.audio_clip;
+}
+
+void res_update(f64 budget) {
+	u64 start = get_time();
+	u64 limit = (u64)(budget * (f64)get_frequency());
+
+	do {
+		lock_mutex(res_mutex);
+
+		struct res* res = upload_head;
+		if (res) {
+			unlink_upload(res);
+		}
+
+		/* A baked texture can't be finished until its atlas has been
+		 * decoded; Rather than block on it, try again next frame. */
+		bool deferred = res && res->baked && res->atlas->state == res_state_decoding;
+		if (deferred) {
+			push_upload(res);
+		}
+
+		unlock_mutex(res_mutex);
+
+		if (!res || deferred) { break; }
+
+		res_upload(res);
+	} while (get_time() - start < limit);
+}
+
+struct res_manifest_item {
+	char* path;
+	u32 type;
+	u32 flags;
+
+	/* Set once the manifest has been prefetched. */
+	struct res* res;
+};
+
+struct res_manifest {
+	vector(struct res_manifest_item) items;
+	bool prefetched;
+};
+
+static const char* manifest_types[] = {
+	[res_shader] = "shader",
+	[res_texture] = "texture",
+	[res_font] = "font",
+	[res_audio_clip] = "audio"
+};
+
+struct res_manifest* new_res_manifest(const char* text) {
+	struct res_manifest* manifest = core_calloc(1, sizeof(struct res_manifest));
+
+	while (*text) {
+		u64 len = strcspn(text, "\r\n");
+
+		char line[300];
+		if (len < sizeof(line)) {
+			memcpy(line, text, len);
+			line[len] = '\0';
+
+			char type[16];
+			char path[256];
+			u32 flags = 0;
+
+			if (sscanf(line, "%15s %255s %u", type, path, &flags) >= 2) {
+				u32 i;
+				for (i = 0; i < sizeof(manifest_types) / sizeof(*manifest_types); i++) {
+					if (strcmp(type, manifest_types[i]) == 0) { break; }
+				}
+
+				if (i < sizeof(manifest_types) / sizeof(*manifest_types)) {
+					struct res_manifest_item item = {
+						.path = copy_string(path),
+						.type = i,
+						.flags = flags
+					};
+
+					vector_push(manifest->items, item);
+				} else {
+					fprintf(stderr, "Unknown resource type `%s' in manifest.\n", type);
+				}
+			}
+		}
+
+		text += len;
+		text += strspn(text, "\r\n");
+	}
+
+	return manifest;
+}
+
+struct res_manifest* load_res_manifest(const char* path) {
+	char* text;
+	if (!read_raw(path, (u8**)&text, null, true)) {
+		fprintf(stderr, "Failed to load resource manifest `%s'.\n", path);
+		return null;
+	}
+
+	struct res_manifest* manifest = new_res_manifest(text);
+
+	core_free(text);
+
+	return manifest;
+}
+
+void free_res_manifest(struct res_manifest* manifest) {
+	if (!manifest) { return; }
+
+	for (u32 i = 0; i < vector_count(manifest->items); i++) {
+		struct res_manifest_item* item = manifest->items + i;
+
+		if (item->res) {
+			res_release(item->res);
+		}
+
+		core_free(item->path);
+	}
+
+	free_vector(manifest->items);
+	core_free(manifest);
+}
+
+void res_prefetch(struct res_manifest* manifest) {
+	if (!manifest || manifest->prefetched) { return; }
+
+	for (u32 i = 0; i < vector_count(manifest->items); i++) {
+		struct res_manifest_item* item = manifest->items + i;
+		item->res = res_load_async(item->path, item->type, item->flags);
+	}
+
+	manifest->prefetched = true;
+}
+
+bool res_manifest_ready(struct res_manifest* manifest) {
+	if (!manifest || !manifest->prefetched) { return false; }
+
+	for (u32 i = 0; i < vector_count(manifest->items); i++) {
+		if (!res_ready(manifest->items[i].res)) {
+			return false;
+		}
+	}
+
+	return true;
 }
 
 struct shader load_shader(const char* path) {
-	return res_load(path, res_shader, null)->as.shader;
+	return res_get_shader(res_load(path, res_shader, 0, 0.0f, false));
 }
 
 struct texture* load_texture(const char* path, u32 flags) {
-	return res_load(path, res_texture, &flags)->as.texture;
+	return res_get_texture(res_load(path, res_texture, flags, 0.0f, false));
 }
 
 struct font* load_font(const char* path, f32 size) {
-	return res_load(path, res_font, &size)->as.font;
+	return res_get_font(res_load(path, res_font, 0, size, false));
 }
 
 struct audio_clip* load_audio_clip(const char* path) {
-	return res_load(path, res_audio_clip, null)->as.audio_clip;
+	return res_get_audio_clip(res_load(path, res_audio_clip, 0, 0.0f, false));
 }
 
 struct shader load_shader_no_pck(const char* path) {
-	return res_load_no_pck(path, res_shader, null)->as.shader;
+	return res_get_shader(res_load(path, res_shader, 0, 0.0f, true));
 }
 
 struct texture* load_texture_no_pck(const char* path, u32 flags) {
-	return res_load_no_pck(path, res_texture, &flags)->as.texture;
+	return res_get_texture(res_load(path, res_texture, flags, 0.0f, true));
 }
 
 struct font* load_font_no_pck(const char* path, f32 size) {
-	return res_load_no_pck(path, res_font, &size)->as.font;
+	return res_get_font(res_load(path, res_font, 0, size, true));
 }
 
 struct audio_clip* load_audio_clip_no_pck(const char* path) {
-	return res_load_no_pck(path, res_audio_clip, null)->as.audio_clip;
+	return res_get_audio_clip(res_load(path, res_audio_clip, 0, 0.0f, true));
 }
@@ -11,11 +11,125 @@
 API bool read_raw(const char* path, u8** buf, u64* size, bool term);
 API bool read_raw_no_pck(const char* path, u8** buf, u64* size, bool term);
 
+/* Paste the contents of every `#include "file"' line in a shader
+ * into it; Paths are relative to the file that includes them. Takes
+ * ownership of `source', and returns the result. */
+API char* resolve_shader_includes(char* source, const char* path, bool no_pck);
+
 API void res_init();
+
+/* Also ends the trace, if there is one. */
 API void res_deinit();
 
+/* Access tracing.
+ *
+ * While a trace is being recorded, the path of every file that is
+ * read through the resource manager is appended to it the first time
+ * that it is read, so that the packer can lay the package out in the
+ * order that it is used (see the packer). res_trace_group starts a
+ * new group of accesses, such as when a room is loaded; The packer
+ * keeps each group together, even across several traces appended to
+ * the same file.
+ *
+ * Traces are text; Group lines start with `>', and every other line
+ * is a path. */
+
+#define res_trace_path "res.trace"
+
+API bool res_trace_begin(const char* path);
+API void res_trace_end();
+API void res_trace_group(const char* name);
+
+/* Free a resource straight away, whether or not it is still
+ * referenced. For fonts, every size is unloaded. */
 API void res_unload(const char* path);
 
+enum {
+	res_shader = 0,
+	res_texture,
+	res_font,
+	res_audio_clip
+};
+
+/* Asynchronous loading.
+ *
+ * res_load_async returns a handle straight away, while the file is
+ * read and decoded on a pool of worker threads. Anything that has
+ * to touch the GPU is finished off by res_update, which the main
+ * loop calls once per frame. Handles belong to the resource cache
+ * and are shared with the synchronous load functions, so loading a
+ * resource that is still in flight just waits for it.
+ *
+ * For textures, `flags' are the texture flags; For fonts, they are
+ * the size of the font in pixels.
+ *
+ * These must only be called from the main thread. */
+struct res;
+
+API struct res* res_load_async(const char* path, u32 type, u32 flags);
+
+/* Returns true once the resource has either loaded or failed. */
+API bool res_ready(struct res* res);
+
+/* Block until the resource has loaded, finishing it off immediately
+ * instead of waiting for res_update. */
+API void res_wait(struct res* res);
+
+/* These wait for the resource if it isn't ready, and return null
+ * if it failed to load. */
+API struct shader res_get_shader(struct res* res);
+API struct texture* res_get_texture(struct res* res);
+API struct font* res_get_font(struct res* res);
+API struct audio_clip* res_get_audio_clip(struct res* res);
+
+/* Reference counting.
+ *
+ * Every load, whether it is synchronous or not, acquires a reference
+ * to the resource, which should be given back with one of the release
+ * functions once it is no longer needed. Resources without any
+ * references are kept in a least recently used list, and are only
+ * freed once the cache goes over one of its memory budgets; Loading
+ * one again before then costs nothing. Shaders are never released. */
+API void res_release(struct res* res);
+API void res_release_texture(struct texture* texture);
+API void res_release_font(struct font* font);
+API void res_release_audio_clip(struct audio_clip* clip);
+
+/* The budgets are in bytes. The CPU budget covers file data that is
+ * kept in memory, such as font and audio data; The GPU budget covers
+ * textures and glyph atlases. */
+API void res_set_budget(u64 cpu, u64 gpu);
+API void res_get_usage(u64* cpu, u64* gpu);
+
+/* Prefetching.
+ *
+ * A manifest lists resources that are going to be needed together,
+ * so that they can be loaded before they are asked for. Manifests are
+ * text, with one resource per line in the form `<type> <path> [flags]',
+ * where the type is one of `shader', `texture', `font' or `audio',
+ * and the flags are the same as for res_load_async.
+ *
+ * res_prefetch starts loading everything in a manifest asynchronously,
+ * and holds a reference to each resource until the manifest is freed.
+ * Freeing it leaves the resources in the cache, so loading them
+ * afterwards costs nothing unless they have been evicted. */
+struct res_manifest;
+
+API struct res_manifest* new_res_manifest(const char* text);
+API struct res_manifest* load_res_manifest(const char* path);
+API void free_res_manifest(struct res_manifest* manifest);
+
+/* Does nothing if the manifest has already been prefetched. */
+API void res_prefetch(struct res_manifest* manifest);
+
+/* Returns true once everything in a prefetched manifest is ready. */
+API bool res_manifest_ready(struct res_manifest* manifest);
+
+/* Upload decoded resources to the GPU until `budget' seconds have
+ * been spent. At least one resource is uploaded per call, if any
+ * are waiting, so that loading always makes progress. */
+API void res_update(f64 budget);
+
 API struct shader load_shader(const char* path);
 API struct texture* load_texture(const char* path, u32 flags);
 API struct font* load_font(const char* path, f32 size);
@@ -28,14 +142,19 @@ API struct audio_clip* load_audio_clip_no_pck(const char* path);
 
 /* File API, for reading only.
  *
- * In debug, it wraps the default C stdio.
- * In release, it contains extra functionality to read from the
- * packed resource file. */
+ * Files are read straight out of memory, so reading never makes a
+ * system call. In debug, the file is mapped into memory. In release,
+ * the data comes from the mapping of the packed resource file, except
+ * for compressed entries, which are decompressed into a buffer when
+ * they are opened. */
 struct file {
-	void* handle;
-	u64 pk_offset;
+	const u8* data;
 	u64 cursor;
 	u64 size;
+
+	/* What `data' belongs to, if it belongs to the file. */
+	struct file_mapping* mapping;
+	u8* buffer;
 };
 
 API struct file file_open(const char* path);
@@ -43,3 +162,13 @@ API bool file_good(struct file* file);
 API void file_close(struct file* file);
 API u64 file_seek(struct file* file, u64 offset);
 API u64 file_read(void* buf, u64 size, u64 count, struct file* file);
+
+/* Read `count' elements into a new array. Returns null if there
+ * aren't that many left in the file. */
+API void* file_read_array(struct file* file, u64 size, u64 count);
+
+/* Get a pointer to the next `size' bytes of the file, without copying
+ * them, and skip past them. Returns null if there aren't that many
+ * left. The pointer is valid until the file is closed, and has no
+ * particular alignment. */
+API const void* file_map_range(struct file* file, u64 size);
@@ -20,6 +20,7 @@ struct table {
 
 	struct table_el* els;
 	u32 count;
+	u32 tombstone_count;
 	u32 capacity;
 };
 
@@ -64,6 +65,7 @@ static void table_resize(struct table* table, u32 capacity) {
 
 	table->els = els;
 	table->capacity = capacity;
+	table->tombstone_count = 0;
 }
 
 static void* table_data_get(struct table* table, i32 idx) {
@@ -85,10 +87,11 @@ static i32 table_data_add(struct table* table) {
 	}
 
 	if (table->data_count >= table->data_capacity) {
-		u32 old_cap = table->capacity;
+		u32 old_cap = table->data_capacity;
 		table->data_capacity = table->data_capacity < 8 ? 8 : table->data_capacity * 2;
 		table->data = core_realloc(table->data, table->data_capacity * (table->element_size + 1));
-		memset(((u8*)table->data) + old_cap, 0, (table->data_capacity - old_cap) * (table->element_size + 1));
+		memset(((u8*)table->data) + old_cap * (table->element_size + 1), 0,
+			(table->data_capacity - old_cap) * (table->element_size + 1));
 	}
 
 	i32 idx = table->data_count++;
@@ -118,6 +121,7 @@ struct table* new_table(u32 element_size) {
 
 		.els = null,
 		.count = 0,
+		.tombstone_count = 0,
 		.capacity = 0
 	};
 
@@ -156,13 +160,26 @@ const char* table_get_key(struct table* table, const char* key) {
 }
 
 void* table_set(struct table* table, const char* key, const void* val) {
-	if (table->count >= table->capacity * load_factor) {
-		u32 capacity = table->capacity < 8 ? 8 : table->capacity * 2;
+	/* Tombstones take up slots just like keys do; If they weren't
+	 * counted, a table that has keys added and deleted over and over
+	 * would eventually have no empty slots left, and lookups would
+	 * never terminate. Resizing clears them out, so the capacity is
+	 * only grown if the live keys alone need it. */
+	if (table->count + table->tombstone_count >= table->capacity * load_factor) {
+		u32 capacity = table->capacity < 8 ? 8 : table->capacity;
+		if (table->count >= capacity * load_factor / 2) {
+			capacity *= 2;
+		}
+
 		table_resize(table, capacity);
 	}
 
 	struct table_el* el = find_el(table->els, table->capacity, key);
 	if (!el->key) { /* New key. */
+		if (el->val_idx == -2) {
+			table->tombstone_count--;
+		}
+
 		table->count++;
 		el->val_idx = table_data_add(table);
 	} else {
@@ -196,6 +213,7 @@ void table_delete(struct table* table, const char* key) {
 	el->val_idx = -2;
 
 	table->count--;
+	table->tombstone_count++;
 }
 
 u32 get_table_count(struct table* table) {
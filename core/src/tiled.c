@@ -1,283 +1,453 @@
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "core.h"
 #include "res.h"
 #include "tiled.h"
 
-static char* read_string(struct file* file) {
-	u32 len;
-	file_read(&len, sizeof(len), 1, file);
-	char* str = core_alloc(len + 1);
-	str[len] = '\0';
-	file_read(str, 1, len, file);
-	return str;
+static bool check_table(const struct map_view* view, struct map_table table, u64 element_size, u64 alignment) {
+	return table.offset % alignment == 0 && table.offset <= view->size &&
+		(u64)table.count * element_size <= view->size - table.offset;
 }
 
-static u32 read_u32(struct file* file) {
-	u32 u;
-	file_read(&u, sizeof(u), 1, file);
-	return u;
+bool map_range_ok(struct map_range range, struct map_table table) {
+	return range.first <= table.count && range.count <= table.count - range.first;
 }
 
-static i32 read_i32(struct file* file) {
-	i32 i;
-	file_read(&i, sizeof(i), 1, file);
-	return i;
+#define table_ptr(view_, table_) ((const void*)((view_)->data + (view_)->header->table_.offset))
+
+bool open_map_view(struct map_view* view, const u8* data, u64 size) {
+	*view = (struct map_view) { .data = data, .size = size };
+
+	/* Every table is aligned relative to the start of the file. */
+	if (size < sizeof(struct map_header) || (uintptr_t)data % sizeof(f64) != 0) {
+		return false;
+	}
+
+	const struct map_header* header = (const struct map_header*)data;
+	view->header = header;
+
+	if (memcmp(header->magic, map_magic, sizeof(header->magic)) != 0 || header->version != map_version) {
+		return false;
+	}
+
+	bool ok =
+		check_table(view, header->properties, sizeof(struct map_property), sizeof(f64)) &&
+		check_table(view, header->tilesets,   sizeof(struct map_tileset),  sizeof(u32)) &&
+		check_table(view, header->animations, sizeof(struct map_animation), sizeof(u32)) &&
+		check_table(view, header->frames,     sizeof(struct map_frame),    sizeof(u32)) &&
+		check_table(view, header->layers,     sizeof(struct map_layer),    sizeof(u32)) &&
+		check_table(view, header->objects,    sizeof(struct map_object),   sizeof(u32)) &&
+		check_table(view, header->points,     sizeof(v2f),                 sizeof(f32)) &&
+		check_table(view, header->strings,    1,                           1) &&
+		map_range_ok(header->map_properties, header->properties);
+
+	/* Every string ends within the pool, as long as the pool does. */
+	if (!ok || header->strings.count == 0 || data[header->strings.offset + header->strings.count - 1] != '\0') {
+		return false;
+	}
+
+	view->properties = table_ptr(view, properties);
+	view->tilesets   = table_ptr(view, tilesets);
+	view->animations = table_ptr(view, animations);
+	view->frames     = table_ptr(view, frames);
+	view->layers     = table_ptr(view, layers);
+	view->objects    = table_ptr(view, objects);
+	view->points     = table_ptr(view, points);
+	view->strings    = table_ptr(view, strings);
+
+	return true;
 }
 
-static i16 read_i16(struct file* file) {
-	i16 i;
-	file_read(&i, sizeof(i), 1, file);
-	return i;
+const char* map_string(const struct map_view* view, u32 offset) {
+	return offset < view->header->strings.count ? view->strings + offset : "";
 }
 
-static f32 read_f32(struct file* file) {	
-	f32 f;
-	file_read(&f, sizeof(f), 1, file);
-	return f;
+const struct map_property* map_find_property(const struct map_view* view, struct map_range range, const char* name) {
+	if (!map_range_ok(range, view->header->properties)) { return null; }
+
+	for (u32 i = 0; i < range.count; i++) {
+		const struct map_property* prop = view->properties + range.first + i;
+
+		if (strcmp(map_string(view, prop->name), name) == 0) {
+			return prop;
+		}
+	}
+
+	return null;
 }
 
-static f64 read_f64(struct file* file) {	
-	f64 f;
-	file_read(&f, sizeof(f), 1, file);
-	return f;
+/* The runtime structures aren't const, but nothing writes to them. */
+static char* get_string(const struct map_view* view, u32 offset) {
+	return (char*)map_string(view, offset);
 }
 
-static bool read_bool(struct file* file) {
-	bool b;
-	file_read(&b, sizeof(b), 1, file);
-	return b;
+/* Hands out pieces of the block that a map is allocated in. Every
+ * piece is aligned to 8 bytes. */
+struct map_arena {
+	u8* data;
+	u64 used;
+};
+
+static u64 arena_round(u64 size) {
+	return (size + 7) & ~(u64)7;
 }
 
-static struct table* read_properties(struct file* file) {
-	struct table* t = new_table(sizeof(struct property));
+static void* arena_take(struct map_arena* arena, u64 size) {
+	void* ptr = arena->data + arena->used;
+	arena->used += arena_round(size);
+	return ptr;
+}
+
+/* How big the block that a map is allocated in has to be. Objects and
+ * properties are converted into arrays as big as their tables, at the
+ * same index as their records, so that layers and owners can use the
+ * same ranges into them as the file does. */
+static u64 map_alloc_size(const struct map_view* view) {
+	const struct map_header* header = view->header;
+
+	u64 size =
+		arena_round(sizeof(struct tiled_map)) +
+		arena_round((u64)header->properties.count * sizeof(struct property)) +
+		arena_round((u64)header->objects.count * sizeof(struct object)) +
+		arena_round((u64)header->tilesets.count * sizeof(struct tileset)) +
+		arena_round((u64)header->layers.count * sizeof(struct layer));
+
+	for (u32 i = 0; i < header->tilesets.count; i++) {
+		const struct map_tileset* record = view->tilesets + i;
 
-	u32 count = read_u32(file);
+		size += arena_round((u64)record->tile_count * sizeof(struct animated_tile));
 
-	for (u32 i = 0; i < count; i++) {
-		struct property prop = { 0 };
+		if (map_range_ok(record->animations, header->animations)) {
+			size += arena_round((u64)record->animations.count * sizeof(u32));
+		}
+	}
 
-		char* name = read_string(file);
+	return size;
+}
 
-		prop.type = read_i32(file);
+static int compare_properties(const void* a, const void* b) {
+	return strcmp(((const struct property*)a)->name, ((const struct property*)b)->name);
+}
 
-		switch (prop.type) {
+static struct properties make_properties(const struct map_view* view, struct property* pool, struct map_range range) {
+	if (!map_range_ok(range, view->header->properties) || range.count == 0) {
+		return (struct properties) { 0 };
+	}
+
+	struct property* items = pool + range.first;
+
+	for (u32 i = 0; i < range.count; i++) {
+		const struct map_property* record = view->properties + range.first + i;
+
+		struct property* prop = items + i;
+		*prop = (struct property) { .name = get_string(view, record->name), .type = record->type };
+
+		switch (prop->type) {
 			case prop_bool:
-				prop.as.boolean = read_bool(file);
+				prop->as.boolean = record->as.boolean != 0;
 				break;
 			case prop_number:
-				prop.as.number = read_f64(file);
+				prop->as.number = record->as.number;
 				break;
 			case prop_string:
-				prop.as.string = read_string(file);
+				prop->as.string = get_string(view, record->as.string);
 				break;
 			default:
 				break;
 		}
+	}
 
-		table_set(t, name, &prop);
+	qsort(items, range.count, sizeof(struct property), compare_properties);
 
-		core_free(name);
+	return (struct properties) { items, range.count };
+}
+
+const struct property* find_property(const struct properties* properties, const char* name) {
+	u32 lo = 0, hi = properties->count;
+
+	while (lo < hi) {
+		const u32 mid = lo + (hi - lo) / 2;
+		const i32 c = strcmp(properties->items[mid].name, name);
+
+		if (c == 0) {
+			return properties->items + mid;
+		} else if (c < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
 	}
 
-	return t;
+	return null;
 }
 
-struct tiled_map* load_map(const char* filename) {
-	struct file file = file_open(filename);
-	if (!file_good(&file)) {
-		fprintf(stderr, "Failed to open file `%s'.\n", filename);
-		return null;
-	}
+static void load_tileset(const struct map_view* view, struct map_arena* arena, struct tileset* tileset,
+	const struct map_tileset* record) {
+	tileset->name = get_string(view, record->name);
+	tileset->image = load_texture(get_string(view, record->image), sprite_texture);
 
-	struct tiled_map* map = core_alloc(sizeof(struct tiled_map));
+	tileset->tile_count = record->tile_count;
+	tileset->tile_w = record->tile_w;
+	tileset->tile_h = record->tile_h;
 
-	map->properties = read_properties(&file);
+	tileset->animations = arena_take(arena, (u64)record->tile_count * sizeof(struct animated_tile));
 
-	/* Load the tilesets. */
-	map->tileset_count = read_u32(&file);
-	map->tilesets = core_calloc(map->tileset_count, sizeof(struct tileset));
+	if (!map_range_ok(record->animations, view->header->animations)) { return; }
 
-	for (u32 i = 0; i < map->tileset_count; i++) {
-		struct tileset* current = map->tilesets + i;
+	tileset->animated = arena_take(arena, (u64)record->animations.count * sizeof(u32));
+
+	for (u32 i = 0; i < record->animations.count; i++) {
+		const struct map_animation* animation = view->animations + record->animations.first + i;
+
+		if (animation->tile_id >= record->tile_count || !map_range_ok(animation->frames, view->header->frames)) {
+			continue;
+		}
+
+		struct animated_tile* tile = tileset->animations + animation->tile_id;
+		if (tile->exists || animation->frames.count == 0) { continue; }
 
-		current->name = read_string(&file);
+		tile->exists = true;
+		tile->frame_count = animation->frames.count < anim_tile_frame_count ?
+			animation->frames.count : anim_tile_frame_count;
 
-		char* path = read_string(&file);
-		current->image = load_texture(path, sprite_texture);
-		core_free(path);
+		f64 end = 0.0;
+		for (u32 ii = 0; ii < tile->frame_count; ii++) {
+			const struct map_frame* frame = view->frames + animation->frames.first + ii;
 
-		current->tile_count = read_u32(&file);
+			end += frame->duration > 0 ? (f64)frame->duration * 0.001 : 0.0;
 
-		current->tile_w = read_u32(&file);
-		current->tile_h = read_u32(&file);
+			tile->frames[ii] = (i16)frame->tile_id;
+			tile->ends[ii] = end;
+		}
 
-		current->animations = core_calloc(current->tile_count, sizeof(struct animated_tile));
+		tileset->animated[tileset->animated_count++] = animation->tile_id;
+	}
+}
 
-		/* Load animations. */
-		u32 animation_count = read_u32(&file);
-		
-		for (u32 ii = 0; ii < animation_count; ii++) {
-			u32 frame_count = read_u32(&file);
-			u32 id = read_u32(&file);
+void update_tile_animations(struct tileset* tileset, f64 time) {
+	for (u32 i = 0; i < tileset->animated_count; i++) {
+		struct animated_tile* tile = tileset->animations + tileset->animated[i];
 
-			struct animated_tile* tile = current->animations + id;
-			tile->frame_count = frame_count;
-			tile->timer = 0.0;
-			tile->exists = true;
+		const f64 length = tile->ends[tile->frame_count - 1];
+		if (length <= 0.0) {
 			tile->current_frame = 0;
+			continue;
+		}
 
-			for (u32 iii = 0; iii < frame_count; iii++) {
-				i32 tile_id = read_i32(&file);
-				i32 duration = read_i32(&file);
-				
-				tile->frames[iii] = tile_id;
-				tile->durations[iii] = (f64)duration * 0.001;
+		const f64 t = fmod(time, length);
+
+		/* Find the first frame that ends after `t'. */
+		u32 lo = 0, hi = tile->frame_count - 1;
+		while (lo < hi) {
+			const u32 mid = lo + (hi - lo) / 2;
+
+			if (tile->ends[mid] > t) {
+				hi = mid;
+			} else {
+				lo = mid + 1;
 			}
 		}
+
+		tile->current_frame = lo;
 	}
+}
 
-	map->layer_count = read_u32(&file);
-	map->layers = core_calloc(map->layer_count, sizeof(struct layer));
+static void load_object(const struct map_view* view, struct property* properties, struct object* object,
+	const struct map_object* record) {
+	object->name = get_string(view, record->name);
+	object->type = get_string(view, record->type);
+	object->shape = record->shape;
+	object->properties = make_properties(view, properties, record->properties);
+
+	switch (object->shape) {
+		case object_shape_point:
+			object->as.point = make_v2f(record->x, record->y);
+			break;
+		case object_shape_polygon:
+			if (map_range_ok(record->points, view->header->points)) {
+				object->as.polygon.points = (v2f*)view->points + record->points.first;
+				object->as.polygon.count = record->points.count;
+			}
+			break;
+		case object_shape_rect:
+			object->as.rect = (struct f32_rect) { record->x, record->y, record->w, record->h };
+			break;
+		default: break;
+	}
+}
 
-	for (u32 i = 0; i < map->layer_count; i++) {
-		struct layer* layer = map->layers + i;
-
-		layer->name = read_string(&file);
-
-		layer->properties = read_properties(&file);
-
-		layer->type = read_i32(&file);
-
-		switch (layer->type) {
-			case layer_tiles: {
-				layer->as.tile_layer.w = read_u32(&file);
-				layer->as.tile_layer.h = read_u32(&file);
-
-				layer->as.tile_layer.tiles = core_calloc(layer->as.tile_layer.w * layer->as.tile_layer.h, sizeof(struct tile));
-
-				for (u64 y = 0; y < layer->as.tile_layer.h; y++) {
-					for (u64 x = 0; x < layer->as.tile_layer.w; x++) {
-						layer->as.tile_layer.tiles[x + y * layer->as.tile_layer.w] = (struct tile) {
-							.id = read_i16(&file),
-							.tileset_id = read_i16(&file)
-						};
-					}
-				}
-			} break;
-			case layer_objects: {
-				layer->as.object_layer.object_count = read_u32(&file);
-				layer->as.object_layer.objects = core_calloc(layer->as.object_layer.object_count, sizeof(struct object));
-
-				for (u32 ii = 0; ii < layer->as.object_layer.object_count; ii++) {
-					struct object* object = layer->as.object_layer.objects + ii;
-
-					object->properties = read_properties(&file);
-
-					object->name = read_string(&file);
-					object->type = read_string(&file);
-
-					object->shape = read_i32(&file);
-
-					switch (object->shape) {
-						case object_shape_point:
-							object->as.point.x = read_f32(&file);
-							object->as.point.y = read_f32(&file);
-							break;
-						case object_shape_polygon: {
-							object->as.polygon.count = read_u32(&file);
-							object->as.polygon.points = core_calloc(object->as.polygon.count, sizeof(v2f));
-
-							for (u32 iii = 0; iii < object->as.polygon.count; iii++) {
-								object->as.polygon.points[iii].x = read_f32(&file);
-								object->as.polygon.points[iii].y = read_f32(&file);
-							}
-						} break;
-						case object_shape_rect:
-							object->as.rect.x = read_f32(&file);
-							object->as.rect.y = read_f32(&file);
-							object->as.rect.w = read_f32(&file);
-							object->as.rect.h = read_f32(&file);
-							break;
-						default: break;
-					}
-				}
-			} break;
-			default:
-				fprintf(stderr, "Loading map `%s'; Unkown layer type ID %d\n", filename, layer->type);
+static void load_layer(const struct map_view* view, struct property* properties, struct object* objects,
+	struct layer* layer, const struct map_layer* record, const char* filename) {
+
+	layer->name = get_string(view, record->name);
+	layer->type = record->type;
+	layer->properties = make_properties(view, properties, record->properties);
+
+	switch (layer->type) {
+		case layer_tiles: {
+			/* Tiles are used straight from the file. */
+			struct map_table tiles = { record->tiles, record->w * record->h };
+
+			if ((u64)record->w * record->h != tiles.count || !check_table(view, tiles, sizeof(struct tile), sizeof(i16))) {
+				fprintf(stderr, "Loading map `%s'; Tile layer `%s' is truncated.\n", filename, layer->name);
+				layer->type = layer_unknown;
+				break;
+			}
+
+			layer->as.tile_layer.tiles = (struct tile*)(view->data + record->tiles);
+			layer->as.tile_layer.w = record->w;
+			layer->as.tile_layer.h = record->h;
+		} break;
+		case layer_objects: {
+			if (!map_range_ok(record->objects, view->header->objects)) {
+				fprintf(stderr, "Loading map `%s'; Object layer `%s' is truncated.\n", filename, layer->name);
+				layer->type = layer_unknown;
 				break;
-		};
+			}
+
+			layer->as.object_layer.object_count = record->objects.count;
+			layer->as.object_layer.objects = objects + record->objects.first;
+
+			for (u32 i = 0; i < record->objects.count; i++) {
+				load_object(view, properties, layer->as.object_layer.objects + i,
+					view->objects + record->objects.first + i);
+			}
+		} break;
+		default:
+			fprintf(stderr, "Loading map `%s'; Unkown layer type ID %d\n", filename, layer->type);
+			break;
+	}
+}
+
+struct tiled_map* load_map(const char* filename) {
+	struct file file = file_open(filename);
+	if (!file_good(&file)) {
+		fprintf(stderr, "Failed to open file `%s'.\n", filename);
+		return null;
+	}
+
+	return load_map_from_file(file, filename);
+}
+
+struct tiled_map* load_map_from_file(struct file file, const char* filename) {
+	struct map_view view;
+	if (!open_map_view(&view, file.data, file.size)) {
+		fprintf(stderr, "`%s' is not a version %d map; Export it from Tiled again.\n", filename, map_version);
+		file_close(&file);
+		return null;
+	}
+
+	const struct map_header* header = view.header;
+
+	struct map_arena arena = { .data = core_calloc(1, map_alloc_size(&view)) };
+
+	struct tiled_map* map = arena_take(&arena, sizeof(struct tiled_map));
+	map->file = file;
+
+	struct property* properties = arena_take(&arena, (u64)header->properties.count * sizeof(struct property));
+	struct object* objects = arena_take(&arena, (u64)header->objects.count * sizeof(struct object));
+
+	map->properties = make_properties(&view, properties, header->map_properties);
+
+	map->tileset_count = header->tilesets.count;
+	map->tilesets = arena_take(&arena, (u64)map->tileset_count * sizeof(struct tileset));
+
+	for (u32 i = 0; i < map->tileset_count; i++) {
+		load_tileset(&view, &arena, map->tilesets + i, view.tilesets + i);
+	}
+
+	map->layer_count = header->layers.count;
+	map->layers = arena_take(&arena, (u64)map->layer_count * sizeof(struct layer));
+
+	for (u32 i = 0; i < map->layer_count; i++) {
+		load_layer(&view, properties, objects, map->layers + i, view.layers + i, filename);
 	}
 
 	return map;
 }
 
 void free_map(struct tiled_map* map) {
-	for (table_iter(map->properties, i)) {
-		struct property* prop = i.value;
-
-		if (prop->type == prop_string) {
-			core_free(prop->as.string);
-		}
+	for (u32 i = 0; i < map->tileset_count; i++) {
+		res_release_texture(map->tilesets[i].image);
 	}
-	free_table(map->properties);
 
-	if (map->tilesets) {
-		for (u32 i = 0; i < map->tileset_count; i++) {
-			core_free(map->tilesets[i].name);
-			core_free(map->tilesets[i].animations);
-		}
+	file_close(&map->file);
+
+	core_free(map);
+}
+
+static void append_dependency(char** text, u64* size, const char* type, const char* path, u32 flags) {
+	char line[300];
+	i32 len = snprintf(line, sizeof(line), "%s %s %u\n", type, path, flags);
+	if (len < 0 || len >= (i32)sizeof(line)) { return; }
+
+	*text = core_realloc(*text, *size + len + 1);
+	memcpy(*text + *size, line, len + 1);
+	*size += len;
+}
+
+static bool has_extension(const char* path, const char* extension) {
+	u64 path_len = strlen(path), ext_len = strlen(extension);
+	return path_len >= ext_len && strcmp(path + path_len - ext_len, extension) == 0;
+}
+
+char* cook_map_manifest(const u8* data, u64 size) {
+	char* text = core_alloc(1);
+	text[0] = '\0';
+	u64 text_size = 0;
 
-		core_free(map->tilesets);
+	struct map_view view;
+	if (!open_map_view(&view, data, size)) {
+		return text;
 	}
 
-	if (map->layers) {
-		for (u32 i = 0; i < map->layer_count; i++) {
-			struct layer* layer = map->layers + i;
+	struct map_range properties = view.header->map_properties;
 
-			core_free(layer->name);
+	for (u32 i = 0; i < properties.count; i++) {
+		const struct map_property* prop = view.properties + properties.first + i;
+		if (prop->type != prop_string) { continue; }
 
-			for (table_iter(layer->properties, it)) {
-				struct property* prop = it.value;
+		const char* value = map_string(&view, prop->as.string);
 
-				if (prop->type == prop_string) {
-					core_free(prop->as.string);
-				}
-			}
-			free_table(layer->properties);
-
-			switch (layer->type) {
-				case layer_tiles:
-					core_free(layer->as.tile_layer.tiles);
-					break;
-				case layer_objects: {
-					for (u32 ii = 0; ii < layer->as.object_layer.object_count; ii++) {
-						struct object* object = layer->as.object_layer.objects + ii;
-
-						core_free(object->name);
-						core_free(object->type);
-
-						if (object->shape == object_shape_polygon) {
-							core_free(object->as.polygon.points);
-						}
-					
-						for (table_iter(object->properties, it)) {
-							struct property* prop = it.value;
-
-							if (prop->type == prop_string) {
-								core_free(prop->as.string);
-							}
-						}
-						free_table(object->properties);
-					}
-					core_free(layer->as.object_layer.objects);
-				} break;
-				default: break;
-			}
+		if (has_extension(value, ".bmp")) {
+			append_dependency(&text, &text_size, "texture", value, sprite_texture);
+		} else if (has_extension(value, ".wav")) {
+			append_dependency(&text, &text_size, "audio", value, 0);
+		} else if (has_extension(value, ".glsl")) {
+			append_dependency(&text, &text_size, "shader", value, 0);
 		}
+	}
 
-		core_free(map->layers);
+	for (u32 i = 0; i < view.header->tilesets.count; i++) {
+		append_dependency(&text, &text_size, "texture", map_string(&view, view.tilesets[i].image), sprite_texture);
 	}
 
-	core_free(map);
+	return text;
+}
+
+struct res_manifest* load_map_manifest(const char* filename) {
+#ifdef DEBUG
+	u8* data;
+	u64 size;
+	if (!read_raw(filename, &data, &size, false)) {
+		fprintf(stderr, "Failed to open file `%s'.\n", filename);
+		return null;
+	}
+
+	char* text = cook_map_manifest(data, size);
+	struct res_manifest* manifest = new_res_manifest(text);
+
+	core_free(text);
+	core_free(data);
+
+	return manifest;
+#else
+	char path[256];
+	snprintf(path, sizeof(path), "%s" map_manifest_ext, filename);
+
+	return load_res_manifest(path);
+#endif
 }
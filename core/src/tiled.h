@@ -4,7 +4,7 @@
  * generic data structure. */
 
 #include "common.h"
-#include "table.h"
+#include "res.h"
 #include "video.h"
 
 #define anim_tile_frame_count 32
@@ -18,11 +18,13 @@ struct animated_tile {
 	bool exists;
 
 	i16 frames[anim_tile_frame_count];
-	f64 durations[anim_tile_frame_count];
+
+	/* When each frame ends, in seconds from the start of the
+	 * animation; The last one is the length of the whole animation. */
+	f64 ends[anim_tile_frame_count];
 
 	u32 frame_count;
 	u32 current_frame;
-	f64 timer;
 };
 
 struct tileset {
@@ -31,7 +33,13 @@ struct tileset {
 	i32 tile_w, tile_h;
 	i32 tile_count;
 
+	/* Indexed by tile ID. */
 	struct animated_tile* animations;
+
+	/* The IDs of the tiles that are animated, so that updating the
+	 * animations doesn't have to go through every tile. */
+	u32* animated;
+	u32 animated_count;
 };
 
 enum {
@@ -49,21 +57,6 @@ struct f32_rect {
 	f32 x, y, w, h;
 };
 
-struct object {
-	i32 shape;
-	u32 id;
-	char* name;
-	char* type;
-
-	union {
-		struct f32_rect rect;
-		v2f point;
-		struct polygon polygon;
-	} as;
-
-	struct table* properties;
-};
-
 enum {
 	prop_bool = 0,
 	prop_number,
@@ -71,6 +64,7 @@ enum {
 };
 
 struct property {
+	char* name;
 	i32 type;
 
 	union {
@@ -80,6 +74,32 @@ struct property {
 	} as;
 };
 
+/* The properties of a map, a layer or an object, sorted by name. Names
+ * are pooled in the map file, so every property with the same name
+ * points at the same string. */
+struct properties {
+	struct property* items;
+	u32 count;
+};
+
+/* Returns null if there is no property with the name. */
+API const struct property* find_property(const struct properties* properties, const char* name);
+
+struct object {
+	i32 shape;
+	u32 id;
+	char* name;
+	char* type;
+
+	union {
+		struct f32_rect rect;
+		v2f point;
+		struct polygon polygon;
+	} as;
+
+	struct properties properties;
+};
+
 enum {
 	layer_unknown = -1,
 	layer_tiles = 0,
@@ -102,9 +122,12 @@ struct layer {
 		} object_layer;
 	} as;
 
-	struct table* properties;
+	struct properties properties;
 };
 
+/* Everything that a map needs is allocated along with it, in one
+ * block, so that loading a map makes one allocation and freeing it
+ * makes one free. */
 struct tiled_map {
 	struct layer* layers;
 	u32 layer_count;
@@ -112,8 +135,170 @@ struct tiled_map {
 	struct tileset* tilesets;
 	u32 tileset_count;
 
-	struct table* properties;
+	struct properties properties;
+
+	/* Names, strings, tiles and polygon points point straight into
+	 * the file, which stays open for as long as the map is loaded. */
+	struct file file;
+};
+
+/* The binary map format, as written by `tiledext/mapformat.js'.
+ *
+ * A map file starts with a map_header, which gives the offset and
+ * count of every table in the file. Offsets are from the start of the
+ * file, and every table is aligned to its largest member, so that the
+ * file can be used in place once it is in memory. Records refer to
+ * each other by index, and to strings by their offset into the string
+ * pool, where they are null terminated.
+ *
+ * Properties of the map, of layers and of objects are all stored in
+ * one table, with each owner's properties next to each other. Tile
+ * layers are stored as `w * h' struct tile, in rows. */
+
+#define map_magic "OMVD"
+#define map_version 2
+
+struct map_table {
+	u32 offset;
+	u32 count;
+};
+
+struct map_range {
+	u32 first;
+	u32 count;
+};
+
+struct map_header {
+	char magic[4];
+	u32 version;
+
+	struct map_table properties;
+	struct map_table tilesets;
+	struct map_table animations;
+	struct map_table frames;
+	struct map_table layers;
+	struct map_table objects;
+	struct map_table points;
+
+	/* The count is the size of the pool in bytes. */
+	struct map_table strings;
+
+	/* Into the property table. */
+	struct map_range map_properties;
+};
+
+struct map_property {
+	u32 name;
+	i32 type;
+
+	union {
+		f64 number;
+		u32 boolean;
+		u32 string;
+	} as;
+};
+
+struct map_tileset {
+	u32 name;
+	u32 image;
+	u32 tile_count;
+	u32 tile_w, tile_h;
+
+	/* Into the animation table. */
+	struct map_range animations;
+};
+
+struct map_animation {
+	u32 tile_id;
+
+	/* Into the frame table. */
+	struct map_range frames;
+};
+
+struct map_frame {
+	i32 tile_id;
+	i32 duration; /* In milliseconds. */
+};
+
+struct map_layer {
+	u32 name;
+	i32 type;
+
+	struct map_range properties;
+
+	/* For tile layers, the offset of the tiles; For object layers,
+	 * into the object table. */
+	u32 w, h;
+	u32 tiles;
+	struct map_range objects;
+};
+
+struct map_object {
+	u32 name;
+	u32 type;
+	i32 shape;
+
+	struct map_range properties;
+
+	/* Rectangles use all four; Points use `x' and `y'. */
+	f32 x, y, w, h;
+
+	/* Into the point table, for polygons. */
+	struct map_range points;
+};
+
+/* The tables of a map file, once open_map_view has checked that they
+ * are within it. Ranges in records still have to be checked with
+ * map_range_ok before they are used. `data' must be aligned to 8
+ * bytes. */
+struct map_view {
+	const struct map_header* header;
+
+	const struct map_property* properties;
+	const struct map_tileset* tilesets;
+	const struct map_animation* animations;
+	const struct map_frame* frames;
+	const struct map_layer* layers;
+	const struct map_object* objects;
+	const v2f* points;
+	const char* strings;
+
+	const u8* data;
+	u64 size;
 };
 
+API bool open_map_view(struct map_view* view, const u8* data, u64 size);
+API bool map_range_ok(struct map_range range, struct map_table table);
+
+/* Returns an empty string if the offset is out of the pool. */
+API const char* map_string(const struct map_view* view, u32 offset);
+
+/* Returns null if there is no property with the name in the range. */
+API const struct map_property* map_find_property(const struct map_view* view, struct map_range range, const char* name);
+
 API struct tiled_map* load_map(const char* filename);
+
+/* For a map that has already been opened, such as on another thread.
+ * The map takes the file over, and closes it if it can't be read. */
+API struct tiled_map* load_map_from_file(struct file file, const char* filename);
 API void free_map(struct tiled_map* map);
+
+/* Sets the current frame of every animated tile of a tileset from a
+ * clock, in seconds, so that the frames only depend on the time, and
+ * not on how it has been stepped. */
+API void update_tile_animations(struct tileset* tileset, f64 time);
+
+/* Maps depend on the textures of their tilesets, and on any resource
+ * that one of the map's string properties names. The packer cooks a
+ * resource manifest (see `res.h') listing these for every map, and
+ * stores it at the path of the map followed by map_manifest_ext, so
+ * that the resources can be prefetched before the map is loaded.
+ *
+ * cook_map_manifest builds the manifest from the data of a map file.
+ * load_map_manifest loads the cooked manifest in release; In debug,
+ * maps aren't cooked, so it is built from the map there and then. */
+
+#define map_manifest_ext ".deps"
+
+API char* cook_map_manifest(const u8* data, u64 size);
+API struct res_manifest* load_map_manifest(const char* filename);
@@ -31,6 +31,35 @@ struct shader {
 	u32 id;
 };
 
+enum {
+	shader_vertex = 0,
+	shader_fragment,
+	shader_geometry,
+	shader_stage_count
+};
+
+/* The source of each stage of a shader. The sources point into
+ * `data', which owns them; A stage that the shader doesn't have is
+ * null. */
+struct shader_stages {
+	char* data;
+	const char* sources[shader_stage_count];
+};
+
+/* Split a shader into its `#begin'/`#end' sections. This is done in
+ * place, so `source' is owned by the stages afterwards. */
+API void split_shader(struct shader_stages* stages, char* source);
+
+/* Decode a shader that was cooked by the packer (see `pack.h'). On
+ * success, the stages take ownership of `data'; Returns false, leaving
+ * `data' alone, if it isn't a cooked shader. */
+API bool decode_cooked_shader(struct shader_stages* stages, u8* data, u64 size);
+
+API void deinit_shader_stages(struct shader_stages* stages);
+
+/* Linked programs are cached on disk, keyed by their source and the
+ * driver, if the driver can give them back as binaries. */
+API void init_shader_from_stages(struct shader* shader, const struct shader_stages* stages, const char* name);
 API void init_shader(struct shader* shader, const char* source, const char* name);
 API void deinit_shader(struct shader* shader);
 API void bind_shader(const struct shader* shader);
@@ -48,7 +77,10 @@ enum {
 	vb_dynamic    = 1 << 1,
 	vb_lines      = 1 << 2,
 	vb_line_strip = 1 << 3,
-	vb_tris       = 1 << 4
+	vb_tris       = 1 << 4,
+
+	/* Set by use_shared_ib. */
+	vb_shared_indices = 1 << 5
 };
 
 struct vertex_buffer {
@@ -70,9 +102,83 @@ API void update_vertices(const struct vertex_buffer* vb, f32* vertices, u32 offs
 API void update_indices(struct vertex_buffer* vb, u32* indices, u32 offset, u32 count);
 API void configure_vb(const struct vertex_buffer* vb, u32 index, u32 component_count,
  	u32 stride, u32 offset);
+
+/* The types of attribute that configure_vb_attrib can read. `_norm'
+ * types are read by the shader as floats from zero to one; Integer
+ * types are read as integers, without being converted at all. */
+enum {
+	vb_attrib_f32 = 0,
+	vb_attrib_u8_norm,
+	vb_attrib_u16_norm,
+	vb_attrib_u32
+};
+
+/* Like configure_vb, but for any type of attribute. `stride' and
+ * `offset' are in bytes. */
+API void configure_vb_attrib(const struct vertex_buffer* vb, u32 index, u32 component_count,
+	u32 type, u32 stride, u32 offset);
+
+/* An index buffer that any number of vertex buffers can draw with,
+ * in place of indices of their own. */
+struct index_buffer {
+	u32 id;
+	u32 count;
+};
+
+API void init_ib(struct index_buffer* ib, u32* indices, u32 count);
+API void deinit_ib(struct index_buffer* ib);
+
+/* Makes a vertex buffer draw with `ib' from now on. Expects the vertex
+ * buffer to be bound for editing, and `ib' to outlive it. */
+API void use_shared_ib(struct vertex_buffer* vb, const struct index_buffer* ib);
 API void draw_vb(const struct vertex_buffer* vb);
 API void draw_vb_n(const struct vertex_buffer* vb, u32 count);
 
+/* Draws `count' indices, as though `base_vertex' had been added to
+ * every one of them. */
+API void draw_vb_n_base(const struct vertex_buffer* vb, u32 count, u32 base_vertex);
+
+/* A vertex buffer that batches of vertices are streamed into, without
+ * ever waiting for the GPU to finish drawing an earlier batch.
+ *
+ * Where GL_ARB_buffer_storage is supported, the buffer is mapped once,
+ * for good, and is split into stream_vb_regions regions, which batches
+ * are written straight into one after the other. Once a region is
+ * full, a fence is placed after the draws from it, which is only waited
+ * on when the ring comes back around to it. Elsewhere, batches are
+ * written to memory on the CPU, and the buffer is orphaned before each
+ * one is uploaded, so that the driver can hand out fresh storage
+ * rather than wait on the old. */
+#define stream_vb_regions 3
+
+struct stream_vb {
+	struct vertex_buffer vb;
+
+	/* In bytes. */
+	u32 region_size;
+	u32 region;
+	u32 cursor;
+
+	/* Null when the buffer is orphaned instead. */
+	u8* mapping;
+	void* fences[stream_vb_regions];
+
+	u8* staging;
+};
+
+API void init_stream_vb(struct stream_vb* svb, i32 flags, u32 region_size);
+API void deinit_stream_vb(struct stream_vb* svb);
+
+/* Returns where the next batch is to be written. It has room for at
+ * least `min_size' bytes; `capacity' is set to how many it really has
+ * room for. */
+API void* stream_vb_begin(struct stream_vb* svb, u32 min_size, u32* capacity);
+
+/* Hands the first `size' bytes of the batch over to the GPU, and
+ * returns where they are in the buffer, in bytes. Expects the buffer
+ * to be bound for editing. */
+API u32 stream_vb_commit(struct stream_vb* svb, u32 size);
+
 enum {
 	texture_filter_nearest = 1 << 0,
 	texture_filter_linear  = 1 << 2,
@@ -86,12 +192,38 @@ enum {
 
 #define sprite_texture (texture_filter_nearest | texture_clamp)
 
+/* Textures that the packer baked into an atlas share the GL texture
+ * of the atlas; `x' and `y' are where the texture sits in it, and
+ * `atlas_width' and `atlas_height' are the size of the whole atlas.
+ * For any other texture, they describe the texture itself. */
 struct texture {
 	u32 id;
 	u32 width, height;
+
+	u32 x, y;
+	u32 atlas_width, atlas_height;
 };
 
+/* Pixels that are ready to be uploaded to a texture. Decoding an
+ * image doesn't touch the GPU, so unlike creating a texture it can
+ * be done from any thread. */
+struct image {
+	u8* pixels;
+	u32 width, height;
+	u32 flags;
+};
+
+API bool decode_bitmap(struct image* image, const u8* src, u64 size, u32 flags);
+
+/* Decode a texture that was cooked by the packer (see `pack.h').
+ * Nothing is copied; The pixels of the image point into `data', so it
+ * must outlive the image, which mustn't be passed to deinit_image.
+ * Returns false if `data' isn't a cooked texture. */
+API bool decode_cooked_texture(struct image* image, const u8* data, u64 size, u32 flags);
+API void deinit_image(struct image* image);
+
 API void init_texture(struct texture* texture, u8* src, u64 size, u32 flags);
+API void init_texture_from_image(struct texture* texture, const struct image* image);
 API void init_texture_no_bmp(struct texture* texture, u8* src, u32 w, u32 h, u32 flags);
 API void update_texture(struct texture* texture, u8* data, u64 size, u32 flags);
 API void update_texture_no_bmp(struct texture* texture, u8* src, u32 w, u32 h, u32 flags);
@@ -137,9 +269,34 @@ struct light {
 	f32 intensity;
 };
 
+/* How many quads any renderer can draw at once. Each renderer is given
+ * its own batch size, up to this, since a renderer's stream buffer
+ * takes up stream_vb_regions batches of memory whether it is used or
+ * not; Something that only draws a HUD doesn't need room for every
+ * tile in a room. */
+#define renderer_max_batch_size 16384
+
+/* The vertices that renderers and quad meshes draw quads with, packed
+ * as tightly as sprite.glsl can read them. Texture coordinates are
+ * normalised, so they must be within the texture. */
+struct quad_vertex {
+	f32 x, y;
+	u16 u, v;
+	struct color color;
+
+	/* The texture slot, or quad_vertex_untextured, in the low byte,
+	 * along with any of the flags below. */
+	u32 flags;
+};
+
+enum {
+	quad_vertex_untextured = 0xff,
+	quad_vertex_inverted   = 1 << 8,
+	quad_vertex_unlit      = 1 << 9
+};
+
 struct renderer {
 	struct shader shader;
-	struct vertex_buffer vb;
 
 	u32 quad_count;
 
@@ -162,20 +319,54 @@ struct renderer {
 	struct light lights[max_lights];
 	u32 light_count;
 
-	f32 verts[100 * 11 * 4];
-	u32 indices[100 * 6];
+	/* The batch that is being pushed to, which is written straight
+	 * into the vertex buffer where it can be; See `stream_vb'. */
+	struct stream_vb stream;
+	struct quad_vertex* verts;
+	u32 batch_size;
+	u32 batch_capacity;
 };
 
-API struct renderer* new_renderer(struct shader shader, v2i dimentions);
+/* A `batch_size' of zero, or one that is over renderer_max_batch_size,
+ * is taken to be renderer_max_batch_size. */
+API struct renderer* new_renderer(struct shader shader, v2i dimentions, u32 batch_size);
 API void free_renderer(struct renderer* renderer);
 API void renderer_flush(struct renderer* renderer);
 API void renderer_end_frame(struct renderer* renderer);
 API void renderer_push(struct renderer* renderer, struct textured_quad* quad);
+
+/* Pushes an array of quads, as though they had been pushed one by one;
+ * For things like text and tiles, which come in arrays anyway. */
+API void renderer_push_n(struct renderer* renderer, const struct textured_quad* quads, u32 count);
 API void renderer_push_light(struct renderer* renderer, struct light light);
 API void renderer_clip(struct renderer* renderer, struct rect clip);
 API void renderer_resize(struct renderer* renderer, v2i size);
 API void renderer_fit_to_main_window(struct renderer* renderer);
 
+/* A batch of quads that is built once and kept on the GPU, for things
+ * that don't change from one frame to the next, like tile maps. It is
+ * drawn with the state of a renderer, just as if its quads had been
+ * pushed, but without building them again. A mesh can only use as many
+ * textures as a renderer has slots for. */
+struct quad_mesh {
+	struct vertex_buffer vb;
+
+	struct texture* textures[32];
+	u32 texture_count;
+
+	u32 quad_count;
+};
+
+API void init_quad_mesh(struct quad_mesh* mesh, const struct textured_quad* quads, u32 count);
+API void deinit_quad_mesh(struct quad_mesh* mesh);
+
+/* How many bytes the mesh takes up on the GPU. */
+API u64 quad_mesh_size(const struct quad_mesh* mesh);
+
+/* Flushes the quads that have been pushed so far first, so that the
+ * mesh is drawn over them. */
+API void renderer_draw_quad_mesh(struct renderer* renderer, const struct quad_mesh* mesh);
+
 struct post_processor {
 	struct render_target target;
 
@@ -210,13 +401,35 @@ API i32 render_text_fancy(struct renderer* renderer, struct font* font,
 		struct textured_quad* coin);
 
 API struct font* load_font_from_memory(void* data, u64 filesize, f32 size);
+
+/* Loading a font is split into two steps, so that the glyphs can
+ * be baked on another thread: decode_font does all of the work,
+ * except for creating the atlas textures, which is left to
+ * upload_font. */
+API struct font* decode_font(void* data, u64 filesize, f32 size);
+API void upload_font(struct font* font);
 API void free_font(struct font* font);
 
+/* Like decode_font, but the glyph sets are read from `cooked', which
+ * was made by cook_font, instead of being baked. Sets that aren't
+ * in it are baked when they are needed, as usual. Takes ownership of
+ * both `data' and `cooked'. */
+API struct font* decode_cooked_font(void* data, u64 filesize, f32 size, u8* cooked, u64 cooked_size);
+
+/* Bake the glyph sets for the given pages of a font ahead of time, in
+ * the format described in `pack.h'. Page `n' covers code points
+ * n * 256 to n * 256 + 255. Doesn't need a GPU. */
+API u8* cook_font(void* data, u64 filesize, f32 size, const u32* pages, u32 page_count, u64* cooked_size);
+
 API void set_font_tab_size(struct font* font, i32 n);
 API i32 get_font_tab_size(struct font* font);
 
 API f32 get_font_size(struct font* font);
 
+/* The amount of GPU memory used by the glyph atlases that have
+ * been baked so far, in bytes. */
+API u64 get_font_atlas_size(struct font* font);
+
 API i32 font_height(struct font* font);
 
 API i32 text_width(struct font* font, const char* text);
@@ -4,18 +4,124 @@
 #include <string.h>
 
 #include "core.h"
+#include "pack.h"
+#include "platform.h"
 #include "res.h"
 #include "util/glad.h"
 #include "video.h"
 
 bool depth_test_enabled = false;
 
+/* Program binaries are only core from 4.1, and glad is generated for
+ * 3.3, so their entry points are loaded by hand. They are null if the
+ * driver can't give back program binaries. */
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH           0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS      0x87FE
+
+typedef void (APIENTRYP get_program_binary_func)(GLuint program, GLsizei size, GLsizei* length,
+	GLenum* format, void* binary);
+typedef void (APIENTRYP program_binary_func)(GLuint program, GLenum format, const void* binary,
+	GLsizei length);
+typedef void (APIENTRYP program_parameteri_func)(GLuint program, GLenum name, GLint value);
+
+static get_program_binary_func get_program_binary;
+static program_binary_func program_binary;
+static program_parameteri_func program_parameteri;
+
+/* Every shader has a single file in the cache, named after the hash
+ * of its name rather than of its sources, so that a shader that changes
+ * (or a driver that is updated) replaces its binary instead of adding
+ * another one. The header's key says which sources it was built from. */
+#define program_cache_dir "shadercache"
+
+/* Buffer storage is only core from 4.4, so its entry point is loaded
+ * by hand too. It is null if the driver doesn't support it, in which
+ * case streamed vertex buffers are orphaned instead of being mapped
+ * persistently. */
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT   0x0080
+
+typedef void (APIENTRYP buffer_storage_func)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+static buffer_storage_func buffer_storage;
+
+struct program_binary_header {
+	u64 key;
+	u32 format;
+	u32 size;
+};
+
+/* Identifies the driver, so that binaries from another one are
+ * never loaded. */
+static u64 driver_hash;
+
+static u64 hash_combine(u64 hash, const char* str) {
+	return hash ^ (fnv1a_hash((const u8*)str, strlen(str)) + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2));
+}
+
+static bool has_gl_extension(const char* name) {
+	i32 count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+
+	for (i32 i = 0; i < count; i++) {
+		if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void init_program_cache() {
+	get_program_binary = null;
+	program_binary = null;
+	program_parameteri = null;
+
+	bool supported = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 1) ||
+		has_gl_extension("GL_ARB_get_program_binary");
+	if (!supported) { return; }
+
+	i32 format_count = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+	if (format_count <= 0) { return; }
+
+	get_program_binary = (get_program_binary_func)get_gl_proc("glGetProgramBinary");
+	program_binary = (program_binary_func)get_gl_proc("glProgramBinary");
+	program_parameteri = (program_parameteri_func)get_gl_proc("glProgramParameteri");
+
+	if (!get_program_binary || !program_binary || !program_parameteri) {
+		get_program_binary = null;
+		program_binary = null;
+		program_parameteri = null;
+		return;
+	}
+
+	driver_hash = 0;
+	driver_hash = hash_combine(driver_hash, (const char*)glGetString(GL_VENDOR));
+	driver_hash = hash_combine(driver_hash, (const char*)glGetString(GL_RENDERER));
+	driver_hash = hash_combine(driver_hash, (const char*)glGetString(GL_VERSION));
+}
+
+static void init_buffer_storage() {
+	buffer_storage = null;
+
+	bool supported = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 4) ||
+		has_gl_extension("GL_ARB_buffer_storage");
+	if (!supported) { return; }
+
+	buffer_storage = (buffer_storage_func)get_gl_proc("glBufferStorage");
+}
+
 void video_init() {
 	if (!gladLoadGL()) {
 		fprintf(stderr, "Failed to load OpenGL.\n");
 		abort();
 	}
 
+	init_program_cache();
+	init_buffer_storage();
+
 	depth_test_enabled = false;
 
 	glEnable(GL_BLEND);
@@ -76,141 +182,230 @@ struct bmp_header {
 };
 #pragma pack(pop)
 
-void init_shader(struct shader* shader, const char* source, const char* name) {
-	shader->panic = false;
+void split_shader(struct shader_stages* stages, char* source) {
+	*stages = (struct shader_stages) { .data = source };
+
+	static const char* stage_names[] = {
+		[shader_vertex]   = "VERTEX",
+		[shader_fragment] = "FRAGMENT",
+		[shader_geometry] = "GEOMETRY"
+	};
+
+	char* end = source + strlen(source);
 
-	const u32 source_len = (u32)strlen(source);
+	for (char* line = source; line < end;) {
+		char* next = strchr(line, '\n');
+		next = next ? next + 1 : end;
 
-	char* vertex_source = core_alloc(source_len);
-	char* fragment_source = core_alloc(source_len);
-	char* geometry_source = core_alloc(source_len);
-	memset(vertex_source, 0, source_len);
-	memset(fragment_source, 0, source_len);
-	memset(geometry_source, 0, source_len);
+		const char* directive = line;
+		while (*directive == ' ' || *directive == '\t') { directive++; }
 
-	bool has_geometry = false;
+		if (strncmp(directive, "#begin ", 7) == 0) {
+			for (u32 i = 0; i < shader_stage_count; i++) {
+				if (strncmp(directive + 7, stage_names[i], strlen(stage_names[i])) == 0) {
+					stages->sources[i] = next;
+				}
+			}
+		} else if (strncmp(directive, "#end ", 5) == 0) {
+			/* Terminate the section that this line ends. */
+			*line = '\0';
+		}
 
-	u32 count = 0;
-	i32 adding_to = -1;
-	for (const char* current = source; *current != '\0'; current++) {
-		if (*current == '\n' && *(current + 1) != '\0') {
-			i32 minus = 1;
+		line = next;
+	}
+}
 
-			current++;
+bool decode_cooked_shader(struct shader_stages* stages, u8* data, u64 size) {
+	if (size < sizeof(struct pack_shader) ||
+		memcmp(data, pack_shader_magic, sizeof(((struct pack_shader*)data)->magic)) != 0) {
+		return false;
+	}
 
-			char* line = core_alloc(count + 1);
-			memcpy(line, current - count - minus, count);
-			line[count] = '\0';
+	struct pack_shader header;
+	memcpy(&header, data, sizeof(header));
 
-			if (strstr(line, "#begin VERTEX")) {
-				adding_to = 0;
-			}
-			else if (strstr(line, "#begin FRAGMENT")) {
-				adding_to = 1;
-			}
-			else if (strstr(line, "#begin GEOMETRY")) {
-				adding_to = 2;
-				has_geometry = true;
-			}
-			else if (strstr(line, "#end VERTEX") ||
-				strstr(line, "#end FRAGMENT") ||
-				strstr(line, "#end GEOMETRY")) {
-				adding_to = -1;
-			}
-			else if (adding_to == 0) {
-				strcat(vertex_source, line);
-				strcat(vertex_source, "\n");
-			}
-			else if (adding_to == 1) {
-				strcat(fragment_source, line);
-				strcat(fragment_source, "\n");
-			}
-			else if (adding_to == 2) {
-				strcat(geometry_source, line);
-				strcat(geometry_source, "\n");
-			}
+	const char* sources[shader_stage_count] = { 0 };
 
-			core_free(line);
+	u64 offset = sizeof(header);
+	for (u32 i = 0; i < shader_stage_count; i++) {
+		if (header.sizes[i] == 0) { continue; }
 
-			count = 0;
+		if (offset + header.sizes[i] > size || data[offset + header.sizes[i] - 1] != '\0') {
+			fprintf(stderr, "Cooked shader is malformed.\n");
+			return false;
 		}
 
-		count++;
+		sources[i] = (const char*)data + offset;
+		offset += header.sizes[i];
 	}
 
-	const char* vsp = vertex_source;
-	const char* fsp = fragment_source;
-	const char* gsp = geometry_source;
+	stages->data = (char*)data;
+	memcpy(stages->sources, sources, sizeof(sources));
 
-	i32 success;
-	u32 v, f, g;
-	v = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(v, 1, &vsp, NULL);
-	glCompileShader(v);
+	return true;
+}
 
-	glGetShaderiv(v, GL_COMPILE_STATUS, &success);
-	if (!success) {
-		char info_log[1024];
-		glGetShaderInfoLog(v, 1024, null, info_log);
-		fprintf(stderr, "Vertex shader of `%s' failed to compile with the following errors:\n%s", name,
-			info_log);
-		shader->panic = true;
+void deinit_shader_stages(struct shader_stages* stages) {
+	core_free(stages->data);
+	*stages = (struct shader_stages) { 0 };
+}
+
+static u64 program_cache_key(const struct shader_stages* stages) {
+	u64 key = driver_hash;
+
+	for (u32 i = 0; i < shader_stage_count; i++) {
+		key = hash_combine(key, stages->sources[i] ? stages->sources[i] : "");
 	}
 
-	f = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(f, 1, &fsp, null);
-	glCompileShader(f);
+	return key;
+}
 
-	glGetShaderiv(f, GL_COMPILE_STATUS, &success);
-	if (!success) {
-		char info_log[1024];
-		glGetShaderInfoLog(f, 1024, null, info_log);
-		fprintf(stderr, "Fragment shader of `%s' failed to compile with the following errors:\n%s", name,
-			info_log);
-		shader->panic = true;
+static void program_cache_path(char* path, const char* name) {
+	u64 hash = fnv1a_hash((const u8*)name, strlen(name));
+	sprintf(path, program_cache_dir "/%016llx.bin", (unsigned long long)hash);
+}
+
+/* Returns false if there is no usable binary for the program, in
+ * which case it has to be compiled. */
+static bool load_program_binary(u32 id, const char* name, u64 key) {
+	char path[256];
+	program_cache_path(path, name);
+
+	if (!file_exists(path)) { return false; }
+
+	u8* data;
+	u64 size;
+	if (!read_raw_no_pck(path, &data, &size, false)) {
+		return false;
+	}
+
+	struct program_binary_header header;
+	bool ok = size >= sizeof(header);
+	if (ok) {
+		memcpy(&header, data, sizeof(header));
+		ok = header.key == key && header.size == size - sizeof(header);
+	}
+
+	/* The driver is free to reject a binary, for example after
+	 * it has been updated. */
+	if (ok) {
+		program_binary(id, header.format, data + sizeof(header), header.size);
+
+		i32 success;
+		glGetProgramiv(id, GL_LINK_STATUS, &success);
+		ok = success;
+	}
+
+	core_free(data);
+
+	return ok;
+}
+
+static void save_program_binary(u32 id, const char* name, u64 key) {
+	i32 length = 0;
+	glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0 || !make_dir(program_cache_dir)) { return; }
+
+	u8* binary = core_alloc(length);
+
+	struct program_binary_header header = { .key = key, .size = (u32)length };
+	get_program_binary(id, length, null, &header.format, binary);
+
+	char path[256];
+	program_cache_path(path, name);
+
+	FILE* file = fopen(path, "wb");
+	if (file) {
+		fwrite(&header, sizeof(header), 1, file);
+		fwrite(binary, 1, length, file);
+		fclose(file);
+	} else {
+		fprintf(stderr, "Failed to open `%s' for writing.\n", path);
+	}
+
+	core_free(binary);
+}
+
+void init_shader_from_stages(struct shader* shader, const struct shader_stages* stages, const char* name) {
+	static const char* stage_names[] = {
+		[shader_vertex]   = "Vertex",
+		[shader_fragment] = "Fragment",
+		[shader_geometry] = "Geometry"
+	};
+
+	static const u32 stage_types[] = {
+		[shader_vertex]   = GL_VERTEX_SHADER,
+		[shader_fragment] = GL_FRAGMENT_SHADER,
+		[shader_geometry] = GL_GEOMETRY_SHADER
+	};
+
+	shader->panic = false;
+
+	u32 id = glCreateProgram();
+	shader->id = id;
+
+	u64 key = 0;
+	if (program_binary) {
+		key = program_cache_key(stages);
+		if (load_program_binary(id, name, key)) {
+			return;
+		}
+
+		program_parameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	}
 
-	if (has_geometry) {
-		g = glCreateShader(GL_GEOMETRY_SHADER);
-		glShaderSource(g, 1, &gsp, null);
-		glCompileShader(g);
+	u32 ids[shader_stage_count] = { 0 };
+
+	for (u32 i = 0; i < shader_stage_count; i++) {
+		/* The geometry stage is optional; The others fail to compile
+		 * if they are missing. */
+		if (i == shader_geometry && !stages->sources[i]) { continue; }
+
+		const char* source = stages->sources[i] ? stages->sources[i] : "";
+
+		ids[i] = glCreateShader(stage_types[i]);
+		glShaderSource(ids[i], 1, &source, null);
+		glCompileShader(ids[i]);
 
-		glGetShaderiv(g, GL_COMPILE_STATUS, &success);
+		i32 success;
+		glGetShaderiv(ids[i], GL_COMPILE_STATUS, &success);
 		if (!success) {
 			char info_log[1024];
-			glGetShaderInfoLog(g, 1024, null, info_log);
-			fprintf(stderr, "Geometry shader of `%s' failed to compile with the following errors:\n%s", name,
-				info_log);
+			glGetShaderInfoLog(ids[i], 1024, null, info_log);
+			fprintf(stderr, "%s shader of `%s' failed to compile with the following errors:\n%s",
+				stage_names[i], name, info_log);
 			shader->panic = true;
 		}
-	}
 
-	u32 id;
-	id = glCreateProgram();
-	glAttachShader(id, v);
-	glAttachShader(id, f);
-	if (has_geometry) {
-		glAttachShader(id, g);
+		glAttachShader(id, ids[i]);
 	}
+
 	glLinkProgram(id);
 
+	i32 success;
 	glGetProgramiv(id, GL_LINK_STATUS, &success);
 	if (!success) {
 		shader->panic = true;
 	}
 
-	glDeleteShader(v);
-	glDeleteShader(f);
+	for (u32 i = 0; i < shader_stage_count; i++) {
+		if (ids[i]) {
+			glDeleteShader(ids[i]);
+		}
+	}
 
-	if (has_geometry) {
-		glDeleteShader(g);
+	if (program_binary && !shader->panic) {
+		save_program_binary(id, name, key);
 	}
+}
+
+void init_shader(struct shader* shader, const char* source, const char* name) {
+	struct shader_stages stages;
+	split_shader(&stages, copy_string(source));
 
-	core_free(vertex_source);
-	core_free(fragment_source);
-	core_free(geometry_source);
+	init_shader_from_stages(shader, &stages, name);
 
-	shader->id = id;
+	deinit_shader_stages(&stages);
 }
 
 void deinit_shader(struct shader* shader) {
@@ -288,7 +483,10 @@ void init_vb(struct vertex_buffer* vb, const i32 flags) {
 void deinit_vb(struct vertex_buffer* vb) {
 	glDeleteVertexArrays(1, &vb->va_id);
 	glDeleteBuffers(1, &vb->vb_id);
-	glDeleteBuffers(1, &vb->ib_id);
+
+	if (!(vb->flags & vb_shared_indices)) {
+		glDeleteBuffers(1, &vb->ib_id);
+	}
 }
 
 void bind_vb_for_draw(const struct vertex_buffer* vb) {
@@ -341,6 +539,60 @@ void configure_vb(const struct vertex_buffer* vb, u32 index, u32 component_count
 	glEnableVertexAttribArray(index);
 }
 
+void configure_vb_attrib(const struct vertex_buffer* vb, u32 index, u32 component_count,
+	u32 type, u32 stride, u32 offset) {
+
+	void* ptr = (void*)(u64)offset;
+
+	switch (type) {
+		case vb_attrib_f32:
+			glVertexAttribPointer(index, component_count, GL_FLOAT, GL_FALSE, stride, ptr);
+			break;
+		case vb_attrib_u8_norm:
+			glVertexAttribPointer(index, component_count, GL_UNSIGNED_BYTE, GL_TRUE, stride, ptr);
+			break;
+		case vb_attrib_u16_norm:
+			glVertexAttribPointer(index, component_count, GL_UNSIGNED_SHORT, GL_TRUE, stride, ptr);
+			break;
+		case vb_attrib_u32:
+			glVertexAttribIPointer(index, component_count, GL_UNSIGNED_INT, stride, ptr);
+			break;
+		default:
+			fprintf(stderr, "Unknown vertex attribute type: %u\n", type);
+			return;
+	}
+
+	glEnableVertexAttribArray(index);
+}
+
+void init_ib(struct index_buffer* ib, u32* indices, u32 count) {
+	ib->count = count;
+
+	glGenBuffers(1, &ib->id);
+
+	/* The element array binding belongs to whichever vertex array is
+	 * bound, so the buffer is filled through another target. */
+	glBindBuffer(GL_COPY_WRITE_BUFFER, ib->id);
+	glBufferData(GL_COPY_WRITE_BUFFER, count * sizeof(u32), indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void deinit_ib(struct index_buffer* ib) {
+	glDeleteBuffers(1, &ib->id);
+}
+
+void use_shared_ib(struct vertex_buffer* vb, const struct index_buffer* ib) {
+	if (!(vb->flags & vb_shared_indices)) {
+		glDeleteBuffers(1, &vb->ib_id);
+	}
+
+	vb->flags |= vb_shared_indices;
+	vb->ib_id = ib->id;
+	vb->index_count = ib->count;
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ib->id);
+}
+
 void draw_vb(const struct vertex_buffer* vb) {
 	u32 draw_type = GL_TRIANGLES;
 	if (vb->flags & vb_lines) {
@@ -363,53 +615,118 @@ void draw_vb_n(const struct vertex_buffer* vb, u32 count) {
 	glDrawElements(draw_type, count, GL_UNSIGNED_INT, 0);
 }
 
-void init_texture(struct texture* texture, u8* data, u64 size, u32 flags) {
-	assert(size > sizeof(struct bmp_header));
+void draw_vb_n_base(const struct vertex_buffer* vb, u32 count, u32 base_vertex) {
+	u32 draw_type = GL_TRIANGLES;
+	if (vb->flags & vb_lines) {
+		draw_type = GL_LINES;
+	} else if (vb->flags & vb_line_strip) {
+		draw_type = GL_LINE_STRIP;
+	}
 
-	if (*data != 'B' && *(data + 1) != 'M') {
-		fprintf(stderr, "Not a valid bitmap!\n");
-		return;
+	glDrawElementsBaseVertex(draw_type, count, GL_UNSIGNED_INT, 0, (GLint)base_vertex);
+}
+
+void init_stream_vb(struct stream_vb* svb, i32 flags, u32 region_size) {
+	memset(svb, 0, sizeof(struct stream_vb));
+
+	svb->region_size = region_size;
+
+	init_vb(&svb->vb, flags);
+	bind_vb_for_edit(&svb->vb);
+
+	if (buffer_storage) {
+		const GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		const GLsizeiptr size = (GLsizeiptr)region_size * stream_vb_regions;
+
+		buffer_storage(GL_ARRAY_BUFFER, size, null, access);
+		svb->mapping = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, access);
+
+		/* The store is immutable now, so orphaning needs a fresh
+		 * buffer if it couldn't be mapped. */
+		if (!svb->mapping) {
+			bind_vb_for_edit(null);
+			deinit_vb(&svb->vb);
+			init_vb(&svb->vb, flags);
+			bind_vb_for_edit(&svb->vb);
+		}
 	}
 
-	struct bmp_header* header = (struct bmp_header*)data;
-	u8* src = data + header->bmp_offset;
+	if (!svb->mapping) {
+		glBufferData(GL_ARRAY_BUFFER, region_size, null, GL_STREAM_DRAW);
+		svb->staging = core_alloc(region_size);
+	}
 
-	u32 mode = texture_rgba;
-	if (header->bits_per_pixel == 24) {
-		mode = texture_rgb;
-	} else if (header->bits_per_pixel == 8) {
-		mode = texture_mono;
+	bind_vb_for_edit(null);
+}
+
+void deinit_stream_vb(struct stream_vb* svb) {
+	if (svb->mapping) {
+		bind_vb_for_edit(&svb->vb);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		bind_vb_for_edit(null);
 	}
 
-	init_texture_no_bmp(texture, src, header->w, header->h, flags | mode | texture_flip);
+	for (u32 i = 0; i < stream_vb_regions; i++) {
+		if (svb->fences[i]) {
+			glDeleteSync(svb->fences[i]);
+		}
+	}
+
+	deinit_vb(&svb->vb);
+
+	if (svb->staging) {
+		core_free(svb->staging);
+	}
 }
 
-void init_texture_no_bmp(struct texture* texture, u8* src, u32 w, u32 h, u32 flags) {
-	glGenTextures(1, &texture->id);
-	glBindTexture(GL_TEXTURE_2D, texture->id);
+void* stream_vb_begin(struct stream_vb* svb, u32 min_size, u32* capacity) {
+	if (!svb->mapping) {
+		*capacity = svb->region_size;
+		return svb->staging;
+	}
 
-	GLenum wrap_mode = GL_REPEAT;
-	if (flags & texture_clamp) {
-		wrap_mode = GL_CLAMP_TO_EDGE;
+	if (svb->region_size - svb->cursor < min_size) {
+		/* Everything that was drawn from this region has been drawn
+		 * by now, so this fence goes after all of it. */
+		svb->fences[svb->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+		svb->region = (svb->region + 1) % stream_vb_regions;
+		svb->cursor = 0;
+
+		GLsync fence = svb->fences[svb->region];
+		if (fence) {
+			while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+
+			glDeleteSync(fence);
+			svb->fences[svb->region] = null;
+		}
 	}
 
-	GLenum filter_mode = GL_LINEAR;
-	if (flags & texture_filter_nearest) {
-		filter_mode = GL_NEAREST;
+	*capacity = svb->region_size - svb->cursor;
+	return svb->mapping + (u64)svb->region * svb->region_size + svb->cursor;
+}
+
+u32 stream_vb_commit(struct stream_vb* svb, u32 size) {
+	if (!svb->mapping) {
+		glBufferData(GL_ARRAY_BUFFER, svb->region_size, null, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, size, svb->staging);
+
+		return 0;
 	}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap_mode);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap_mode);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter_mode);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter_mode);
+	/* The mapping is coherent, so there is nothing to flush. */
+	u32 offset = svb->region * svb->region_size + svb->cursor;
+	svb->cursor += size;
 
-	GLenum format = GL_RGB;
+	return offset;
+}
+
+/* Flip the rows of a bitmap if required, and swap BGR to RGB. */
+static u8* convert_pixels(const u8* src, u32 w, u32 h, u32 flags) {
 	u32 wf = 3;
 	if (flags & texture_rgba) {
-		format = GL_RGBA;
 		wf = 4;
 	} else if (flags & texture_mono) {
-		format = GL_RED;
 		wf = 1;
 	}
 
@@ -446,12 +763,120 @@ void init_texture_no_bmp(struct texture* texture, u8* src, u32 w, u32 h, u32 fla
 		}
 	}
 
+	return dst;
+}
+
+static void upload_texture(struct texture* texture, const u8* pixels, u32 w, u32 h, u32 flags) {
+	glGenTextures(1, &texture->id);
+	glBindTexture(GL_TEXTURE_2D, texture->id);
+
+	GLenum wrap_mode = GL_REPEAT;
+	if (flags & texture_clamp) {
+		wrap_mode = GL_CLAMP_TO_EDGE;
+	}
+
+	GLenum filter_mode = GL_LINEAR;
+	if (flags & texture_filter_nearest) {
+		filter_mode = GL_NEAREST;
+	}
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap_mode);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap_mode);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter_mode);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter_mode);
+
+	GLenum format = GL_RGB;
+	if (flags & texture_rgba) {
+		format = GL_RGBA;
+	} else if (flags & texture_mono) {
+		format = GL_RED;
+	}
+
 	glTexImage2D(GL_TEXTURE_2D, 0, format,
 			w, h, 0, format,
-			GL_UNSIGNED_BYTE, dst);
+			GL_UNSIGNED_BYTE, pixels);
 
 	texture->width = w;
 	texture->height = h;
+	texture->x = 0;
+	texture->y = 0;
+	texture->atlas_width = w;
+	texture->atlas_height = h;
+}
+
+bool decode_bitmap(struct image* image, const u8* data, u64 size, u32 flags) {
+	*image = (struct image) { 0 };
+
+	if (size <= sizeof(struct bmp_header) || (data[0] != 'B' && data[1] != 'M')) {
+		fprintf(stderr, "Not a valid bitmap!\n");
+		return false;
+	}
+
+	const struct bmp_header* header = (const struct bmp_header*)data;
+	const u8* src = data + header->bmp_offset;
+
+	u32 mode = texture_rgba;
+	if (header->bits_per_pixel == 24) {
+		mode = texture_rgb;
+	} else if (header->bits_per_pixel == 8) {
+		mode = texture_mono;
+	}
+
+	image->pixels = convert_pixels(src, header->w, header->h, flags | mode | texture_flip);
+	image->width = header->w;
+	image->height = header->h;
+	image->flags = (flags | mode) & ~texture_flip;
+
+	return true;
+}
+
+bool decode_cooked_texture(struct image* image, const u8* data, u64 size, u32 flags) {
+	if (size < sizeof(struct pack_texture) ||
+		memcmp(data, pack_texture_magic, sizeof(((const struct pack_texture*)data)->magic)) != 0) {
+		return false;
+	}
+
+	struct pack_texture header;
+	memcpy(&header, data, sizeof(header));
+
+	u64 pixels_size = (u64)header.width * header.height * 4;
+	if (size < sizeof(header) + pixels_size) {
+		fprintf(stderr, "Cooked texture is truncated.\n");
+		return false;
+	}
+
+	image->pixels = (u8*)data + sizeof(header);
+	image->width = header.width;
+	image->height = header.height;
+	image->flags = (flags | texture_rgba) & ~(texture_rgb | texture_mono | texture_flip);
+
+	return true;
+}
+
+void deinit_image(struct image* image) {
+	core_free(image->pixels);
+	image->pixels = null;
+}
+
+void init_texture(struct texture* texture, u8* data, u64 size, u32 flags) {
+	struct image image;
+	if (!decode_bitmap(&image, data, size, flags)) {
+		return;
+	}
+
+	init_texture_from_image(texture, &image);
+
+	deinit_image(&image);
+}
+
+void init_texture_from_image(struct texture* texture, const struct image* image) {
+	upload_texture(texture, image->pixels, image->width, image->height, image->flags);
+}
+
+void init_texture_no_bmp(struct texture* texture, u8* src, u32 w, u32 h, u32 flags) {
+	u8* dst = convert_pixels(src, w, h, flags);
+
+	upload_texture(texture, dst, w, h, flags);
 
 	core_free(dst);
 }
@@ -521,6 +946,8 @@ void update_texture_no_bmp(struct texture* texture, u8* src, u32 w, u32 h, u32 f
 
 	texture->width = w;
 	texture->height = h;
+	texture->atlas_width = w;
+	texture->atlas_height = h;
 
 	if (texture->width == w && texture->height == h) {
 		glTexImage2D(GL_TEXTURE_2D, 0, format,
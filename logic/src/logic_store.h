@@ -6,7 +6,9 @@
 #include "lsp.h"
 #include "menu.h"
 #include "room.h"
+#include "sprites.h"
 #include "imui.h"
+#include "jobs.h"
 #include "video.h"
 
 struct logic_store {
@@ -25,9 +27,19 @@ struct logic_store {
 
 	struct font* debug_font;
 
+	/* The references to the sprite textures. They are kept here rather
+	 * than in `sprites.c', so that they can be given back once the
+	 * sprites are reloaded along with the code. */
+	struct res* sprite_textures[texid_count];
+
 	struct world* world;
 	struct room* room;
 
+	/* For loading rooms in the background. */
+	struct job_pool* job_pool;
+
+	struct room_cache room_cache;
+
 	struct menu* pause_menu;
 	bool paused;
 	bool frozen;
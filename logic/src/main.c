@@ -33,10 +33,19 @@ EXPORT_SYM void C_DECL on_reload(void* instance) {
 	 * are reset every reload, and so will become invalid.
 	 *
 	 * The sprite files are not reloaded, only looked up again
-	 * in the resource manager cache, so this is fairly quick. */
+	 * in the resource manager cache, so this is fairly quick. The
+	 * references from the last reload are given back. */
 	preload_sprites();
 }
 
+/* Rooms are read on the job pool by a function in this assembly, so
+ * every read has to be finished before it is unloaded. */
+EXPORT_SYM void C_DECL on_pre_reload() {
+	if (logic_store->job_pool) {
+		job_drain(logic_store->job_pool);
+	}
+}
+
 EXPORT_SYM struct window* C_DECL create_window() {
 	return new_window(make_v2i(1366, 768), "OpenMV", true);
 }
@@ -96,6 +105,8 @@ void load_default_room() {
 		free_room(logic_store->room);
 	}
 
+	flush_room_cache();
+
 	logic_store->room = load_room(logic_store->world, "res/maps/a1/incinerator.dat");
 
 	v2i spawn = get_spawn(logic_store->room);
@@ -158,11 +169,16 @@ EXPORT_SYM void C_DECL on_init() {
 
 	savegame_init();
 
+	logic_store->job_pool = new_job_pool(1);
+
 	struct shader sprite_shader = load_shader("res/shaders/sprite.glsl");
-	logic_store->renderer = new_renderer(sprite_shader, make_v2i(1366, 768));
+	/* The world draws every tile and entity in view, so it gets the
+	 * biggest batches; The HUD and the menus only draw a few icons and
+	 * some text. */
+	logic_store->renderer = new_renderer(sprite_shader, make_v2i(1366, 768), renderer_max_batch_size);
 	logic_store->renderer->camera_enable = true;
-	logic_store->hud_renderer = new_renderer(sprite_shader, make_v2i(1366, 768));
-	logic_store->ui_renderer = new_renderer(sprite_shader, make_v2i(1366, 768));
+	logic_store->hud_renderer = new_renderer(sprite_shader, make_v2i(1366, 768), 1024);
+	logic_store->ui_renderer = new_renderer(sprite_shader, make_v2i(1366, 768), 2048);
 
 	logic_store->explosion_sound = load_audio_clip("res/aud/explosion.wav");
 
@@ -455,6 +471,9 @@ EXPORT_SYM void C_DECL on_deinit() {
 	free_menu(logic_store->pause_menu);
 
 	free_room(logic_store->room);
+	flush_room_cache();
+
+	free_job_pool(logic_store->job_pool);
 
 	free_post_processor(logic_store->crt);
 	free_renderer(logic_store->renderer);
@@ -467,6 +486,8 @@ EXPORT_SYM void C_DECL on_deinit() {
 
 	free_world(logic_store->world);
 
+	release_sprites();
+
 	savegame_deinit();
 
 	keymap_deinit();
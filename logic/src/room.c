@@ -10,18 +10,38 @@
 #include "dialogue.h"
 #include "dynlib.h"
 #include "enemy.h"
+#include "jobs.h"
 #include "keymap.h"
 #include "logic_store.h"
 #include "physics.h"
+#include "platform.h"
 #include "player.h"
 #include "res.h"
 #include "room.h"
+#include "roomcook.h"
 #include "savegame.h"
 #include "shop.h"
 #include "sprites.h"
 #include "table.h"
 #include "tiled.h"
 
+/* How close a body has to get to a transition trigger or a door
+ * before the room that it leads to starts loading in the background,
+ * and how far away it has to get again before the load is given up
+ * on. No more than room_prefetch_max rooms are loaded ahead of time at
+ * once, and no more are started once those that have been built take
+ * up room_prefetch_memory bytes. */
+#define prefetch_distance (128 * sprite_scale)
+#define prefetch_cancel_distance (256 * sprite_scale)
+#define room_prefetch_max 2
+#define room_prefetch_memory (32 * 1024 * 1024)
+
+/* The size of the cells of the grids over the rectangles of a room. */
+#define collision_cell_size (64 * sprite_scale)
+
+/* The size of the tiles of the solid map of a room. */
+#define collision_tile_size (16 * sprite_scale)
+
 struct transition_trigger {
 	struct rect rect;
 	char* change_to;
@@ -34,9 +54,30 @@ struct door {
 	char* entrance;
 };
 
+/* Tile layers are baked into a mesh for every tile_chunk_size by
+ * tile_chunk_size square of tiles when the room is loaded, so that
+ * drawing a layer costs a draw for every chunk on screen, rather than
+ * a quad for every tile. Animated tiles change as they are drawn, so
+ * they are left out of the meshes and pushed every frame instead. */
+#define tile_chunk_size 32
+
+/* Animated tiles are pushed this many at a time. */
+#define animated_tile_batch_size 64
+
+struct tile_chunk {
+	struct quad_mesh mesh;
+
+	/* Indices into the tiles of the layer. */
+	u32* animated;
+	u32 animated_count;
+};
+
 struct tile_layer {
 	struct tile* tiles;
 	u32 w, h;
+
+	struct tile_chunk* chunks;
+	u32 chunks_w, chunks_h;
 };
 
 struct room {
@@ -50,20 +91,41 @@ struct room {
 	struct tileset* tilesets;
 	u32 tileset_count;
 
-	struct rect* box_colliders;
+	/* The clock that the tile animations are played from. */
+	f64 tile_time;
+
+	/* The cooked room; See `roomcook.h'. The colliders point straight
+	 * into it. */
+	struct file blob_file;
+	struct room_blob blob;
+
+	const struct rect* box_colliders;
 	u32 box_collider_count;
 
-	struct rect* killzones;
+	const struct rect* killzones;
 	u32 killzone_count;
 
-	struct rect* shops;
+	const struct rect* shops;
 	u32 shop_count;
 
-	v4i* slope_colliders;
+	const struct room_slope* slope_colliders;
 	u32 slope_collider_count;
 
-	struct table* entrances;
-	struct table* paths;
+	/* In the same order as the paths of the blob. */
+	struct path* paths;
+
+	/* Grids over the rectangles above and below, so that bodies are
+	 * only tested against the ones near them; See `physics.h'. Slopes
+	 * are gridded by the area around them that can collide. The box
+	 * colliders also have a bitmap of the tiles that they cover, for
+	 * testing whether there is anything solid with a few bit tests. */
+	struct solid_map solids;
+	struct rect_grid killzone_grid;
+	struct rect_grid shop_grid;
+	struct rect_grid slope_grid;
+	struct rect_grid transition_trigger_grid;
+	struct rect_grid door_grid;
+	struct rect_grid dialogue_grid;
 
 	struct rect camera_bounds;
 
@@ -78,6 +140,10 @@ struct room {
 
 	struct font* name_font;
 
+	/* How far bake_room has got. */
+	u32 baked_layers;
+	u32 baked_chunks;
+
 	u32 forground_index;
 
 	char* path;
@@ -100,55 +166,373 @@ struct room {
 	struct rect collider;
 
 	struct room** ptr;
+
+	/* The room that is being transitioned to. */
+	struct room_load* next;
+
+	/* The rooms that the nearest exits lead to, nearest first. */
+	struct room_load* prefetches[room_prefetch_max];
+	u32 prefetch_count;
+
+	/* While the room is in the cache, its entities are kept here. */
+	struct world* parked;
+	u64 cached_size;
+};
+
+/* Rooms that are transitioned to are loaded in the background while
+ * the screen fades out. The map and the cooked room are read on a
+ * worker, and the resources of the map are prefetched. Once both are
+ * ready, the room is built on the main thread, and its tile chunks
+ * are baked a few at a time. The room is only swapped in, and its
+ * entities spawned, once the fade has finished and the room is
+ * completely ready; Until then, the screen stays black. */
+#define room_bake_budget 0.002
+
+struct room_files {
+	struct file map;
+	struct file blob;
 };
 
-static char* read_name(struct file* file) {
-	u32 name_len;
-	file_read(&name_len, sizeof(name_len), 1, file);
-	char* name = core_alloc(name_len + 1);
-	name[name_len] = '\0';
-	file_read(name, 1, name_len, file);
+struct room_load {
+	struct job job;
+
+	char* path;
+
+	struct res_manifest* manifest;
 
-	return name;
+	/* Filled in by the job. */
+	struct room_files files;
+	bool read;
+
+	struct room* room;
+	bool baked;
+
+	/* The room came from the cache, and has already been built. */
+	bool cached;
+};
+
+static struct textured_quad make_tile_quad(u32 x, u32 y, i16 id, struct tileset* set) {
+	return (struct textured_quad) {
+		.texture = set->image,
+		.position = { x * set->tile_w * sprite_scale, y * set->tile_h * sprite_scale },
+		.dimentions = { set->tile_w * sprite_scale, set->tile_h * sprite_scale },
+		.rect = {
+			.x = ((id % (set->image->width  / set->tile_w)) * set->tile_w),
+			.y = ((id / (set->image->width / set->tile_h)) * set->tile_h),
+			.w = set->tile_w,
+			.h = set->tile_h
+		},
+		.color = { 255, 255, 255, 255 }
+	};
 }
 
-void skip_name(struct file* file) {
-	u32 obj_name_len;
+static void init_tile_layer(struct tile_layer* layer) {
+	layer->chunks_w = (layer->w + tile_chunk_size - 1) / tile_chunk_size;
+	layer->chunks_h = (layer->h + tile_chunk_size - 1) / tile_chunk_size;
+	layer->chunks = core_calloc(layer->chunks_w * layer->chunks_h, sizeof(struct tile_chunk));
+}
 
-	file_read(&obj_name_len, sizeof(obj_name_len), 1, file);
-	file_seek(file, file->cursor + obj_name_len);
+/* `quads' must have room for a chunk's worth of tiles. */
+static void bake_tile_chunk(struct room* room, struct tile_layer* layer, u32 cx, u32 cy, struct textured_quad* quads) {
+	struct tile_chunk* chunk = layer->chunks + cx + cy * layer->chunks_w;
+
+	u32 end_x = (cx + 1) * tile_chunk_size;
+	u32 end_y = (cy + 1) * tile_chunk_size;
+	end_x = end_x > layer->w ? layer->w : end_x;
+	end_y = end_y > layer->h ? layer->h : end_y;
+
+	u32 quad_count = 0;
+
+	u32 animated[tile_chunk_size * tile_chunk_size];
+	u32 animated_count = 0;
+
+	for (u32 y = cy * tile_chunk_size; y < end_y; y++) {
+		for (u32 x = cx * tile_chunk_size; x < end_x; x++) {
+			u32 idx = x + y * layer->w;
+
+			struct tile tile = layer->tiles[idx];
+			if (tile.id == -1) { continue; }
+
+			struct tileset* set = room->tilesets + tile.tileset_id;
+
+			if (set->animations[tile.id].exists) {
+				animated[animated_count++] = idx;
+			} else {
+				quads[quad_count++] = make_tile_quad(x, y, tile.id, set);
+			}
+		}
+	}
+
+	init_quad_mesh(&chunk->mesh, quads, quad_count);
+
+	if (animated_count > 0) {
+		chunk->animated = core_alloc(animated_count * sizeof(u32));
+		chunk->animated_count = animated_count;
+		memcpy(chunk->animated, animated, animated_count * sizeof(u32));
+	}
 }
 
-#define read_rects(d_, d_c_) \
-	do { \
-		d_ = core_alloc(sizeof(*(d_)) * object_count); \
-		d_c_ = 0; \
-		for (u32 ii = 0; ii < object_count; ii++) { \
-			struct object* object = layer->as.object_layer.objects + ii; \
-			\
-			if (object->shape == object_shape_rect) { \
-				(d_)[(d_c_)].x = (i32)object->as.rect.x * sprite_scale; \
-				(d_)[(d_c_)].y = (i32)object->as.rect.y * sprite_scale; \
-				(d_)[(d_c_)].w = (i32)object->as.rect.w * sprite_scale; \
-				(d_)[(d_c_)].h = (i32)object->as.rect.h * sprite_scale; \
-				\
-				(d_c_)++; \
-			} \
-		} \
-	} while (0)
+/* Bakes the meshes of the tile chunks until `budget' seconds have been
+ * spent, so that a room that is loaded in the background can spread
+ * the uploads over several frames. At least one chunk is baked per
+ * call. Returns true once every chunk has been baked. */
+static bool bake_room(struct room* room, f64 budget) {
+	u64 start = get_time();
+	u64 limit = (u64)(budget * (f64)get_frequency());
 
-struct room* load_room(struct world* world, const char* path) {
+	struct textured_quad* quads = core_alloc(tile_chunk_size * tile_chunk_size * sizeof(struct textured_quad));
+
+	while (room->baked_layers < room->layer_count) {
+		struct tile_layer* layer = room->layers + room->baked_layers;
+
+		if (room->baked_chunks >= layer->chunks_w * layer->chunks_h) {
+			room->baked_layers++;
+			room->baked_chunks = 0;
+			continue;
+		}
+
+		bake_tile_chunk(room, layer,
+			room->baked_chunks % layer->chunks_w, room->baked_chunks / layer->chunks_w, quads);
+		room->baked_chunks++;
+
+		if (get_time() - start >= limit) { break; }
+	}
+
+	core_free(quads);
+
+	return room->baked_layers >= room->layer_count;
+}
+
+static void free_tile_layer(struct tile_layer* layer) {
+	for (u32 i = 0; i < layer->chunks_w * layer->chunks_h; i++) {
+		deinit_quad_mesh(&layer->chunks[i].mesh);
+
+		if (layer->chunks[i].animated) {
+			core_free(layer->chunks[i].animated);
+		}
+	}
+
+	core_free(layer->chunks);
+}
+
+static void init_room_grids(struct room* room) {
+	init_solid_map(&room->solids, room->box_colliders, room->box_collider_count, collision_tile_size);
+	init_rect_grid(&room->killzone_grid, room->killzones, room->killzone_count, collision_cell_size);
+	init_rect_grid(&room->shop_grid, room->shops, room->shop_count, collision_cell_size);
+
+	u32 max_count = room->slope_collider_count;
+	max_count = room->transition_trigger_count > max_count ? room->transition_trigger_count : max_count;
+	max_count = room->door_count > max_count ? room->door_count : max_count;
+	max_count = room->dialogue_count > max_count ? room->dialogue_count : max_count;
+
+	struct rect* rects = core_alloc((max_count > 0 ? max_count : 1) * sizeof(struct rect));
+
+	for (u32 i = 0; i < room->slope_collider_count; i++) {
+		const struct room_slope* slope = room->slope_colliders + i;
+
+		if (slope->start.y == slope->end.y) {
+			rects[i] = make_rect(slope->start.x, slope->start.y, slope->end.x - slope->start.x + 1, 33);
+		} else {
+			/* point_vs_rtri rounds the areas that it compares, so it
+			 * can take points that are a few pixels out of the
+			 * triangle. */
+			const i32 pad = 4;
+
+			i32 x0 = slope->start.x < slope->end.x ? slope->start.x : slope->end.x;
+			i32 y0 = slope->start.y < slope->end.y ? slope->start.y : slope->end.y;
+			i32 x1 = slope->start.x > slope->end.x ? slope->start.x : slope->end.x;
+			i32 y1 = slope->start.y > slope->end.y ? slope->start.y : slope->end.y;
+
+			rects[i] = make_rect(x0 - pad, y0 - pad, x1 - x0 + 1 + pad * 2, y1 - y0 + 1 + pad * 2);
+		}
+	}
+
+	init_rect_grid(&room->slope_grid, rects, room->slope_collider_count, collision_cell_size);
+
+	for (u32 i = 0; i < room->transition_trigger_count; i++) {
+		rects[i] = room->transition_triggers[i].rect;
+	}
+
+	init_rect_grid(&room->transition_trigger_grid, rects, room->transition_trigger_count, collision_cell_size);
+
+	for (u32 i = 0; i < room->door_count; i++) {
+		rects[i] = room->doors[i].rect;
+	}
+
+	init_rect_grid(&room->door_grid, rects, room->door_count, collision_cell_size);
+
+	for (u32 i = 0; i < room->dialogue_count; i++) {
+		rects[i] = room->dialogue[i].rect;
+	}
+
+	init_rect_grid(&room->dialogue_grid, rects, room->dialogue_count, collision_cell_size);
+
+	core_free(rects);
+}
+
+static void deinit_room_grids(struct room* room) {
+	deinit_solid_map(&room->solids);
+	deinit_rect_grid(&room->killzone_grid);
+	deinit_rect_grid(&room->shop_grid);
+	deinit_rect_grid(&room->slope_grid);
+	deinit_rect_grid(&room->transition_trigger_grid);
+	deinit_rect_grid(&room->door_grid);
+	deinit_rect_grid(&room->dialogue_grid);
+}
+
+/* In debug, maps aren't cooked, so the room is cooked from its map. */
+static struct file load_room_blob(const char* path, const struct file* map_file) {
+#ifdef DEBUG
+	u64 size;
+	u8* data = cook_room(map_file->data, map_file->size, &size);
+
+	return (struct file) { .data = data, .size = size, .buffer = data };
+#else
+	char blob_path[256];
+	snprintf(blob_path, sizeof(blob_path), "%s" room_blob_ext, path);
+
+	return file_open(blob_path);
+#endif
+}
+
+/* Everything about loading a room that can be done on any thread. */
+static bool read_room_files(struct room_files* files, const char* path) {
+	files->map = file_open(path);
+	if (!file_good(&files->map)) {
+		fprintf(stderr, "Failed to open file `%s'.\n", path);
+		return false;
+	}
+
+	files->blob = load_room_blob(path, &files->map);
+	if (!file_good(&files->blob)) {
+		fprintf(stderr, "Failed to load the cooked room for `%s'.\n", path);
+		file_close(&files->map);
+		return false;
+	}
+
+	return true;
+}
+
+static void spawn_upgrade(struct world* world, struct room* room, const struct room_spawn* spawn) {
+	bool hp = spawn->prefab != room_prefab_jetpack;
+	bool booster = spawn->prefab == room_prefab_health_booster;
+	i32 upgrade_id = spawn->as.upgrade.id;
+
+	i32 sprite_id = sprid_upgrade_jetpack;
+	if (spawn->prefab == room_prefab_health_pack) {
+		sprite_id = sprid_upgrade_health_pack;
+	} else if (booster) {
+		sprite_id = sprid_upgrade_health_booster;
+	}
+
+	struct player* player = get_component(world, logic_store->player, struct player);
+	bool has_upgrade = (hp && player->hp_ups & upgrade_id) || (player->items & upgrade_id);
+
+	if (has_upgrade) { return; }
+
+	struct f32_rect r = spawn->rect;
+	struct sprite sprite = get_sprite(sprite_id);
+
+	entity pickup = new_entity(world);
+	add_componentv(world, pickup, struct room_child, .parent = room);
+	add_componentv(world, pickup, struct transform,
+		.position = { r.x, r.y },
+		.dimentions = { sprite.rect.w * sprite_scale, sprite.rect.h * sprite_scale });
+	add_component(world, pickup, struct sprite, sprite);
+
+	if (hp) {
+		add_componentv(world, pickup, struct health_upgrade, .id = upgrade_id,
+			.booster = booster);
+		add_componentv(world, pickup, struct collider,
+			.rect = { 0, 0, (i32)r.w, (i32)r.h });
+	} else {
+		add_componentv(world, pickup, struct collider, .rect = { 0, 0, (i32)r.x, (i32)r.y });
+		add_componentv(world, pickup, struct upgrade, .id = upgrade_id,
+			.prefix = copy_string(room_blob_string(&room->blob, spawn->as.upgrade.prefix)),
+			.name = copy_string(room_blob_string(&room->blob, spawn->as.upgrade.name)));
+	}
+}
+
+static void spawn_entity(struct world* world, struct room* room, const struct room_spawn* spawn) {
+	struct f32_rect r = spawn->rect;
+	v2f pos = make_v2f(r.x, r.y);
+
+	switch (spawn->prefab) {
+		case room_prefab_bat:
+			new_bat(world, room, pos, (char*)room_blob_string(&room->blob, spawn->as.enemy.path));
+			break;
+		case room_prefab_spider:
+			new_spider(world, room, pos);
+			break;
+		case room_prefab_drill:
+			new_drill(world, room, pos);
+			break;
+		case room_prefab_scav:
+			new_scav(world, room, pos);
+			break;
+		case room_prefab_save_point:
+			new_save_point(world, room, (struct rect) { r.x, r.y, r.w, r.h });
+			break;
+		case room_prefab_jetpack:
+		case room_prefab_health_pack:
+		case room_prefab_health_booster:
+			spawn_upgrade(world, room, spawn);
+			break;
+		case room_prefab_entity_spawner: {
+			f64 min = spawn->as.spawner.min_increment;
+			f64 max = spawn->as.spawner.max_increment;
+
+			entity e = new_entity(world);
+			add_componentv(world, e, struct transform, .position = { r.x, r.y });
+			add_componentv(world, e, struct entity_spawner, .spawn_type = spawn->as.spawner.type,
+				.next_spawn = random_f64(min, max), .max_increment = max, .min_increment = min);
+			add_componentv(world, e, struct room_child, .parent = room);
+		} break;
+		case room_prefab_lava: {
+			entity e = new_entity(world);
+			add_componentv(world, e, struct lava, .collider = { r.x, r.y, r.w, r.h });
+			add_componentv(world, e, struct room_child, .parent = room);
+		} break;
+		case room_prefab_light: {
+			f32 intensity = 1.0f;
+			f32 range = 1000.0f;
+
+			entity e = new_entity(world);
+			add_componentv(world, e, struct transform, .position = { r.x, r.y });
+			add_componentv(world, e, struct light, .intensity = intensity, .range = range);
+			add_componentv(world, e, struct room_child, .parent = room);
+		} break;
+		default: break;
+	}
+}
+
+/* Builds a room from its files, which it takes over, without baking
+ * its tile chunks or spawning its entities. */
+static struct room* build_room(struct world* world, const char* path, struct room_files* files) {
 	struct room* room = core_calloc(1, sizeof(struct room));
 	room->world = world;
 
-	room->map = load_map(path);
+	room->blob_file = files->blob;
+	if (!open_room_blob(&room->blob, room->blob_file.data, room->blob_file.size)) {
+		fprintf(stderr, "Failed to load the cooked room for `%s'.\n", path);
+		file_close(&room->blob_file);
+		file_close(&files->map);
+		core_free(room);
+		return null;
+	}
+
+	room->map = load_map_from_file(files->map, path);
 	struct tiled_map* map = room->map;
 
 	if (!room->map) {
+		file_close(&room->blob_file);
 		core_free(room);
 		return null;
 	}
 
+	const struct room_blob* blob = &room->blob;
+	const struct room_blob_header* header = blob->header;
+
 	room->transitioning_in = true;
 	room->transition_timer = 1.0;
 	room->transition_speed = 5.0;
@@ -156,21 +540,11 @@ struct room* load_room(struct world* world, const char* path) {
 	room->name_font = load_font("res/CourierPrime.ttf", 25.0f);
 	room->name_timer = 3.0;
 
-	struct property* name_prop = table_get(map->properties, "name");
-	if (name_prop && name_prop->type == prop_string) {
-		room->name = name_prop->as.string;
-	}
-
-	struct property* dark_prop = table_get(map->properties, "dark");
-	if (dark_prop && dark_prop->type == prop_bool) {
-		room->dark = dark_prop->as.boolean;
-	}
+	room->name = (char*)room_blob_string(blob, header->name);
+	room->dark = (header->flags & room_flag_dark) != 0;
 
 	room->path = copy_string(path);
 
-	room->entrances = new_table(sizeof(v2i));
-	room->paths = new_table(sizeof(struct path));
-
 	room->tilesets = map->tilesets;
 	room->tileset_count = map->tileset_count;
 
@@ -178,436 +552,487 @@ struct room* load_room(struct world* world, const char* path) {
 	for (u32 i = 0; i < map->layer_count; i++) {
 		struct layer* layer = map->layers + i;
 
-		switch (layer->type) {
-			case layer_tiles: {
-				u32 idx = room->layer_count++;
-				room->layers = core_realloc(room->layers, room->layer_count * sizeof(struct tile_layer));
-
-				room->layers[idx].tiles = layer->as.tile_layer.tiles;
-				room->layers[idx].w = layer->as.tile_layer.w;
-				room->layers[idx].h = layer->as.tile_layer.h;
+		if (layer->type == layer_tiles) {
+			u32 idx = room->layer_count++;
+			room->layers = core_realloc(room->layers, room->layer_count * sizeof(struct tile_layer));
 
-				if (strcmp(layer->name, "forground") == 0) {
-					room->forground_index = idx;
-				}
-			} break;
-			case layer_objects: {
-				u32 object_count = layer->as.object_layer.object_count;
-
-				if (strcmp(layer->name, "collisions") == 0) {
-					read_rects(room->box_colliders, room->box_collider_count);
-				} else if (strcmp(layer->name, "killzones") == 0) {
-					read_rects(room->killzones, room->killzone_count);
-				} else if (strcmp(layer->name, "slopes") == 0) {
-					room->slope_collider_count = 0;
-					room->slope_colliders = null;
-					for (u32 ii = 0; ii < object_count; ii++) {
-						struct object* object = layer->as.object_layer.objects + ii;
-
-						if (object->shape == object_shape_polygon) {
-							room->slope_colliders = core_realloc(room->slope_colliders,
-								sizeof(*room->slope_colliders) * (room->slope_collider_count + object->as.polygon.count));
-							for (u32 iii = 1; iii < object->as.polygon.count; iii += 1) {
-								v2f start = object->as.polygon.points[iii - 1];
-								v2f end   = object->as.polygon.points[iii];
-
-								room->slope_colliders[room->slope_collider_count++] = make_v4i(start.x, start.y, end.x, end.y);
-							}
-						}
-					}
+			room->layers[idx] = (struct tile_layer) {
+				.tiles = layer->as.tile_layer.tiles,
+				.w = layer->as.tile_layer.w,
+				.h = layer->as.tile_layer.h
+			};
 
-					for (u32 ii = 0; ii < room->slope_collider_count; ii++) {
-						/* Ensure that the start of the slope is alway smaller than the end on the `x' axis. */
-						v2i start = make_v2i(room->slope_colliders[ii].x * sprite_scale, room->slope_colliders[ii].y * sprite_scale);
-						v2i end = make_v2i(room->slope_colliders[ii].z * sprite_scale, room->slope_colliders[ii].w * sprite_scale);
-						if (start.y > end.y) {
-							i32 c = end.y;
-							end.y = start.y;
-							start.y = c;
-
-							c = end.x;
-							end.x = start.x;
-							start.x = c;
-						} else if (start.y == end.y && start.x > end.x) {
-							i32 c = end.y;
-							end.y = start.y;
-							start.y = c;
-
-							c = end.x;
-							end.x = start.x;
-							start.x = c;
-						}
-
-						room->slope_colliders[ii] = make_v4i(start.x, start.y, end.x, end.y);
-					}
-				} else if (strcmp(layer->name, "entrances") == 0) {
-					for (u32 ii = 0; ii < object_count; ii++) {
-						struct object* object = layer->as.object_layer.objects + ii;
-						
-						if (object->shape == object_shape_point) {
-							v2i point;
-							point.x = (i32)object->as.point.x * sprite_scale;
-							point.y = (i32)object->as.point.y * sprite_scale;
-
-							table_set(room->entrances, object->name, &point);
-						}
-					}
-				} else if (strcmp(layer->name, "enemy_paths") == 0) {
-					for (u32 ii = 0; ii < object_count; ii++) {
-						struct object* object = layer->as.object_layer.objects + ii;
-
-						if (object->shape == object_shape_polygon) {
-							struct path p = { 0 };
-							p.count = object->as.polygon.count;
-							p.points = core_calloc(p.count, sizeof(v2i));
-
-							for (u32 iii = 0; iii < p.count; iii++) {
-								p.points[iii].x = (i32)object->as.polygon.points[iii].x * sprite_scale;
-								p.points[iii].y = (i32)object->as.polygon.points[iii].y * sprite_scale;
-							}
-
-							table_set(room->paths, object->name, &p);
-						}
-					}
-				} else if (strcmp(layer->name, "enemies") == 0) {	
-					for (u32 ii = 0; ii < object_count; ii++) {
-						struct object* object = layer->as.object_layer.objects + ii;
-
-						if (object->shape == object_shape_point) {
-							char* path_name = null;
-							struct property* path_name_prop = table_get(object->properties, "path");
-							if (path_name_prop && path_name_prop->type == prop_string) {
-								path_name = path_name_prop->as.string;
-							}
-
-							v2f pos = v2f_mul(object->as.point, make_v2f(sprite_scale, sprite_scale));
-
-							if (strcmp(object->name, "bat") == 0) {
-								new_bat(world, room, pos, path_name);
-							} else if (strcmp(object->name, "spider") == 0) {
-								new_spider(world, room, pos);
-							} else if (strcmp(object->name, "drill") == 0) {
-								new_drill(world, room, pos);
-							} else if (strcmp(object->name, "scav") == 0) {
-								new_scav(world, room, pos);
-							}
-						}
-					}
-				} else if (strcmp(layer->name, "transition_triggers") == 0) {
-					room->transition_triggers = core_calloc(object_count, sizeof(struct transition_trigger));
-
-					for (u32 ii = 0; ii < object_count; ii++) {
-						struct object* object = layer->as.object_layer.objects + ii;
-
-						if (object->shape == object_shape_rect) {
-							struct rect r = {
-								(i32)object->as.rect.x * sprite_scale,
-								(i32)object->as.rect.y * sprite_scale,
-								(i32)object->as.rect.w * sprite_scale,
-								(i32)object->as.rect.h * sprite_scale
-							};
-
-							char* change_to = null;
-							char* entrance = null;
-
-							struct property* change_to_prop = table_get(object->properties, "change_to");
-							if (change_to_prop && change_to_prop->type == prop_string) {
-								change_to = change_to_prop->as.string;
-							}
-
-							struct property* entrance_prop = table_get(object->properties, "entrance");
-							if (entrance_prop && entrance_prop->type == prop_string) {
-								entrance = entrance_prop->as.string;
-							}
-
-							room->transition_triggers[room->transition_trigger_count++] = (struct transition_trigger) {
-								.rect = r,
-								.change_to = change_to,
-								.entrance = entrance
-							};
-						}
-					}
-				} else if (strcmp(layer->name, "doors") == 0) {
-					room->doors = core_calloc(object_count, sizeof(struct door));
-
-					for (u32 ii = 0; ii < object_count; ii++) {
-						struct object* object = layer->as.object_layer.objects + ii;
-
-						if (object->shape == object_shape_rect) {
-							struct rect r = {
-								(i32)object->as.rect.x * sprite_scale,
-								(i32)object->as.rect.y * sprite_scale,
-								(i32)object->as.rect.w * sprite_scale,
-								(i32)object->as.rect.h * sprite_scale
-							};
-
-							char* change_to = null;
-							char* entrance = null;
-
-							struct property* change_to_prop = table_get(object->properties, "change_to");
-							if (change_to_prop && change_to_prop->type == prop_string) {
-								change_to = change_to_prop->as.string;
-							}
-
-							struct property* entrance_prop = table_get(object->properties, "entrance");
-							if (entrance_prop && entrance_prop->type == prop_string) {
-								entrance = entrance_prop->as.string;
-							}
-
-							room->doors[room->door_count++] = (struct door) {
-								.rect = r,
-								.change_to = change_to,
-								.entrance = entrance
-							};
-						}
-					}
-				} else if (strcmp(layer->name, "save_points") == 0) {
-					for (u32 ii = 0; ii < object_count; ii++) {
-						struct object* object = layer->as.object_layer.objects + ii;
-
-						if (object->shape == object_shape_rect) {
-							new_save_point(world, room, (struct rect) {
-								object->as.rect.x * sprite_scale, object->as.rect.y * sprite_scale,
-								object->as.rect.w * sprite_scale, object->as.rect.h * sprite_scale });
-						}
-					}
-				} else if (strcmp(layer->name, "meta") == 0) {
-					for (u32 ii = 0; ii < object_count; ii++) {
-						struct object* object = layer->as.object_layer.objects + ii;
-
-						if (strcmp(object->name, "camera_bounds") == 0 && object->shape == object_shape_rect) {
-							room->camera_bounds = (struct rect) {
-								object->as.rect.x * sprite_scale, object->as.rect.y * sprite_scale,
-								object->as.rect.w * sprite_scale, object->as.rect.h * sprite_scale
-							};
-						}
-					}
-				} else if (strcmp(layer->name, "upgrade_pickups") == 0) {
-					for (u32 ii = 0; ii < object_count; ii++) {
-						struct object* object = layer->as.object_layer.objects + ii;
-
-						if (object->shape != object_shape_rect) {
-							continue;
-						}
-
-						char* obj_name = object->name;
-
-						struct rect r = {
-							object->as.rect.x,
-							object->as.rect.y,
-							object->as.rect.w,
-							object->as.rect.h,
-						};
-
-						char* item_prefix = null;
-						char* item_name = null;
-
-						struct property* item_prefix_prop = table_get(object->properties, "prefix");
-						if (item_prefix_prop && item_prefix_prop->type == prop_string) {
-							item_prefix = item_prefix_prop->as.string;
-						}
-
-						struct property* item_name_prop = table_get(object->properties, "name");
-						if (item_name_prop && item_name_prop->type == prop_string) {
-							item_name = item_name_prop->as.string;
-						}
-
-						bool hp = false;
-						bool booster = false;
-						i32 sprite_id = -1;
-						i32 upgrade_id = -1;
-
-						if (strcmp(obj_name, "jetpack") == 0) {
-							sprite_id = sprid_upgrade_jetpack;
-							upgrade_id = upgrade_jetpack;
-						} else if (strcmp(obj_name, "health_pack") == 0) {
-							sprite_id = sprid_upgrade_health_pack;
-							hp = true;
-						} else if (strcmp(obj_name, "health_booster") == 0) {
-							sprite_id = sprid_upgrade_health_booster;
-							hp = true;
-							booster = true;
-						}
-
-						if (hp) {
-							struct property* id_prop = table_get(object->properties, "id");
-							if (id_prop && id_prop->type == prop_number) {
-								upgrade_id = (i32)id_prop->as.number;
-							}
-						}
-
-						struct player* player = get_component(world, logic_store->player, struct player);
-						bool has_upgrade = (hp && player->hp_ups & upgrade_id) || (player->items & upgrade_id);
-
-						if (!has_upgrade) {
-							if (hp && sprite_id != -1) {
-								struct sprite sprite = get_sprite(sprite_id);
-
-								entity pickup = new_entity(world);
-								add_componentv(world, pickup, struct room_child, .parent = room);
-								add_componentv(world, pickup, struct transform,
-									.position = { r.x * sprite_scale, r.y * sprite_scale },
-									.dimentions = { sprite.rect.w * sprite_scale, sprite.rect.h * sprite_scale });
-								add_component(world, pickup, struct sprite, sprite);
-								add_componentv(world, pickup, struct health_upgrade, .id = upgrade_id,
-									.booster = booster);
-								add_componentv(world, pickup, struct collider,
-									.rect = { 0, 0, r.w * sprite_scale, r.h * sprite_scale });
-							} else if (sprite_id != -1 && upgrade_id != -1) { 
-								struct sprite sprite = get_sprite(sprite_id);
-
-								entity pickup = new_entity(world);
-								add_componentv(world, pickup, struct room_child, .parent = room);
-								add_componentv(world, pickup, struct transform,
-									.position = { r.x * sprite_scale, r.y * sprite_scale },
-									.dimentions = { sprite.rect.w * sprite_scale, sprite.rect.h * sprite_scale });
-								add_component(world, pickup, struct sprite, sprite);
-								add_componentv(world, pickup, struct collider, .rect = { 0, 0, r.x * sprite_scale, r.y * sprite_scale });
-								add_componentv(world, pickup, struct upgrade, .id = upgrade_id,
-									.prefix = copy_string(item_prefix), .name = copy_string(item_name));
-							}
-						}
-					}
-				} else if (strcmp(layer->name, "dialogue_triggers") == 0) {
-					room->dialogue = core_alloc(object_count * sizeof(struct dialogue));
-
-					for (u32 ii = 0; ii < object_count; ii++) {
-						struct object* object = layer->as.object_layer.objects + ii;
-
-						if (object->shape == object_shape_rect) {
-							char* on_play_name = null;
-							char* on_next_name = null;
-
-							struct property* on_play_prop = table_get(object->properties, "on_play");
-							if (on_play_prop && on_play_prop->type == prop_string) {
-								on_play_name = on_play_prop->as.string;
-							}
-						
-							struct property* on_next_prop = table_get(object->properties, "on_next");
-							if (on_next_prop && on_next_prop->type == prop_string) {
-								on_next_name = on_next_prop->as.string;
-							}
-
-							struct f32_rect r = object->as.rect;
-
-							room->dialogue[room->dialogue_count++] = (struct dialogue) {
-								.rect = { r.x * sprite_scale, r.y * sprite_scale, r.w * sprite_scale, r.h * sprite_scale },
-								.on_play = on_play_name ? get_dialogue_fun(on_play_name) : null,
-								.on_next = on_next_name ? get_dialogue_fun(on_next_name) : null,
-							};
-						}
-					}
-				} else if (strcmp(layer->name, "entity_spawners") == 0) {
-					for (u32 ii = 0; ii < object_count; ii++) {
-						struct object* object = layer->as.object_layer.objects + ii;
-
-						if (object->shape == object_shape_point) {
-							f64 min = 0.0;
-							f64 max = 0.0;
-
-							struct property* min_prop = table_get(object->properties, "min_increment");
-							if (min_prop && min_prop->type == prop_number) {
-								min = min_prop->as.number;
-							}
-
-							struct property* max_prop = table_get(object->properties, "max_increment");
-							if (max_prop && max_prop->type == prop_number) {
-								max = max_prop->as.number;
-							}
-
-							struct property* entity_type_prop = table_get(object->properties, "entity_type");
-							char* entity_type = null;
-							if (entity_type_prop && entity_type_prop->type == prop_string) {
-								entity_type = entity_type_prop->as.string;
-							}
-
-							u32 spawn_type = 0;
-							if (strcmp(entity_type, "broken_robot") == 0) {
-								spawn_type = spawn_type_broken_robot;
-							}
-
-							v2f r = object->as.point;
-
-							entity e = new_entity(world);
-							add_componentv(world, e, struct transform, .position = { r.x * sprite_scale, r.y * sprite_scale });
-							add_componentv(world, e, struct entity_spawner, .spawn_type = spawn_type,
-								.next_spawn = random_f64(min, max), .max_increment = (f64)max, .min_increment = (f64)min);
-							add_componentv(world, e, struct room_child, .parent = room);
-						}
-					}
-				} else if (strcmp(layer->name, "lava") == 0) {
-					for (u32 ii = 0; ii < object_count; ii++) {
-						struct object* object = layer->as.object_layer.objects + ii;
-
-						if (object->shape == object_shape_rect) {
-							struct f32_rect r = object->as.rect;
-
-							entity e = new_entity(world);
-							add_componentv(world, e, struct lava, .collider = {
-								r.x * sprite_scale, r.y * sprite_scale,
-								r.w * sprite_scale, r.h * sprite_scale});
-							add_componentv(world, e, struct room_child, .parent = room);
-						}
-					}
-				} else if (strcmp(layer->name, "shops") == 0) {	
-					read_rects(room->shops, room->shop_count);
-				} else if (strcmp(layer->name, "lights") == 0) {
-					for (u32 ii = 0; ii < object_count; ii++) {
-						struct object* object = layer->as.object_layer.objects + ii;
-
-						if (object->shape == object_shape_point) {
-							f32 intensity = 1.0f;
-							f32 range = 1000.0f;
-							
-							v2f r = object->as.point;
-
-							entity e = new_entity(world);
-							add_componentv(world, e, struct transform, .position = { r.x * sprite_scale, r.y * sprite_scale });
-							add_componentv(world, e, struct light, .intensity = intensity, .range = range);
-							add_componentv(world, e, struct room_child, .parent = room);
-						}
-					}
-				} else {
-					fprintf(stderr, "Warning: Unknown object layer type `%s'\n", layer->name);
-				}
-			} break;
-			default: break;
+			init_tile_layer(room->layers + idx);
 		}
 	}
 
+	room->forground_index = header->forground_index < room->layer_count ? header->forground_index : 0;
+
+	room->camera_bounds = header->camera_bounds;
+
+	room->box_colliders = blob->box_colliders;
+	room->box_collider_count = header->box_colliders.count;
+	room->killzones = blob->killzones;
+	room->killzone_count = header->killzones.count;
+	room->shops = blob->shops;
+	room->shop_count = header->shops.count;
+	room->slope_colliders = blob->slopes;
+	room->slope_collider_count = header->slopes.count;
+
+	room->transition_trigger_count = header->transition_triggers.count;
+	room->transition_triggers = core_calloc(room->transition_trigger_count, sizeof(struct transition_trigger));
+
+	for (u32 i = 0; i < room->transition_trigger_count; i++) {
+		const struct room_trigger* cooked = blob->transition_triggers + i;
+
+		room->transition_triggers[i] = (struct transition_trigger) {
+			.rect = cooked->rect,
+			.change_to = (char*)room_blob_string(blob, cooked->change_to),
+			.entrance = (char*)room_blob_string(blob, cooked->entrance)
+		};
+	}
+
+	room->door_count = header->doors.count;
+	room->doors = core_calloc(room->door_count, sizeof(struct door));
+
+	for (u32 i = 0; i < room->door_count; i++) {
+		const struct room_trigger* cooked = blob->doors + i;
+
+		room->doors[i] = (struct door) {
+			.rect = cooked->rect,
+			.change_to = (char*)room_blob_string(blob, cooked->change_to),
+			.entrance = (char*)room_blob_string(blob, cooked->entrance)
+		};
+	}
+
+	room->dialogue_count = header->dialogue.count;
+	room->dialogue = core_calloc(room->dialogue_count, sizeof(struct dialogue));
+
+	for (u32 i = 0; i < room->dialogue_count; i++) {
+		const struct room_dialogue* cooked = blob->dialogue + i;
+
+		const char* on_play_name = room_blob_string(blob, cooked->on_play);
+		const char* on_next_name = room_blob_string(blob, cooked->on_next);
+
+		room->dialogue[i] = (struct dialogue) {
+			.rect = cooked->rect,
+			.on_play = on_play_name ? get_dialogue_fun(on_play_name) : null,
+			.on_next = on_next_name ? get_dialogue_fun(on_next_name) : null,
+		};
+	}
+
+	room->paths = core_calloc(header->paths.count, sizeof(struct path));
+
+	for (u32 i = 0; i < header->paths.count; i++) {
+		room->paths[i] = (struct path) {
+			.points = (v2f*)blob->points + blob->paths[i].points.first,
+			.count = blob->paths[i].points.count
+		};
+	}
+
+	init_room_grids(room);
+
 	return room;
 }
 
-void free_room(struct room* room) {
-	free_map(room->map);
+static void spawn_room(struct room* room) {
+	for (u32 i = 0; i < room->blob.header->spawns.count; i++) {
+		spawn_entity(room->world, room, room->blob.spawns + i);
+	}
+}
 
-	core_free(room->path);
+struct room* load_room(struct world* world, const char* path) {
+	res_trace_group(path);
+
+	struct room_files files;
+	if (!read_room_files(&files, path)) {
+		return null;
+	}
+
+	struct room* room = build_room(world, path, &files);
+	if (!room) {
+		return null;
+	}
+
+	while (!bake_room(room, 1.0)) {}
+
+	spawn_room(room);
+
+	return room;
+}
+
+/* Roughly; Only counts what grows with the size of the room. */
+static u64 room_size(struct room* room) {
+	u64 size = room->blob_file.size + room->map->file.size;
+
+	for (u32 i = 0; i < room->layer_count; i++) {
+		struct tile_layer* layer = room->layers + i;
+
+		for (u32 ii = 0; ii < layer->chunks_w * layer->chunks_h; ii++) {
+			size += quad_mesh_size(&layer->chunks[ii].mesh) + layer->chunks[ii].animated_count * sizeof(u32);
+		}
+	}
+
+	return size;
+}
+
+static void park_room(struct room* room) {
+	if (!room->parked) {
+		room->parked = new_world();
+	}
 
 	for (view(room->world, view, type_info(struct room_child))) {
 		struct room_child* rc = view_get(&view, struct room_child);
-		
-		if (rc->parent == room) {
+
+		if (rc->parent != room) { continue; }
+
+		/* Projectiles refer to whatever fired them, which is no longer the
+		 * same entity once it has been parked. */
+		if (has_component(room->world, view.e, struct projectile)) {
 			destroy_entity(room->world, view.e);
+		} else {
+			move_entity(room->world, room->parked, view.e);
 		}
 	}
+}
 
-	if (room->box_colliders) {
-		core_free(room->box_colliders);
+/* Brings the entities of a room back, and sets it up as though it had
+ * just been loaded. */
+static void unpark_room(struct room* room) {
+	for (view(room->parked, view, type_info(struct room_child))) {
+		move_entity(room->parked, room->world, view.e);
 	}
 
-	if (room->slope_colliders) {
-		core_free(room->slope_colliders);
+	room->transitioning_in = true;
+	room->transitioning_out = false;
+	room->transition_timer = 1.0;
+	room->name_timer = 3.0;
+}
+
+static void free_cached_rooms(struct room_cache* cache, u32 first) {
+	for (u32 i = first; i < cache->count; i++) {
+		free_room(cache->rooms[i]);
 	}
 
-	if (room->killzones) {
-		core_free(room->killzones);
+	cache->count = first < cache->count ? first : cache->count;
+}
+
+static void cache_room(struct room* room) {
+	struct room_cache* cache = &logic_store->room_cache;
+
+	park_room(room);
+	room->cached_size = room_size(room);
+
+	free_cached_rooms(cache, room_cache_max - 1);
+
+	memmove(cache->rooms + 1, cache->rooms, cache->count * sizeof(struct room*));
+	cache->rooms[0] = room;
+	cache->count++;
+
+	u64 size = 0;
+	for (u32 i = 0; i < cache->count; i++) {
+		size += cache->rooms[i]->cached_size;
+
+		if (size > room_cache_memory) {
+			free_cached_rooms(cache, i);
+			break;
+		}
 	}
+}
+
+/* Returns null if the room isn't in the cache. */
+static struct room* take_cached_room(const char* path) {
+	struct room_cache* cache = &logic_store->room_cache;
 
-	if (room->shops) {
-		core_free(room->shops);
+	for (u32 i = 0; i < cache->count; i++) {
+		struct room* room = cache->rooms[i];
+
+		if (strcmp(room->path, path) == 0) {
+			memmove(cache->rooms + i, cache->rooms + i + 1, (cache->count - i - 1) * sizeof(struct room*));
+			cache->count--;
+
+			return room;
+		}
+	}
+
+	return null;
+}
+
+void flush_room_cache() {
+	free_cached_rooms(&logic_store->room_cache, 0);
+}
+
+static void read_room_job(struct job* job) {
+	struct room_load* load = job->udata;
+
+	load->read = read_room_files(&load->files, load->path);
+}
+
+static struct room_load* start_room_load(const char* path) {
+	struct room_load* load = core_calloc(1, sizeof(struct room_load));
+	load->path = copy_string(path);
+
+	load->room = take_cached_room(path);
+	if (load->room) {
+		load->cached = true;
+		load->baked = true;
+
+		return load;
+	}
+
+	load->manifest = load_map_manifest(path);
+	res_prefetch(load->manifest);
+
+	load->job = (struct job) { .func = read_room_job, .udata = load };
+	job_submit(logic_store->job_pool, &load->job);
+
+	return load;
+}
+
+/* Moves a load along as far as it can go this frame. Returns true
+ * once the room is ready to be swapped in, or has failed to load, in
+ * which case `room' is null. */
+static bool update_room_load(struct world* world, struct room_load* load) {
+	if (!load->room) {
+		if (!job_finished(logic_store->job_pool, &load->job)) { return false; }
+		if (!load->read) { return true; }
+
+		if (load->manifest && !res_manifest_ready(load->manifest)) { return false; }
+
+		load->room = build_room(world, load->path, &load->files);
+		load->read = false;
+
+		if (!load->room) { return true; }
+	}
+
+	if (!load->baked) {
+		load->baked = bake_room(load->room, room_bake_budget);
+	}
+
+	return load->baked;
+}
+
+static void free_room_load(struct room_load* load) {
+	if (!job_cancel(logic_store->job_pool, &load->job)) {
+		job_join(logic_store->job_pool, &load->job);
+	}
+
+	/* Read, but never built. */
+	if (load->read) {
+		file_close(&load->files.map);
+		file_close(&load->files.blob);
+	}
+
+	if (load->room && load->cached) {
+		cache_room(load->room);
+	} else if (load->room) {
+		free_room(load->room);
+	}
+
+	free_res_manifest(load->manifest);
+	core_free(load->path);
+	core_free(load);
+}
+
+static void free_room_prefetches(struct room* room) {
+	for (u32 i = 0; i < room->prefetch_count; i++) {
+		free_room_load(room->prefetches[i]);
+	}
+
+	room->prefetch_count = 0;
+}
+
+/* Returns the prefetch of a room, after taking it from the list, or
+ * null if the room isn't being prefetched. */
+static struct room_load* take_room_prefetch(struct room* room, const char* path) {
+	for (u32 i = 0; i < room->prefetch_count; i++) {
+		struct room_load* load = room->prefetches[i];
+
+		if (strcmp(load->path, path) == 0) {
+			room->prefetches[i] = room->prefetches[--room->prefetch_count];
+			return load;
+		}
+	}
+
+	return null;
+}
+
+static bool room_is_cached(const char* path) {
+	struct room_cache* cache = &logic_store->room_cache;
+
+	for (u32 i = 0; i < cache->count; i++) {
+		if (strcmp(get_room_path(cache->rooms[i]), path) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* The square of the distance between the edges of two rectangles, or
+ * zero if they overlap. */
+static i64 rect_distance_sqrd(struct rect a, struct rect b) {
+	i64 dx = 0, dy = 0;
+
+	if (a.x + a.w < b.x) { dx = b.x - (a.x + a.w); }
+	else if (b.x + b.w < a.x) { dx = a.x - (b.x + b.w); }
+
+	if (a.y + a.h < b.y) { dy = b.y - (a.y + a.h); }
+	else if (b.y + b.h < a.y) { dy = a.y - (b.y + b.h); }
+
+	return dx * dx + dy * dy;
+}
+
+/* How near the body is to the nearest exit that leads to `path'. */
+static i64 exit_distance_sqrd(struct room* room, struct rect body_rect, const char* path) {
+	i64 nearest = INT64_MAX;
+
+	for (u32 i = 0; i < room->transition_trigger_count; i++) {
+		struct transition_trigger* t = room->transition_triggers + i;
+
+		if (t->change_to && strcmp(t->change_to, path) == 0) {
+			i64 d = rect_distance_sqrd(body_rect, t->rect);
+			nearest = d < nearest ? d : nearest;
+		}
+	}
+
+	for (u32 i = 0; i < room->door_count; i++) {
+		struct door* d = room->doors + i;
+
+		if (d->change_to && strcmp(d->change_to, path) == 0) {
+			i64 dist = rect_distance_sqrd(body_rect, d->rect);
+			nearest = dist < nearest ? dist : nearest;
+		}
+	}
+
+	return nearest;
+}
+
+/* Offers the room that an exit leads to for prefetching. */
+static void consider_prefetch(struct room* room, struct rect body_rect, const char* path,
+	const char** best, i64* best_distance) {
+	if (!path || strcmp(path, room->path) == 0 || room_is_cached(path)) { return; }
+
+	for (u32 i = 0; i < room->prefetch_count; i++) {
+		if (strcmp(room->prefetches[i]->path, path) == 0) { return; }
+	}
+
+	i64 d = exit_distance_sqrd(room, body_rect, path);
+	if (d < *best_distance) {
+		*best = path;
+		*best_distance = d;
+	}
+}
+
+/* Loads the rooms that the exits near the body lead to ahead of time,
+ * so that by the time the body goes through one, its room is ready to
+ * be swapped in, as though it had been cached. Loads are given up on
+ * once the body moves away from their exits, and at most one room is
+ * built or baked a little at a time each frame, the nearest first. */
+static void update_room_prefetch(struct room* room, struct rect body_rect, struct rect reach) {
+	const i64 cancel_distance = (i64)prefetch_cancel_distance * (i64)prefetch_cancel_distance;
+
+	i64 distances[room_prefetch_max];
+
+	for (u32 i = 0; i < room->prefetch_count; i++) {
+		distances[i] = exit_distance_sqrd(room, body_rect, room->prefetches[i]->path);
+
+		if (distances[i] > cancel_distance) {
+			free_room_load(room->prefetches[i]);
+
+			room->prefetches[i] = room->prefetches[--room->prefetch_count];
+			i--;
+		}
+	}
+
+	/* Nearest first; There are only ever a couple. */
+	for (u32 i = 1; i < room->prefetch_count; i++) {
+		for (u32 ii = i; ii > 0 && distances[ii] < distances[ii - 1]; ii--) {
+			struct room_load* load = room->prefetches[ii];
+			room->prefetches[ii] = room->prefetches[ii - 1];
+			room->prefetches[ii - 1] = load;
+
+			i64 d = distances[ii];
+			distances[ii] = distances[ii - 1];
+			distances[ii - 1] = d;
+		}
+	}
+
+	u64 size = 0;
+	for (u32 i = 0; i < room->prefetch_count; i++) {
+		if (room->prefetches[i]->room) {
+			size += room_size(room->prefetches[i]->room);
+		}
+	}
+
+	if (room->prefetch_count < room_prefetch_max && size < room_prefetch_memory) {
+		const char* best = null;
+		i64 best_distance = INT64_MAX;
+
+		const u32* near;
+		u32 near_count;
+
+		near_count = rect_grid_query(&room->transition_trigger_grid, reach, &near);
+		for (u32 i = 0; i < near_count; i++) {
+			struct transition_trigger* t = room->transition_triggers + near[i];
+
+			if (rect_overlap(reach, t->rect, null)) {
+				consider_prefetch(room, body_rect, t->change_to, &best, &best_distance);
+			}
+		}
+
+		near_count = rect_grid_query(&room->door_grid, reach, &near);
+		for (u32 i = 0; i < near_count; i++) {
+			struct door* d = room->doors + near[i];
+
+			if (rect_overlap(reach, d->rect, null)) {
+				consider_prefetch(room, body_rect, d->change_to, &best, &best_distance);
+			}
+		}
+
+		if (best) {
+			room->prefetches[room->prefetch_count++] = start_room_load(best);
+		}
+	}
+
+	for (u32 i = 0; i < room->prefetch_count; i++) {
+		if (!update_room_load(room->world, room->prefetches[i])) {
+			break;
+		}
+	}
+}
+
+void free_room(struct room* room) {
+	if (room->next) {
+		free_room_load(room->next);
+	}
+
+	free_room_prefetches(room);
+
+	free_map(room->map);
+
+	res_release_font(room->name_font);
+
+	core_free(room->path);
+
+	if (room->parked) {
+		unpark_room(room);
+		free_world(room->parked);
+	}
+
+	for (view(room->world, view, type_info(struct room_child))) {
+		struct room_child* rc = view_get(&view, struct room_child);
+		
+		if (rc->parent == room) {
+			destroy_entity(room->world, view.e);
+		}
 	}
 
 	if (room->layers) {
+		for (u32 i = 0; i < room->layer_count; i++) {
+			free_tile_layer(room->layers + i);
+		}
+
 		core_free(room->layers);
 	}
 
@@ -623,13 +1048,11 @@ void free_room(struct room* room) {
 		core_free(room->dialogue);
 	}
 
-	free_table(room->entrances);
+	core_free(room->paths);
 
-	for (struct table_iter i = new_table_iter(room->paths); table_iter_next(&i);) {
-		struct path* p = i.value;
-		core_free(p->points);
-	}
-	free_table(room->paths);
+	deinit_room_grids(room);
+
+	file_close(&room->blob_file);
 
 	core_free(room);
 }
@@ -650,38 +1073,36 @@ static void draw_tile_layer(struct room* room, struct renderer* renderer, struct
 		end_x = end_x > layer->w ? layer->w : end_x;
 		end_y = end_y > layer->h ? layer->h : end_y;
 
-		for (u32 y = start_y; y < end_y; y++) {
-			for (u32 x = start_x; x < end_x; x++) {
-				struct tile tile = layer->tiles[x + y * layer->w];
-				if (tile.id != -1) {
+		if (start_x >= end_x || start_y >= end_y) { return; }
+
+		for (u32 cy = start_y / tile_chunk_size; cy <= (end_y - 1) / tile_chunk_size; cy++) {
+			for (u32 cx = start_x / tile_chunk_size; cx <= (end_x - 1) / tile_chunk_size; cx++) {
+				struct tile_chunk* chunk = layer->chunks + cx + cy * layer->chunks_w;
+
+				renderer_draw_quad_mesh(renderer, &chunk->mesh);
+
+				struct textured_quad quads[animated_tile_batch_size];
+				u32 quad_count = 0;
+
+				for (u32 i = 0; i < chunk->animated_count; i++) {
+					u32 x = chunk->animated[i] % layer->w;
+					u32 y = chunk->animated[i] / layer->w;
+
+					if (x < start_x || x >= end_x || y < start_y || y >= end_y) { continue; }
+
+					struct tile tile = layer->tiles[chunk->animated[i]];
 					struct tileset* set = room->tilesets + tile.tileset_id;
+					struct animated_tile* at = set->animations + tile.id;
 
-					struct textured_quad quad = {
-						.texture = set->image,
-						.position = { x * set->tile_w * sprite_scale, y * set->tile_h * sprite_scale },
-						.dimentions = { set->tile_w * sprite_scale, set->tile_h * sprite_scale },
-						.rect = {
-							.x = ((tile.id % (set->image->width  / set->tile_w)) * set->tile_w),
-							.y = ((tile.id / (set->image->width / set->tile_h)) * set->tile_h),
-							.w = set->tile_w,
-							.h = set->tile_h
-						},
-						.color = { 255, 255, 255, 255 }
-					};
-
-					if (set->animations[tile.id].exists) {
-						struct animated_tile* at = set->animations + tile.id;
-
-						quad.rect = (struct rect) {	
-							.x = ((at->frames[at->current_frame] % (set->image->width  / set->tile_w)) * set->tile_w),
-							.y = ((at->frames[at->current_frame] / (set->image->width / set->tile_h)) * set->tile_h),
-							.w = set->tile_w,
-							.h = set->tile_h
-						};
+					if (quad_count >= animated_tile_batch_size) {
+						renderer_push_n(renderer, quads, quad_count);
+						quad_count = 0;
 					}
 
-					renderer_push(renderer, &quad);
+					quads[quad_count++] = make_tile_quad(x, y, at->frames[at->current_frame], set);
 				}
+
+				renderer_push_n(renderer, quads, quad_count);
 			}
 		}
 	}
@@ -715,20 +1136,9 @@ void update_room_light(struct room* room, struct renderer* renderer) {
 
 void update_room(struct room* room, f64 ts, f64 actual_ts) {
 	/* Update tile animations */
+	room->tile_time += ts;
 	for (u32 i = 0; i < room->tileset_count; i++) {
-		for (u32 ii = 0; ii < room->tilesets[i].tile_count; ii++) {
-			struct animated_tile* at = room->tilesets[i].animations + ii;
-			if (at->exists) {
-				at->timer += ts;
-				if (at->timer > at->durations[at->current_frame]) {
-					at->timer = 0.0;
-					at->current_frame++;
-					if (at->current_frame >= at->frame_count) {
-						at->current_frame = 0;
-					}
-				}
-			}
-		}
+		update_tile_animations(room->tilesets + i, room->tile_time);
 	}
 
 	/* Update spawners */
@@ -851,26 +1261,61 @@ void update_room(struct room* room, f64 ts, f64 actual_ts) {
 		logic_store->frozen = true;
 
 		room->transition_timer += actual_ts * room->transition_speed;
-		if (room->transition_timer >= 1.0) {
-			struct room** ptr = room->ptr;
 
-			struct world* world = room->world;
+		bool ready = update_room_load(room->world, room->next);
+
+		if (ready && !room->next->room) {
+			/* Stay where we are, rather than end up nowhere. */
+			fprintf(stderr, "Failed to load room `%s'.\n", room->transition_to);
+
+			free_room_load(room->next);
+			room->next = null;
+
+			core_free(room->transition_to);
+			core_free(room->entrance);
+			room->transition_to = null;
+			room->entrance = null;
+
+			room->transitioning_out = false;
+			room->transitioning_in = true;
+			room->transition_timer = room->transition_timer > 1.0 ? 1.0 : room->transition_timer;
+		} else if (ready && room->transition_timer >= 1.0) {
+			struct room** ptr = room->ptr;
 
 			entity body = room->body;
 			struct rect collider = room->collider;
 			char* change_to = room->transition_to;
 			char* entrance = room->entrance;
 
-			free_room(room);
-			*ptr = load_room(world, change_to);
-			room = *ptr;
+			struct room_load* load = room->next;
+			struct room* next = load->room;
+			bool cached = load->cached;
+			load->room = null;
+			room->next = null;
+
+			free_room_load(load);
+
+			room->transition_to = null;
+			room->entrance = null;
+			room->transitioning_out = false;
+
+			free_room_prefetches(room);
+			cache_room(room);
+			*ptr = next;
+			room = next;
+
+			if (cached) {
+				unpark_room(room);
+			} else {
+				spawn_room(room);
+			}
 
-			v2i* entrance_pos = (v2i*)table_get(room->entrances, entrance);
+			const struct room_entrance* entrance_pos = room_blob_find_entrance(&room->blob, entrance);
 			if (entrance_pos) {
 				v2f* position = &get_component(room->world, body, struct transform)->position;
 
-				position->x = entrance_pos->x - (collider.w / 2);
-				position->y = entrance_pos->y - collider.h;
+				position->x = entrance_pos->position.x - (collider.w / 2);
+				position->y = entrance_pos->position.y - collider.h;
 
 				logic_store->camera_position = *position;
 			} else {
@@ -914,9 +1359,14 @@ bool handle_body_collisions(struct room* room, struct rect collider, v2f* positi
 
 	bool collided = false;
 
+	const u32* near;
+	u32 near_count;
+
 	/* Resolve rectangle collisions, using a basic AABB vs AABB method. */
-	for (u32 i = 0; i < room->box_collider_count; i++) {
-		struct rect rect = room->box_colliders[i];
+	near_count = solid_map_overlap(&room->solids, body_rect) ?
+		rect_grid_query(&room->solids.grid, body_rect, &near) : 0;
+	for (u32 i = 0; i < near_count; i++) {
+		struct rect rect = room->box_colliders[near[i]];
 
 		v2i normal;
 		if (rect_overlap(body_rect, rect, &normal)) {
@@ -946,9 +1396,11 @@ bool handle_body_collisions(struct room* room, struct rect collider, v2f* positi
 	 *
 	 * NOTE: Slopes are buggy at low framerate, for unknown reasons. */
  	v2i check_point = make_v2i(body_rect.x + (body_rect.w / 2), body_rect.y + body_rect.h);
-	for (u32 i = 0; i < room->slope_collider_count; i++) {
-		v2i start = make_v2i(room->slope_colliders[i].x, room->slope_colliders[i].y);
-		v2i end   = make_v2i(room->slope_colliders[i].z, room->slope_colliders[i].w);
+	near_count = rect_grid_query(&room->slope_grid, make_rect(check_point.x, check_point.y, 1, 1), &near);
+	for (u32 i = 0; i < near_count; i++) {
+		const struct room_slope* slope = room->slope_colliders + near[i];
+		v2i start = slope->start;
+		v2i end   = slope->end;
 
 		if (start.y == end.y) { /* Straight lines. */
 			if (check_point.x > start.x && check_point.x < end.x &&
@@ -960,11 +1412,8 @@ bool handle_body_collisions(struct room* room, struct rect collider, v2f* positi
 			if (point_vs_rtri(check_point, start, end)) {
 		 		f32 col_centre = body_rect.x + (body_rect.w / 2);
 
-				f32 slope = (f32)(end.y - start.y) / (f32)(end.x - start.x); /* Rise/Run. */
-		 		f32 b = (start.y - (slope * start.x));
-
 		 		/* y = mx + b */
-				position->y = (((slope * col_centre) + b) - body_rect.h) - collider.y;
+				position->y = (((slope->slope * col_centre) + slope->b) - body_rect.h) - collider.y;
 				velocity->y = 0.0f;
 
 				collided = true;
@@ -989,6 +1438,17 @@ void room_transition_to(struct room** room, entity body, struct rect collider, c
 
 	(*room)->body = body;
 	(*room)->collider = collider;
+
+	if ((*room)->next) {
+		free_room_load((*room)->next);
+	}
+
+	res_trace_group(path);
+
+	(*room)->next = take_room_prefetch(*room, path);
+	if (!(*room)->next) {
+		(*room)->next = start_room_load(path);
+	}
 }
 
 void handle_body_interactions(struct room** room_ptr, struct rect collider, entity body, bool body_on_ground) {
@@ -1004,18 +1464,34 @@ void handle_body_interactions(struct room** room_ptr, struct rect collider, enti
 		.w = collider.w, .h = collider.h
 	};
 
+	struct rect reach = {
+		.x = body_rect.x - prefetch_distance,
+		.y = body_rect.y - prefetch_distance,
+		.w = body_rect.w + prefetch_distance * 2,
+		.h = body_rect.h + prefetch_distance * 2
+	};
+
+	if (!room->transitioning_out) {
+		update_room_prefetch(room, body_rect, reach);
+	}
+
+	const u32* near;
+	u32 near_count;
+
 	struct transition_trigger* transition = null;
-	for (u32 i = 0; i < room->transition_trigger_count; i++) {
-		struct rect rect = room->transition_triggers[i].rect;
+	near_count = rect_grid_query(&room->transition_trigger_grid, body_rect, &near);
+	for (u32 i = 0; i < near_count; i++) {
+		struct rect rect = room->transition_triggers[near[i]].rect;
 
 		if (rect_overlap(body_rect, rect, null)) {
-			transition = room->transition_triggers + i;
+			transition = room->transition_triggers + near[i];
 			break;
 		}
 	}
 
-	for (u32 i = 0; i < room->killzone_count; i++) {
-		struct rect rect = room->killzones[i];
+	near_count = rect_grid_query(&room->killzone_grid, body_rect, &near);
+	for (u32 i = 0; i < near_count; i++) {
+		struct rect rect = room->killzones[near[i]];
 
 		if (rect_overlap(body_rect, rect, null)) {
 			kill_player(room->world, body);
@@ -1025,11 +1501,12 @@ void handle_body_interactions(struct room** room_ptr, struct rect collider, enti
 	
 	struct door* door = null;
 	if (body_on_ground && key_just_pressed(main_window, mapped_key("interact"))) {
-		for (u32 i = 0; i < room->door_count; i++) {
-			struct rect rect = room->doors[i].rect;
+		near_count = rect_grid_query(&room->door_grid, body_rect, &near);
+		for (u32 i = 0; i < near_count; i++) {
+			struct rect rect = room->doors[near[i]].rect;
 
 			if (rect_overlap(body_rect, rect, null)) {
-				door = room->doors + i;
+				door = room->doors + near[i];
 				break;
 			}
 		}
@@ -1042,17 +1519,19 @@ void handle_body_interactions(struct room** room_ptr, struct rect collider, enti
 			}
 		}
 
-		for (u32 i = 0; i < room->dialogue_count; i++) {
-			struct dialogue* d = room->dialogue + i;
+		near_count = rect_grid_query(&room->dialogue_grid, body_rect, &near);
+		for (u32 i = 0; i < near_count; i++) {
+			struct dialogue* d = room->dialogue + near[i];
 
-			if (rect_overlap(body_rect, room->dialogue[i].rect, null) && d->on_play) {
+			if (rect_overlap(body_rect, d->rect, null) && d->on_play) {
 				d->want_next = true;
 				d->on_play(&d->want_next);
 			}
 		}
 
-		for (u32 i = 0; i < room->shop_count; i++) {
-			if (rect_overlap(body_rect, room->shops[i], null)) {
+		near_count = rect_grid_query(&room->shop_grid, body_rect, &near);
+		for (u32 i = 0; i < near_count; i++) {
+			if (rect_overlap(body_rect, room->shops[near[i]], null)) {
 				shopping();
 			}
 		}
@@ -1080,11 +1559,21 @@ void handle_body_interactions(struct room** room_ptr, struct rect collider, enti
 }
 
 bool rect_room_overlap(struct room* room, struct rect rect, v2i* normal) {
-	for (u32 i = 0; i < room->box_collider_count; i++) {
-		struct rect r = room->box_colliders[i];
+	if (normal) { *normal = make_v2i(0, 0); }
 
-		if (rect_overlap(rect, r, normal)) {
-			return true;
+	const u32* near;
+	u32 near_count;
+
+	if (solid_map_overlap(&room->solids, rect)) {
+		if (!normal) { return true; }
+
+		near_count = rect_grid_query(&room->solids.grid, rect, &near);
+		for (u32 i = 0; i < near_count; i++) {
+			struct rect r = room->box_colliders[near[i]];
+
+			if (rect_overlap(rect, r, normal)) {
+				return true;
+			}
 		}
 	}
 
@@ -1094,12 +1583,15 @@ bool rect_room_overlap(struct room* room, struct rect rect, v2i* normal) {
  		{ rect.x + rect.w, rect.y + rect.h },
  	};
 
+	/* The check points are all along the bottom edge. */
+	near_count = rect_grid_query(&room->slope_grid, make_rect(rect.x, rect.y + rect.h, rect.w + 1, 1), &near);
+
 	for (u32 j = 0; j < sizeof(check_points) / sizeof(*check_points); j++) {
 		v2i check_point = check_points[j];
 
-		for (u32 i = 0; i < room->slope_collider_count; i++) {
-			v2i start = make_v2i(room->slope_colliders[i].x, room->slope_colliders[i].y);
-			v2i end   = make_v2i(room->slope_colliders[i].z, room->slope_colliders[i].w);
+		for (u32 i = 0; i < near_count; i++) {
+			v2i start = room->slope_colliders[near[i]].start;
+			v2i end   = room->slope_colliders[near[i]].end;
 
 			if (start.y == end.y) { /* Straight lines. */
 				if (check_point.x > start.x && check_point.x < end.x &&
@@ -1119,10 +1611,22 @@ bool rect_room_overlap(struct room* room, struct rect rect, v2i* normal) {
 	return false;
 }
 
+bool room_solid_at(struct room* room, v2i point) {
+	return solid_map_at(&room->solids, point);
+}
+
+i32 room_sweep_x(struct room* room, struct rect rect, i32 dx) {
+	return solid_map_sweep_x(&room->solids, rect, dx);
+}
+
+i32 room_sweep_y(struct room* room, struct rect rect, i32 dy) {
+	return solid_map_sweep_y(&room->solids, rect, dy);
+}
+
 v2i get_spawn(struct room* room) {
-	v2i* entrance_pos = (v2i*)table_get(room->entrances, "spawn");
-	if (entrance_pos) {
-		return make_v2i(entrance_pos->x, entrance_pos->y);
+	const struct room_entrance* entrance = room_blob_find_entrance(&room->blob, "spawn");
+	if (entrance) {
+		return entrance->position;
 	}
 
 	return make_v2i(0, 0);
@@ -1133,7 +1637,10 @@ struct rect room_get_camera_bounds(struct room* room) {
 }
 
 struct path* get_path(struct room* room, const char* name) {
-	return table_get(room->paths, name);
+	const struct room_path* path = room_blob_find_path(&room->blob, name);
+	if (!path) { return null; }
+
+	return room->paths + (path - room->blob.paths);
 }
 
 entity new_save_point(struct world* world, struct room* room, struct rect rect) {
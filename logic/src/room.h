@@ -30,6 +30,30 @@ void handle_body_interactions(struct room** room, struct rect rect, entity body,
 void room_transition_to(struct room** room, entity body, struct rect collider, const char* path, const char* entrance);
 bool rect_room_overlap(struct room* room, struct rect rect, v2i* normal);
 
+/* Rooms that have been left are kept in a cache, with their entities
+ * parked in a world of their own, so that going back to one doesn't
+ * load it again and finds it as it was left. The rooms that were left
+ * the longest ago are freed once there are more than room_cache_max of
+ * them, or they take up more than room_cache_memory bytes between
+ * them. */
+#define room_cache_max 8
+#define room_cache_memory (64 * 1024 * 1024)
+
+struct room_cache {
+	/* The most recently left first. */
+	struct room* rooms[room_cache_max];
+	u32 count;
+};
+
+/* For when the rooms that have been left no longer match the state of
+ * the game, such as when a save is loaded. */
+void flush_room_cache();
+
+/* Against the box colliders of the room only; See `solid_map' in `physics.h'. */
+bool room_solid_at(struct room* room, v2i point);
+i32 room_sweep_x(struct room* room, struct rect rect, i32 dx);
+i32 room_sweep_y(struct room* room, struct rect rect, i32 dy);
+
 typedef void (*dialogue_ask_submit_func)(bool, void*);
 
 void dialogue_message(const char* text, void* ctx);
@@ -0,0 +1,563 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "consts.h"
+#include "core.h"
+#include "player.h"
+#include "room.h"
+#include "roomcook.h"
+#include "vector.h"
+
+struct room_cooker {
+	struct map_view map;
+
+	struct room_blob_header header;
+	u32 tile_layer_count;
+
+	vector(struct rect) box_colliders;
+	vector(struct rect) killzones;
+	vector(struct rect) shops;
+	vector(struct room_slope) slopes;
+	vector(struct room_trigger) transition_triggers;
+	vector(struct room_trigger) doors;
+	vector(struct room_dialogue) dialogue;
+	vector(struct room_entrance) entrances;
+	vector(struct room_path) paths;
+	vector(v2f) points;
+	vector(struct room_spawn) spawns;
+
+	char* strings;
+	u32 string_size;
+};
+
+static u32 add_string(struct room_cooker* cooker, const char* string) {
+	if (!string || !string[0]) { return 0; }
+
+	u32 len = (u32)strlen(string) + 1;
+	u32 offset = cooker->string_size;
+
+	cooker->strings = core_realloc(cooker->strings, cooker->string_size + len);
+	memcpy(cooker->strings + offset, string, len);
+	cooker->string_size += len;
+
+	return offset;
+}
+
+static u32 string_property(struct room_cooker* cooker, struct map_range properties, const char* name) {
+	const struct map_property* prop = map_find_property(&cooker->map, properties, name);
+	if (!prop || prop->type != prop_string) { return 0; }
+
+	return add_string(cooker, map_string(&cooker->map, prop->as.string));
+}
+
+static f64 number_property(struct room_cooker* cooker, struct map_range properties, const char* name, f64 fallback) {
+	const struct map_property* prop = map_find_property(&cooker->map, properties, name);
+	if (!prop || prop->type != prop_number) { return fallback; }
+
+	return prop->as.number;
+}
+
+/* Colliders, triggers, entrances, paths and upgrades are snapped to
+ * whole pixels before they are scaled; Everything else is scaled
+ * first. */
+static struct rect snapped_rect(const struct map_object* object) {
+	return (struct rect) {
+		(i32)object->x * sprite_scale,
+		(i32)object->y * sprite_scale,
+		(i32)object->w * sprite_scale,
+		(i32)object->h * sprite_scale
+	};
+}
+
+static struct rect scaled_rect(const struct map_object* object) {
+	return (struct rect) {
+		(i32)(object->x * sprite_scale),
+		(i32)(object->y * sprite_scale),
+		(i32)(object->w * sprite_scale),
+		(i32)(object->h * sprite_scale)
+	};
+}
+
+static struct f32_rect scaled_f32_rect(const struct map_object* object) {
+	return (struct f32_rect) {
+		object->x * sprite_scale,
+		object->y * sprite_scale,
+		object->w * sprite_scale,
+		object->h * sprite_scale
+	};
+}
+
+static void add_spawn(struct room_cooker* cooker, const struct room_spawn* spawn) {
+	vector_push(cooker->spawns, *spawn);
+}
+
+static u64 hash_name(const char* name) {
+	return fnv1a_hash((const u8*)name, strlen(name));
+}
+
+static void add_slopes(struct room_cooker* cooker, const struct map_object* object) {
+	if (!map_range_ok(object->points, cooker->map.header->points)) { return; }
+
+	const v2f* points = cooker->map.points + object->points.first;
+
+	for (u32 i = 1; i < object->points.count; i++) {
+		v2i start = make_v2i((i32)points[i - 1].x * sprite_scale, (i32)points[i - 1].y * sprite_scale);
+		v2i end   = make_v2i((i32)points[i].x * sprite_scale,     (i32)points[i].y * sprite_scale);
+
+		/* Ensure that the start of the slope is alway smaller than the end on the `y' axis,
+		 * or on the `x' axis if the slope is flat. */
+		if (start.y > end.y || (start.y == end.y && start.x > end.x)) {
+			v2i c = start;
+			start = end;
+			end = c;
+		}
+
+		struct room_slope slope = { .start = start, .end = end };
+
+		if (start.y != end.y) {
+			slope.slope = (f32)(end.y - start.y) / (f32)(end.x - start.x); /* Rise/Run. */
+			slope.b = start.y - (slope.slope * start.x);
+		}
+
+		vector_push(cooker->slopes, slope);
+	}
+}
+
+static void add_entrance(struct room_cooker* cooker, const struct map_object* object) {
+	const char* name = map_string(&cooker->map, object->name);
+
+	struct room_entrance entrance = {
+		.hash = hash_name(name),
+		.name = add_string(cooker, name),
+		.position = { (i32)object->x * sprite_scale, (i32)object->y * sprite_scale }
+	};
+
+	/* Later entrances replace earlier ones with the same name. */
+	for (u32 i = 0; i < vector_count(cooker->entrances); i++) {
+		if (cooker->entrances[i].hash == entrance.hash) {
+			cooker->entrances[i] = entrance;
+			return;
+		}
+	}
+
+	vector_push(cooker->entrances, entrance);
+}
+
+static void add_path(struct room_cooker* cooker, const struct map_object* object) {
+	if (!map_range_ok(object->points, cooker->map.header->points)) { return; }
+
+	const char* name = map_string(&cooker->map, object->name);
+
+	struct room_path path = {
+		.hash = hash_name(name),
+		.name = add_string(cooker, name),
+		.points = { vector_count(cooker->points), object->points.count }
+	};
+
+	for (u32 i = 0; i < object->points.count; i++) {
+		v2f point = cooker->map.points[object->points.first + i];
+
+		v2f scaled = make_v2f((i32)point.x * sprite_scale, (i32)point.y * sprite_scale);
+		vector_push(cooker->points, scaled);
+	}
+
+	for (u32 i = 0; i < vector_count(cooker->paths); i++) {
+		if (cooker->paths[i].hash == path.hash) {
+			cooker->paths[i] = path;
+			return;
+		}
+	}
+
+	vector_push(cooker->paths, path);
+}
+
+static void add_enemy(struct room_cooker* cooker, const struct map_object* object) {
+	const char* name = map_string(&cooker->map, object->name);
+
+	struct room_spawn spawn = {
+		.rect = { object->x * sprite_scale, object->y * sprite_scale },
+		.as.enemy.path = string_property(cooker, object->properties, "path")
+	};
+
+	if (strcmp(name, "bat") == 0) {
+		spawn.prefab = room_prefab_bat;
+	} else if (strcmp(name, "spider") == 0) {
+		spawn.prefab = room_prefab_spider;
+	} else if (strcmp(name, "drill") == 0) {
+		spawn.prefab = room_prefab_drill;
+	} else if (strcmp(name, "scav") == 0) {
+		spawn.prefab = room_prefab_scav;
+	} else {
+		return;
+	}
+
+	add_spawn(cooker, &spawn);
+}
+
+static void add_upgrade(struct room_cooker* cooker, const struct map_object* object) {
+	const char* name = map_string(&cooker->map, object->name);
+
+	struct rect r = snapped_rect(object);
+
+	struct room_spawn spawn = {
+		.rect = { r.x, r.y, r.w, r.h },
+		.as.upgrade.id = -1,
+		.as.upgrade.prefix = string_property(cooker, object->properties, "prefix"),
+		.as.upgrade.name = string_property(cooker, object->properties, "name")
+	};
+
+	if (strcmp(name, "jetpack") == 0) {
+		spawn.prefab = room_prefab_jetpack;
+		spawn.as.upgrade.id = upgrade_jetpack;
+	} else if (strcmp(name, "health_pack") == 0) {
+		spawn.prefab = room_prefab_health_pack;
+		spawn.as.upgrade.id = (i32)number_property(cooker, object->properties, "id", -1.0);
+	} else if (strcmp(name, "health_booster") == 0) {
+		spawn.prefab = room_prefab_health_booster;
+		spawn.as.upgrade.id = (i32)number_property(cooker, object->properties, "id", -1.0);
+	} else {
+		return;
+	}
+
+	add_spawn(cooker, &spawn);
+}
+
+static void add_entity_spawner(struct room_cooker* cooker, const struct map_object* object) {
+	struct room_spawn spawn = {
+		.prefab = room_prefab_entity_spawner,
+		.rect = { object->x * sprite_scale, object->y * sprite_scale },
+		.as.spawner.type = spawn_type_broken_robot,
+		.as.spawner.min_increment = number_property(cooker, object->properties, "min_increment", 0.0),
+		.as.spawner.max_increment = number_property(cooker, object->properties, "max_increment", 0.0)
+	};
+
+	add_spawn(cooker, &spawn);
+}
+
+static void add_trigger(struct room_cooker* cooker, vector(struct room_trigger)* triggers,
+	const struct map_object* object) {
+
+	struct room_trigger trigger = {
+		.rect = snapped_rect(object),
+		.change_to = string_property(cooker, object->properties, "change_to"),
+		.entrance = string_property(cooker, object->properties, "entrance")
+	};
+
+	vector_push(*triggers, trigger);
+}
+
+static void add_object(struct room_cooker* cooker, const char* layer_name, const struct map_object* object) {
+	bool rect = object->shape == object_shape_rect;
+	bool point = object->shape == object_shape_point;
+	bool polygon = object->shape == object_shape_polygon;
+
+	if (strcmp(layer_name, "collisions") == 0 && rect) {
+		struct rect r = snapped_rect(object);
+		vector_push(cooker->box_colliders, r);
+	} else if (strcmp(layer_name, "killzones") == 0 && rect) {
+		struct rect r = snapped_rect(object);
+		vector_push(cooker->killzones, r);
+	} else if (strcmp(layer_name, "shops") == 0 && rect) {
+		struct rect r = snapped_rect(object);
+		vector_push(cooker->shops, r);
+	} else if (strcmp(layer_name, "slopes") == 0 && polygon) {
+		add_slopes(cooker, object);
+	} else if (strcmp(layer_name, "entrances") == 0 && point) {
+		add_entrance(cooker, object);
+	} else if (strcmp(layer_name, "enemy_paths") == 0 && polygon) {
+		add_path(cooker, object);
+	} else if (strcmp(layer_name, "enemies") == 0 && point) {
+		add_enemy(cooker, object);
+	} else if (strcmp(layer_name, "transition_triggers") == 0 && rect) {
+		add_trigger(cooker, &cooker->transition_triggers, object);
+	} else if (strcmp(layer_name, "doors") == 0 && rect) {
+		add_trigger(cooker, &cooker->doors, object);
+	} else if (strcmp(layer_name, "save_points") == 0 && rect) {
+		add_spawn(cooker, &(struct room_spawn) { .prefab = room_prefab_save_point, .rect = scaled_f32_rect(object) });
+	} else if (strcmp(layer_name, "meta") == 0 && rect) {
+		if (strcmp(map_string(&cooker->map, object->name), "camera_bounds") == 0) {
+			cooker->header.camera_bounds = scaled_rect(object);
+		}
+	} else if (strcmp(layer_name, "upgrade_pickups") == 0 && rect) {
+		add_upgrade(cooker, object);
+	} else if (strcmp(layer_name, "dialogue_triggers") == 0 && rect) {
+		struct room_dialogue dialogue = {
+			.rect = scaled_rect(object),
+			.on_play = string_property(cooker, object->properties, "on_play"),
+			.on_next = string_property(cooker, object->properties, "on_next")
+		};
+
+		vector_push(cooker->dialogue, dialogue);
+	} else if (strcmp(layer_name, "entity_spawners") == 0 && point) {
+		add_entity_spawner(cooker, object);
+	} else if (strcmp(layer_name, "lava") == 0 && rect) {
+		add_spawn(cooker, &(struct room_spawn) { .prefab = room_prefab_lava, .rect = scaled_f32_rect(object) });
+	} else if (strcmp(layer_name, "lights") == 0 && point) {
+		add_spawn(cooker, &(struct room_spawn) {
+			.prefab = room_prefab_light,
+			.rect = { object->x * sprite_scale, object->y * sprite_scale } });
+	}
+}
+
+static bool known_layer(const char* name) {
+	static const char* names[] = {
+		"collisions", "killzones", "shops", "slopes", "entrances", "enemy_paths", "enemies",
+		"transition_triggers", "doors", "save_points", "meta", "upgrade_pickups",
+		"dialogue_triggers", "entity_spawners", "lava", "lights"
+	};
+
+	for (u32 i = 0; i < sizeof(names) / sizeof(*names); i++) {
+		if (strcmp(name, names[i]) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void add_layer(struct room_cooker* cooker, const struct map_layer* layer) {
+	const char* name = map_string(&cooker->map, layer->name);
+
+	if (layer->type == layer_tiles) {
+		if (strcmp(name, "forground") == 0) {
+			cooker->header.forground_index = cooker->tile_layer_count;
+		}
+
+		cooker->tile_layer_count++;
+		return;
+	}
+
+	if (layer->type != layer_objects || !map_range_ok(layer->objects, cooker->map.header->objects)) {
+		return;
+	}
+
+	if (!known_layer(name)) {
+		fprintf(stderr, "Warning: Unknown object layer type `%s'\n", name);
+		return;
+	}
+
+	for (u32 i = 0; i < layer->objects.count; i++) {
+		add_object(cooker, name, cooker->map.objects + layer->objects.first + i);
+	}
+}
+
+static i32 entrance_cmp(const void* a, const void* b) {
+	u64 ha = ((const struct room_entrance*)a)->hash;
+	u64 hb = ((const struct room_entrance*)b)->hash;
+
+	return ha < hb ? -1 : ha > hb;
+}
+
+static i32 path_cmp(const void* a, const void* b) {
+	u64 ha = ((const struct room_path*)a)->hash;
+	u64 hb = ((const struct room_path*)b)->hash;
+
+	return ha < hb ? -1 : ha > hb;
+}
+
+static void place_table(struct map_table* table, u64* offset, u32 count, u64 element_size, u64 alignment) {
+	*offset = (*offset + alignment - 1) & ~(alignment - 1);
+
+	table->offset = (u32)*offset;
+	table->count = count;
+
+	*offset += (u64)count * element_size;
+}
+
+#define place_vector(header_, offset_, name_, alignment_) \
+	place_table(&(header_)->name_, (offset_), vector_count(cooker.name_), sizeof(*cooker.name_), (alignment_))
+
+#define copy_vector(data_, header_, name_) \
+	do { \
+		if (cooker.name_) { \
+			memcpy((data_) + (header_)->name_.offset, cooker.name_, (header_)->name_.count * sizeof(*cooker.name_)); \
+		} \
+	} while (0)
+
+u8* cook_room(const u8* map_data, u64 map_size, u64* size) {
+	struct room_cooker cooker = { 0 };
+
+	if (!open_map_view(&cooker.map, map_data, map_size)) {
+		fprintf(stderr, "Failed to cook room; The map is not a version %d map.\n", map_version);
+		return null;
+	}
+
+	/* Offset zero is the empty string. */
+	cooker.strings = core_calloc(1, 1);
+	cooker.string_size = 1;
+
+	struct room_blob_header* header = &cooker.header;
+
+	memcpy(header->magic, room_blob_magic, sizeof(header->magic));
+	header->version = room_blob_version;
+
+	struct map_range map_properties = cooker.map.header->map_properties;
+
+	header->name = string_property(&cooker, map_properties, "name");
+
+	const struct map_property* dark = map_find_property(&cooker.map, map_properties, "dark");
+	if (dark && dark->type == prop_bool && dark->as.boolean) {
+		header->flags |= room_flag_dark;
+	}
+
+	for (u32 i = 0; i < cooker.map.header->layers.count; i++) {
+		add_layer(&cooker, cooker.map.layers + i);
+	}
+
+	if (cooker.entrances) {
+		qsort(cooker.entrances, vector_count(cooker.entrances), sizeof(*cooker.entrances), entrance_cmp);
+	}
+
+	if (cooker.paths) {
+		qsort(cooker.paths, vector_count(cooker.paths), sizeof(*cooker.paths), path_cmp);
+	}
+
+	/* The tables with 64-bit members go first, so that less padding
+	 * is needed. */
+	u64 offset = sizeof(struct room_blob_header);
+	place_vector(header, &offset, entrances,           sizeof(u64));
+	place_vector(header, &offset, paths,               sizeof(u64));
+	place_vector(header, &offset, spawns,              sizeof(u64));
+	place_vector(header, &offset, box_colliders,       sizeof(u32));
+	place_vector(header, &offset, killzones,           sizeof(u32));
+	place_vector(header, &offset, shops,               sizeof(u32));
+	place_vector(header, &offset, slopes,              sizeof(u32));
+	place_vector(header, &offset, transition_triggers, sizeof(u32));
+	place_vector(header, &offset, doors,               sizeof(u32));
+	place_vector(header, &offset, dialogue,            sizeof(u32));
+	place_vector(header, &offset, points,              sizeof(u32));
+	place_table(&header->strings, &offset, cooker.string_size, 1, 1);
+
+	u8* data = core_calloc(1, offset);
+	*size = offset;
+
+	memcpy(data, header, sizeof(*header));
+	copy_vector(data, header, entrances);
+	copy_vector(data, header, paths);
+	copy_vector(data, header, spawns);
+	copy_vector(data, header, box_colliders);
+	copy_vector(data, header, killzones);
+	copy_vector(data, header, shops);
+	copy_vector(data, header, slopes);
+	copy_vector(data, header, transition_triggers);
+	copy_vector(data, header, doors);
+	copy_vector(data, header, dialogue);
+	copy_vector(data, header, points);
+	memcpy(data + header->strings.offset, cooker.strings, cooker.string_size);
+
+	free_vector(cooker.entrances);
+	free_vector(cooker.paths);
+	free_vector(cooker.spawns);
+	free_vector(cooker.box_colliders);
+	free_vector(cooker.killzones);
+	free_vector(cooker.shops);
+	free_vector(cooker.slopes);
+	free_vector(cooker.transition_triggers);
+	free_vector(cooker.doors);
+	free_vector(cooker.dialogue);
+	free_vector(cooker.points);
+	core_free(cooker.strings);
+
+	return data;
+}
+
+static bool check_table(struct map_table table, u64 size, u64 element_size, u64 alignment) {
+	return table.offset % alignment == 0 && table.offset <= size &&
+		(u64)table.count * element_size <= size - table.offset;
+}
+
+#define check_blob_table(name_, alignment_) \
+	check_table(header->name_, size, sizeof(*blob->name_), (alignment_))
+
+#define blob_table_ptr(name_) ((const void*)(data + header->name_.offset))
+
+bool open_room_blob(struct room_blob* blob, const u8* data, u64 size) {
+	*blob = (struct room_blob) { 0 };
+
+	if (size < sizeof(struct room_blob_header) || (uintptr_t)data % sizeof(u64) != 0) {
+		return false;
+	}
+
+	const struct room_blob_header* header = (const struct room_blob_header*)data;
+
+	if (memcmp(header->magic, room_blob_magic, sizeof(header->magic)) != 0 || header->version != room_blob_version) {
+		return false;
+	}
+
+	bool ok =
+		check_blob_table(box_colliders,       sizeof(u32)) &&
+		check_blob_table(killzones,           sizeof(u32)) &&
+		check_blob_table(shops,               sizeof(u32)) &&
+		check_blob_table(slopes,              sizeof(u32)) &&
+		check_blob_table(transition_triggers, sizeof(u32)) &&
+		check_blob_table(doors,               sizeof(u32)) &&
+		check_blob_table(dialogue,            sizeof(u32)) &&
+		check_blob_table(entrances,           sizeof(u64)) &&
+		check_blob_table(paths,               sizeof(u64)) &&
+		check_blob_table(points,              sizeof(u32)) &&
+		check_blob_table(spawns,              sizeof(u64)) &&
+		check_table(header->strings, size, 1, 1);
+
+	if (!ok || header->strings.count == 0 || data[header->strings.offset + header->strings.count - 1] != '\0') {
+		return false;
+	}
+
+	blob->header = header;
+	blob->box_colliders       = blob_table_ptr(box_colliders);
+	blob->killzones           = blob_table_ptr(killzones);
+	blob->shops               = blob_table_ptr(shops);
+	blob->slopes              = blob_table_ptr(slopes);
+	blob->transition_triggers = blob_table_ptr(transition_triggers);
+	blob->doors               = blob_table_ptr(doors);
+	blob->dialogue            = blob_table_ptr(dialogue);
+	blob->entrances           = blob_table_ptr(entrances);
+	blob->paths               = blob_table_ptr(paths);
+	blob->points              = blob_table_ptr(points);
+	blob->spawns              = blob_table_ptr(spawns);
+	blob->strings             = blob_table_ptr(strings);
+
+	/* Paths are used without being checked again. */
+	for (u32 i = 0; i < header->paths.count; i++) {
+		if (!map_range_ok(blob->paths[i].points, header->points)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+const char* room_blob_string(const struct room_blob* blob, u32 offset) {
+	if (offset == 0 || offset >= blob->header->strings.count) { return null; }
+
+	return blob->strings + offset;
+}
+
+#define find_named(blob_, table_, name_) \
+	do { \
+		u64 hash_ = hash_name(name_); \
+		u32 low_ = 0, high_ = (blob_)->header->table_.count; \
+		\
+		while (low_ < high_) { \
+			u32 mid_ = low_ + (high_ - low_) / 2; \
+			\
+			if ((blob_)->table_[mid_].hash < hash_) { \
+				low_ = mid_ + 1; \
+			} else if ((blob_)->table_[mid_].hash > hash_) { \
+				high_ = mid_; \
+			} else { \
+				const char* found_ = room_blob_string((blob_), (blob_)->table_[mid_].name); \
+				return found_ && strcmp(found_, (name_)) == 0 ? (blob_)->table_ + mid_ : null; \
+			} \
+		} \
+		\
+		return null; \
+	} while (0)
+
+const struct room_entrance* room_blob_find_entrance(const struct room_blob* blob, const char* name) {
+	find_named(blob, entrances, name);
+}
+
+const struct room_path* room_blob_find_path(const struct room_blob* blob, const char* name) {
+	find_named(blob, paths, name);
+}
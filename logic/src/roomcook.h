@@ -0,0 +1,166 @@
+#pragma once
+
+/* Rooms are cooked from their maps into a blob of arrays that
+ * load_room can use as they are, instead of going through every
+ * object layer of the map when the room is loaded. Everything is
+ * already scaled by sprite_scale, slopes are already ordered and have
+ * their line equations worked out, and the names of layers, enemies,
+ * upgrades and the like are already resolved.
+ *
+ * The packer cooks the blob of every map, and stores it at the path
+ * of the map followed by room_blob_ext. In debug, maps aren't cooked,
+ * so the blob is cooked from the map when the room is loaded.
+ *
+ * Like a map (see `tiled.h'), a blob starts with a header that gives
+ * the offset and count of every table, and records refer to strings
+ * by their offset into a pool at the end. Offset zero is the empty
+ * string, which stands for a string that the map doesn't have. */
+
+#include "common.h"
+#include "tiled.h"
+#include "video.h"
+
+#define room_blob_ext ".room"
+#define room_blob_magic "OMVR"
+#define room_blob_version 1
+
+enum {
+	room_flag_dark = 1 << 0
+};
+
+/* What load_room makes an entity for. */
+enum {
+	room_prefab_bat = 0,
+	room_prefab_spider,
+	room_prefab_drill,
+	room_prefab_scav,
+	room_prefab_save_point,
+	room_prefab_jetpack,
+	room_prefab_health_pack,
+	room_prefab_health_booster,
+	room_prefab_entity_spawner,
+	room_prefab_lava,
+	room_prefab_light
+};
+
+struct room_blob_header {
+	char magic[4];
+	u32 version;
+
+	u32 flags;
+	u32 name;
+
+	/* Among the tile layers. */
+	u32 forground_index;
+
+	struct rect camera_bounds;
+
+	struct map_table box_colliders;
+	struct map_table killzones;
+	struct map_table shops;
+	struct map_table slopes;
+	struct map_table transition_triggers;
+	struct map_table doors;
+	struct map_table dialogue;
+	struct map_table entrances;
+	struct map_table paths;
+	struct map_table points;
+	struct map_table spawns;
+
+	/* The count is the size of the pool in bytes. */
+	struct map_table strings;
+};
+
+struct room_slope {
+	/* `start' is always above `end', or to the left of it if the
+	 * slope is flat. */
+	v2i start, end;
+
+	/* y = slope * x + b, for slopes that aren't flat. */
+	f32 slope, b;
+};
+
+/* Transition triggers and doors. */
+struct room_trigger {
+	struct rect rect;
+	u32 change_to;
+	u32 entrance;
+};
+
+struct room_dialogue {
+	struct rect rect;
+	u32 on_play;
+	u32 on_next;
+};
+
+/* Entrances and paths are sorted by the hash of their name, so that
+ * they can be binary searched. */
+struct room_entrance {
+	u64 hash;
+	u32 name;
+	v2i position;
+};
+
+struct room_path {
+	u64 hash;
+	u32 name;
+
+	/* Into the point table. */
+	struct map_range points;
+};
+
+struct room_spawn {
+	u32 prefab;
+
+	/* Points have no size. */
+	struct f32_rect rect;
+
+	union {
+		struct {
+			u32 path;
+		} enemy;
+
+		struct {
+			i32 id;
+			u32 prefix;
+			u32 name;
+		} upgrade;
+
+		struct {
+			u32 type;
+			f64 min_increment;
+			f64 max_increment;
+		} spawner;
+	} as;
+};
+
+/* The tables of a blob, once they have been checked to be within it.
+ * Like open_map_view, `data' must be aligned to 8 bytes. */
+struct room_blob {
+	const struct room_blob_header* header;
+
+	const struct rect* box_colliders;
+	const struct rect* killzones;
+	const struct rect* shops;
+	const struct room_slope* slopes;
+	const struct room_trigger* transition_triggers;
+	const struct room_trigger* doors;
+	const struct room_dialogue* dialogue;
+	const struct room_entrance* entrances;
+	const struct room_path* paths;
+	const v2f* points;
+	const struct room_spawn* spawns;
+	const char* strings;
+};
+
+/* Returns null, after printing why, if the map can't be read. */
+u8* cook_room(const u8* map_data, u64 map_size, u64* size);
+
+bool open_room_blob(struct room_blob* blob, const u8* data, u64 size);
+
+/* Returns null for offset zero, or one that is out of the pool. */
+const char* room_blob_string(const struct room_blob* blob, u32 offset);
+
+/* Return null if there is nothing with the name. */
+const struct room_entrance* room_blob_find_entrance(const struct room_blob* blob, const char* name);
+const struct room_path* room_blob_find_path(const struct room_blob* blob, const char* name);
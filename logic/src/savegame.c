@@ -194,6 +194,7 @@ void loadgame() {
 	if (logic_store->room) {
 		free_room(logic_store->room);
 	}
+	flush_room_cache();
 	logic_store->room = load_room(world, room_path);
 	core_free(room_path);
 
@@ -1,3 +1,6 @@
+#include <string.h>
+
+#include "logic_store.h"
 #include "res.h"
 #include "sprites.h"
 
@@ -451,12 +454,36 @@ struct animated_sprite anim_sprites[] = {
 };
 
 void preload_sprites() {
+	/* Start decoding everything at once, so that the lookups below
+	 * only have to wait for the slowest texture rather than all of
+	 * them. The references from before a reload are only given back
+	 * once the new ones are held, so that the textures are never left
+	 * unreferenced, and can't be evicted in between. */
+	struct res* textures[texid_count] = { 0 };
+	for (u32 i = 0; i < texid_count; i++) {
+		if (texture_paths[i]) {
+			textures[i] = res_load_async(texture_paths[i], res_texture, sprite_texture);
+		}
+	}
+
+	release_sprites();
+	memcpy(logic_store->sprite_textures, textures, sizeof(textures));
+
 	for (u32 i = 0; i < sizeof(sprites) / sizeof(*sprites); i++) {
-		sprites[i].texture = load_texture(texture_paths[(u64)sprites[i].texture], sprite_texture);
+		sprites[i].texture = res_get_texture(logic_store->sprite_textures[(u64)sprites[i].texture]);
 	}
 
 	for (u32 i = 0; i < sizeof(anim_sprites) / sizeof(*anim_sprites); i++) {
-		anim_sprites[i].texture = load_texture(texture_paths[(u64)anim_sprites[i].texture], sprite_texture);
+		anim_sprites[i].texture = res_get_texture(logic_store->sprite_textures[(u64)anim_sprites[i].texture]);
+	}
+}
+
+void release_sprites() {
+	for (u32 i = 0; i < texid_count; i++) {
+		if (logic_store->sprite_textures[i]) {
+			res_release(logic_store->sprite_textures[i]);
+			logic_store->sprite_textures[i] = null;
+		}
 	}
 }
 
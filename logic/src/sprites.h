@@ -14,7 +14,8 @@ enum {
 	texid_icon,
 	texid_arms,
 	texid_bad,
-	texid_back
+	texid_back,
+	texid_count
 };
 
 /* Sprite IDs  */
@@ -69,6 +70,7 @@ enum {
 };
 
 void preload_sprites();
+void release_sprites();
 struct sprite get_sprite(u32 id);
 struct animated_sprite get_animated_sprite(u32 id);
 struct texture* get_texture(u32 id);
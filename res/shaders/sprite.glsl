@@ -5,9 +5,10 @@
 layout (location = 0) in vec2 position;
 layout (location = 1) in vec2 uv;
 layout (location = 2) in vec4 color;
-layout (location = 3) in float texture_id;
-layout (location = 4) in float inverted;
-layout (location = 5) in float unlit;
+
+/* The texture slot in the low byte (255 for none), then a bit each for
+ * inverted and unlit. See `struct quad_vertex' in video.h. */
+layout (location = 3) in uint flags;
 
 uniform mat4 camera = mat4(1.0);
 uniform mat4 view = mat4(1.0);
@@ -16,17 +17,17 @@ out VS_OUT {
 	vec2 frag_pos;
 	vec4 color;
 	vec2 uv;
-	float texture_id;
-	float inverted;
-	float unlit;
+	flat int texture_id;
+	flat int inverted;
+	flat int unlit;
 } vs_out;
 
 void main() {
 	vs_out.color = color;
 	vs_out.uv = uv;
-	vs_out.texture_id = texture_id;
-	vs_out.inverted = inverted;
-	vs_out.unlit = unlit;
+	vs_out.texture_id = int(flags & 0xffu);
+	vs_out.inverted = int((flags >> 8) & 1u);
+	vs_out.unlit = int((flags >> 9) & 1u);
 
 	vs_out.frag_pos = vec4(position, 0.0, 1.0).xy;
 
@@ -45,9 +46,9 @@ in VS_OUT {
 	vec2 frag_pos;
 	vec4 color;
 	vec2 uv;
-	float texture_id;
-	float inverted;
-	float unlit;
+	flat int texture_id;
+	flat int inverted;
+	flat int unlit;
 } fs_in;
 
 struct light {
@@ -66,7 +67,7 @@ uniform int light_count;
 void main() {
 	vec4 texture_color = vec4(1.0);
 
-	switch (int(fs_in.texture_id)) {
+	switch (fs_in.texture_id) {
 	case 0:  texture_color = texture(textures[0],  fs_in.uv); break;
 	case 1:  texture_color = texture(textures[1],  fs_in.uv); break;
 	case 2:  texture_color = texture(textures[2],  fs_in.uv); break;
@@ -102,12 +103,12 @@ void main() {
 	default: texture_color = vec4(1.0); break;
 	}
 
-	if ((int(fs_in.inverted)) == 1) {
+	if (fs_in.inverted == 1) {
 		texture_color = vec4(1.0 - texture_color.rgb, texture_color.a);
 	}
 
 	float lighting_result = 1.0;
-	if ((int(fs_in.unlit)) == 0 && ambient_light != 1.0) {
+	if (fs_in.unlit == 0 && ambient_light != 1.0) {
 		lighting_result = ambient_light;
 
 		for (int i = 0; i < light_count; i++) {
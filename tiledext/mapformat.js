@@ -1,55 +1,34 @@
-function write_i16(val, file) {
-	var buf = new ArrayBuffer(2);
-	var view = new Int16Array(buf);
-	view[0] = val;
-	file.write(buf);
-}
-
-function write_i32(val, file) {
-	var buf = new ArrayBuffer(4);
-	var view = new Int32Array(buf);
-	view[0] = val;
-	file.write(buf);
-}
-
-function write_u32(val, file) {
-	var buf = new ArrayBuffer(4);
-	var view = new Uint32Array(buf);
-	view[0] = val;
-	file.write(buf);
-}
-
-function write_f32(val, file) {
-	var buf = new ArrayBuffer(4);
-	var view = new Float32Array(buf);
-	view[0] = val;
-	file.write(buf);
-}
-
-function write_f64(val, file) {
-	var buf = new ArrayBuffer(8);
-	var view = new Float64Array(buf);
-	view[0] = val;
-	file.write(buf);
-}
-
-function write_bool(val, file) {
-	var buf = new ArrayBuffer(1);
-	var view = new Int8Array(buf);
-	view[0] = val;
-	file.write(buf);
-}
-
-function write_str(string, file) {
-	write_u32(string.length, file);
-
-	var string_buf = new ArrayBuffer(string.length);
-	var string_view = new Uint8Array(string_buf);
-	for (var i = 0; i < string.length; i++) {
-		string_view[i] = string.charCodeAt(i);
-	}
-	file.write(string_buf);
-}
+/* Writes maps in the OpenMV binary format, as described in
+ * `core/src/tiled.h'.
+ *
+ * The map is written in two passes. The first collects every record
+ * into the table it belongs in, and every string into the string pool.
+ * The second lays the tables out one after the other, each aligned to
+ * its largest member, and writes them into a single buffer. */
+
+var map_version = 2;
+
+var header_size = 80;
+var property_size = 16;
+var tileset_size = 28;
+var animation_size = 12;
+var frame_size = 8;
+var layer_size = 36;
+var object_size = 44;
+var point_size = 8;
+var tile_size = 4;
+
+var prop_bool = 0;
+var prop_number = 1;
+var prop_string = 2;
+
+var layer_unknown = -1;
+var layer_tiles = 0;
+var layer_objects = 1;
+
+var object_shape_rect = 0;
+var object_shape_point = 1;
+var object_shape_polygon = 2;
 
 function get_local_fp(fp) {
 	return fp.substring(
@@ -57,73 +36,166 @@ function get_local_fp(fp) {
 		fp.length);
 }
 
-/* Recurses the layers inside groups. */
-function count_layers(map) {
-	var count = 0;
+function align(offset, alignment) {
+	return Math.ceil(offset / alignment) * alignment;
+}
 
-	for (var i = 0; i < map.layerCount; i++) {
-		var layer = map.layerAt(i);
+function new_tables() {
+	return {
+		properties: [],
+		tilesets: [],
+		animations: [],
+		frames: [],
+		layers: [],
+		objects: [],
+		points: [],
+
+		/* One array of tiles for each tile layer. */
+		tile_arrays: [],
+
+		strings: [],
+		string_offsets: {},
+		string_size: 0
+	};
+}
 
-		if (layer.isGroupLayer) {
-			count += count_layers(layer);
-		}
+/* Returns the offset of a string in the pool, adding it if it isn't
+ * there already. */
+function add_string(tables, string) {
+	if (string === undefined || string === null) {
+		string = "";
 	}
 
-	count += map.layerCount;
+	if (Object.prototype.hasOwnProperty.call(tables.string_offsets, string)) {
+		return tables.string_offsets[string];
+	}
 
-	return count;
-}
+	var offset = tables.string_size;
 
-function write_properties(obj, file) {
-	var prop_count = 0;
-	for (const prop of Object.entries(obj.resolvedProperties())) {
-		prop_count++;
-	}
+	tables.strings.push(string);
+	tables.string_offsets[string] = offset;
+	tables.string_size += string.length + 1;
+
+	return offset;
+}
 
-	write_u32(prop_count, file);
+/* Returns the range of the properties in the property table. */
+function add_properties(tables, obj) {
+	var first = tables.properties.length;
 
 	for (const prop of Object.entries(obj.resolvedProperties())) {
-		write_str(prop[0], file);
+		var record = { name: add_string(tables, prop[0]), type: -1, value: 0 };
 
 		switch (typeof prop[1]) {
 			case "number":
-				write_i32(1, file);
-				write_f64(prop[1], file);
+				record.type = prop_number;
+				record.value = prop[1];
 				break;
 			case "string":
-				write_i32(2, file);
-				write_str(prop[1], file);
+				record.type = prop_string;
+				record.value = add_string(tables, prop[1]);
 				break;
 			case "boolean":
-				write_i32(0, file);
-				write_bool(prop[1], file);
+				record.type = prop_bool;
+				record.value = prop[1] ? 1 : 0;
 				break;
 			default:
-				write_i32(-1, file);
 				console.error("Property type not supported.");
 				break;
 		}
+
+		tables.properties.push(record);
+	}
+
+	return { first: first, count: tables.properties.length - first };
+}
+
+function add_tileset(tables, tileset) {
+	var record = {
+		name: add_string(tables, tileset.name),
+		image: add_string(tables, get_local_fp(tileset.image)),
+		tile_count: tileset.tileCount,
+		tile_w: tileset.tileWidth,
+		tile_h: tileset.tileHeight,
+		animations: { first: tables.animations.length, count: 0 }
+	};
+
+	for (var i = 0; i < tileset.tiles.length; i++) {
+		var tile = tileset.tiles[i];
+		if (tile == null || !tile.animated) { continue; }
+
+		var animation = {
+			tile_id: tile.id,
+			frames: { first: tables.frames.length, count: tile.frames.length }
+		};
+
+		for (var ii = 0; ii < tile.frames.length; ii++) {
+			tables.frames.push({ tile_id: tile.frames[ii].tileId, duration: tile.frames[ii].duration });
+		}
+
+		tables.animations.push(animation);
 	}
+
+	record.animations.count = tables.animations.length - record.animations.first;
+
+	tables.tilesets.push(record);
 }
 
-function write_layer(tilesets, layer, file) {
+function add_object(tables, obj) {
+	var record = {
+		name: add_string(tables, obj.name),
+		type: add_string(tables, obj.type),
+		shape: object_shape_rect,
+		properties: add_properties(tables, obj),
+		x: obj.x, y: obj.y, w: 0, h: 0,
+		points: { first: 0, count: 0 }
+	};
+
+	if (obj.shape == MapObject.Polygon || obj.shape == MapObject.Polyline) {
+		record.shape = object_shape_polygon;
+		record.x = 0;
+		record.y = 0;
+		record.points = { first: tables.points.length, count: obj.polygon.length };
+
+		for (var point of obj.polygon) {
+			tables.points.push({ x: obj.x + point.x, y: obj.y + point.y });
+		}
+	} else if (obj.shape == MapObject.Point) {
+		record.shape = object_shape_point;
+	} else {
+		record.w = obj.width;
+		record.h = obj.height;
+	}
+
+	tables.objects.push(record);
+}
+
+/* Group layers are flattened into the layers they contain. */
+function add_layer(tables, tilesets, layer) {
 	if (layer.isGroupLayer) {
 		for (var i = 0; i < layer.layerCount; i++) {
-			write_layer(tilesets, layer.layerAt(i), file);
+			add_layer(tables, tilesets, layer.layerAt(i));
 		}
 
 		return;
 	}
 
-	write_str(layer.name, file);
-
-	write_properties(layer, file);
+	var record = {
+		name: add_string(tables, layer.name),
+		type: layer_unknown,
+		properties: add_properties(tables, layer),
+		w: 0, h: 0,
+		tile_array: -1,
+		objects: { first: 0, count: 0 }
+	};
 
 	if (layer.isTileLayer) {
-		write_i32(0, file);
+		record.type = layer_tiles;
+		record.w = layer.width;
+		record.h = layer.height;
+		record.tile_array = tables.tile_arrays.length;
 
-		write_u32(layer.width, file);
-		write_u32(layer.height, file);
+		var tiles = [];
 
 		for (var y = 0; y < layer.height; y++) {
 			for (var x = 0; x < layer.width; x++) {
@@ -143,107 +215,198 @@ function write_layer(tilesets, layer, file) {
 					}
 				}
 
-				write_i16(tile_id, file);
-				write_i16(tileset_id, file);
+				tiles.push({ id: tile_id, tileset_id: tileset_id });
 			}
 		}
-	} else if (layer.isObjectLayer) {
-		write_i32(1, file);
 
-		write_u32(layer.objectCount, file);
+		tables.tile_arrays.push(tiles);
+	} else if (layer.isObjectLayer) {
+		record.type = layer_objects;
 
+		var first = tables.objects.length;
 		for (var obj of layer.objects) {
-			write_properties(obj, file);
-
-			write_str(obj.name, file);
-			write_str(obj.type, file);
-
-			if (obj.shape == MapObject.Polygon || obj.shape == MapObject.Polyline) {
-				write_i32(2, file);
-				write_u32(obj.polygon.length, file);
-				for (var point of obj.polygon) {
-					write_f32(obj.x + point.x, file);
-					write_f32(obj.y + point.y, file);
-				}
-			} else if (obj.shape == MapObject.Point) {
-				write_i32(1, file);
-				write_f32(obj.x, file);
-				write_f32(obj.y, file);
-			} else {
-				write_i32(0, file);
-				write_f32(obj.x, file);
-				write_f32(obj.y, file);
-				write_f32(obj.width, file);
-				write_f32(obj.height, file);
-			}
+			add_object(tables, obj);
 		}
-	} else {
-		write_i32(-1, file);
+
+		record.objects = { first: first, count: tables.objects.length - first };
 	}
+
+	tables.layers.push(record);
 }
 
-var dat_format = {
-	name: "OpenMV",
-	extension: "dat",
+/* Works out where every table goes. The tile arrays go after the
+ * fixed size tables, and the string pool goes last. */
+function lay_out(tables) {
+	var layout = {};
+	var offset = header_size;
 
-	write:function(map, filename) {
-		var file = new BinaryFile(filename, BinaryFile.WriteOnly);
+	function place(name, count, size, alignment) {
+		offset = align(offset, alignment);
+		layout[name] = { offset: offset, count: count };
+		offset += count * size;
+	}
 
-		write_properties(map, file);
+	place("properties", tables.properties.length, property_size, 8);
+	place("tilesets",   tables.tilesets.length,   tileset_size,   4);
+	place("animations", tables.animations.length, animation_size, 4);
+	place("frames",     tables.frames.length,     frame_size,     4);
+	place("layers",     tables.layers.length,     layer_size,     4);
+	place("objects",    tables.objects.length,    object_size,    4);
+	place("points",     tables.points.length,     point_size,     4);
+
+	layout.tile_arrays = [];
+	for (var i = 0; i < tables.tile_arrays.length; i++) {
+		offset = align(offset, 4);
+		layout.tile_arrays.push(offset);
+		offset += tables.tile_arrays[i].length * tile_size;
+	}
 
-		var tilesets = map.usedTilesets();
+	place("strings", tables.string_size, 1, 1);
 
-		/* Write the amount of tilesets. */
-		write_u32(tilesets.length, file);
+	layout.size = offset;
 
-		/* Write the tilesets */
-		for (var i = 0; i < tilesets.length; i++) {
-			var tileset = tilesets[i];
+	return layout;
+}
 
-			write_str(tileset.name, file);
+function serialise(tables, layout, map_properties) {
+	var buffer = new ArrayBuffer(layout.size);
+	var view = new DataView(buffer);
+	var cursor = 0;
+
+	function u32(val) { view.setUint32(cursor, val, true); cursor += 4; }
+	function i32(val) { view.setInt32(cursor, val, true); cursor += 4; }
+	function i16(val) { view.setInt16(cursor, val, true); cursor += 2; }
+	function f32(val) { view.setFloat32(cursor, val, true); cursor += 4; }
+	function f64(val) { view.setFloat64(cursor, val, true); cursor += 8; }
+	function range(r) { u32(r.first); u32(r.count); }
+	function table(t) { u32(t.offset); u32(t.count); }
+
+	/* Header. */
+	for (var i = 0; i < 4; i++) {
+		view.setUint8(cursor++, "OMVD".charCodeAt(i));
+	}
+	u32(map_version);
+
+	table(layout.properties);
+	table(layout.tilesets);
+	table(layout.animations);
+	table(layout.frames);
+	table(layout.layers);
+	table(layout.objects);
+	table(layout.points);
+	table(layout.strings);
+	range(map_properties);
+
+	cursor = layout.properties.offset;
+	for (var prop of tables.properties) {
+		u32(prop.name);
+		i32(prop.type);
+
+		if (prop.type == prop_number) {
+			f64(prop.value);
+		} else {
+			u32(prop.value);
+			u32(0);
+		}
+	}
 
-			var image_path = get_local_fp(tileset.image);
-			write_str(image_path, file);
+	cursor = layout.tilesets.offset;
+	for (var tileset of tables.tilesets) {
+		u32(tileset.name);
+		u32(tileset.image);
+		u32(tileset.tile_count);
+		u32(tileset.tile_w);
+		u32(tileset.tile_h);
+		range(tileset.animations);
+	}
 
-			write_u32(tileset.tileCount, file);
-			write_u32(tileset.tileWidth, file);
-			write_u32(tileset.tileHeight, file);
+	cursor = layout.animations.offset;
+	for (var animation of tables.animations) {
+		u32(animation.tile_id);
+		range(animation.frames);
+	}
 
-			var animation_count = 0;
-			for (var ii = 0; ii < tileset.tiles.length; ii++) {
-				var tile = tileset.tiles[ii];
+	cursor = layout.frames.offset;
+	for (var frame of tables.frames) {
+		i32(frame.tile_id);
+		i32(frame.duration);
+	}
 
-				if (tile.animated) {
-					animation_count++;
-				}
-			}
+	cursor = layout.layers.offset;
+	for (var layer of tables.layers) {
+		u32(layer.name);
+		i32(layer.type);
+		range(layer.properties);
+		u32(layer.w);
+		u32(layer.h);
+		u32(layer.tile_array >= 0 ? layout.tile_arrays[layer.tile_array] : 0);
+		range(layer.objects);
+	}
 
-			write_u32(animation_count, file);
+	cursor = layout.objects.offset;
+	for (var obj of tables.objects) {
+		u32(obj.name);
+		u32(obj.type);
+		i32(obj.shape);
+		range(obj.properties);
+		f32(obj.x);
+		f32(obj.y);
+		f32(obj.w);
+		f32(obj.h);
+		range(obj.points);
+	}
 
-			for (var ii = 0; ii < tileset.tiles.length; ii++) {
-				var tile = tileset.tiles[ii];
-				if (tile == null) { continue; }
+	cursor = layout.points.offset;
+	for (var point of tables.points) {
+		f32(point.x);
+		f32(point.y);
+	}
 
-				if (tile.animated) {
-					write_u32(tile.frames.length, file);
-					write_u32(tile.id, file);
-				}
+	for (var i = 0; i < tables.tile_arrays.length; i++) {
+		cursor = layout.tile_arrays[i];
+		for (var tile of tables.tile_arrays[i]) {
+			i16(tile.id);
+			i16(tile.tileset_id);
+		}
+	}
 
-				for (var iii = 0; iii < tile.frames.length; iii++) {
-					write_u32(tile.frames[iii].tileId, file);
-					write_u32(tile.frames[iii].duration, file);
-				}
-			}
+	cursor = layout.strings.offset;
+	for (var string of tables.strings) {
+		for (var i = 0; i < string.length; i++) {
+			view.setUint8(cursor++, string.charCodeAt(i));
 		}
+		view.setUint8(cursor++, 0);
+	}
+
+	return buffer;
+}
+
+var dat_format = {
+	name: "OpenMV",
+	extension: "dat",
+
+	write:function(map, filename) {
+		var tables = new_tables();
+
+		/* The string pool is never empty, so that an offset of zero
+		 * is always the empty string. */
+		add_string(tables, "");
 
-		/* Write the layer count */
-		write_u32(count_layers(map), file);
+		var map_properties = add_properties(tables, map);
+
+		var tilesets = map.usedTilesets();
+		for (var i = 0; i < tilesets.length; i++) {
+			add_tileset(tables, tilesets[i]);
+		}
 
-		/* Write the layers */
 		for (var i = 0; i < map.layerCount; i++) {
-			write_layer(tilesets, map.layerAt(i), file);
+			add_layer(tables, tilesets, map.layerAt(i));
 		}
 
+		var layout = lay_out(tables);
+
+		var file = new BinaryFile(filename, BinaryFile.WriteOnly);
+		file.write(serialise(tables, layout, map_properties));
 		file.commit();
 	}
 }
@@ -11,11 +11,13 @@ project "packer"
 
 	files {
 		"src/packer.c",
+		"../../logic/src/roomcook.c"
 	}
 
 	includedirs {
 		"src",
-		"../../core/src"
+		"../../core/src",
+		"../../logic/src"
 	}
 
 	links {
@@ -1,17 +1,26 @@
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "util/stb_rect_pack.h"
+
 #include "common.h"
 #include "core.h"
 #include "imui.h"
+#include "jobs.h"
+#include "lz.h"
+#include "pack.h"
 #include "platform.h"
 #include "res.h"
+#include "roomcook.h"
+#include "table.h"
+#include "tiled.h"
+#include "vector.h"
 #include "video.h"
 
-#define buffer_size 1000000
-u8* buffer;
-
 #define max_files 1024
 char** files;
 u32 file_count;
@@ -27,71 +36,1248 @@ static void on_text_input(struct window* window, const char* text, void* udata)
 	ui_text_input_event(udata, text);
 }
 
-void pack_files_worker(struct thread* thread) {
-	lock_mutex(get_thread_uptr(thread));
-	i32* pack_progress = mutex_get_ptr(get_thread_uptr(thread));
+/* Entries are only stored compressed if it makes them at
+ * least this much smaller. */
+#define max_compression_ratio 0.9
 
-	*pack_progress = 0;
+struct pack_item {
+	char* path;
 
-	unlock_mutex(get_thread_uptr(thread));
+	/* The data as it will be stored in the package. */
+	u8* data;
 
-	FILE* out = fopen(pack_file_buffer, "wb");
-	if (!out) {
-		fprintf(stderr, "Failed to open `res.pck' for writing.\n");
+	/* Set if `data' points into the previous package, rather than
+	 * being owned by the item. */
+	bool borrowed;
+
+	struct pack_entry entry;
+};
+
+static i32 pack_item_cmp(const void* a, const void* b) {
+	u64 ha = ((struct pack_item*)a)->entry.hash;
+	u64 hb = ((struct pack_item*)b)->entry.hash;
+
+	return ha < hb ? -1 : ha > hb;
+}
+
+/* Takes ownership of `raw'. */
+static void make_pack_item(struct pack_item* item, const char* path, u8* raw, u64 size) {
+	item->path = copy_string(path);
+	item->entry = (struct pack_entry) {
+		.hash = pack_hash(path),
+		.raw_size = size,
+		.checksum = pack_checksum(raw, size)
+	};
+
+	u64 bound = lz_compress_bound(size);
+	u8* compressed = core_alloc(bound);
+	u64 compressed_size = lz_compress(raw, size, compressed, bound);
+
+	if (compressed_size > 0 && (f64)compressed_size < (f64)size * max_compression_ratio) {
+		item->data = compressed;
+		item->entry.size = compressed_size;
+		item->entry.flags |= pack_entry_compressed;
+
+		core_free(raw);
+	} else {
+		item->data = raw;
+		item->entry.size = size;
+
+		core_free(compressed);
+	}
+}
+
+/* Lines in `packed.include' are a path, optionally followed by
+ * options that are separated by spaces. */
+static void line_path(const char* line, char* path, u64 path_size) {
+	u64 len = 0;
+	while (line[len] && line[len] != ' ' && len < path_size - 1) {
+		len++;
+	}
+
+	memcpy(path, line, len);
+	path[len] = '\0';
+}
+
+static bool line_has_option(const char* line, const char* option) {
+	u64 option_len = strlen(option);
+
+	const char* cur = strchr(line, ' ');
+	while (cur) {
+		cur++;
+
+		if (strncmp(cur, option, option_len) == 0 && (cur[option_len] == ' ' || cur[option_len] == '\0')) {
+			return true;
+		}
+
+		cur = strchr(cur, ' ');
+	}
+
+	return false;
+}
+
+/* Pixels are left empty around every image in an atlas, so that
+ * neighbouring images can't bleed into each other. */
+#define atlas_padding 1
+
+struct atlas_image {
+	char* path;
+	struct image image;
+	struct pack_atlas_region region;
+};
+
+static i32 region_cmp(const void* a, const void* b) {
+	u64 ha = ((struct pack_atlas_region*)a)->hash;
+	u64 hb = ((struct pack_atlas_region*)b)->hash;
+
+	return ha < hb ? -1 : ha > hb;
+}
+
+/* Convert an RGB image to RGBA, so that every cooked texture has
+ * the same format. */
+static void expand_to_rgba(struct image* image) {
+	if (!(image->flags & texture_rgb)) { return; }
+
+	u64 pixel_count = (u64)image->width * image->height;
+
+	u8* pixels = core_alloc(pixel_count * 4);
+	for (u64 i = 0; i < pixel_count; i++) {
+		pixels[i * 4 + 0] = image->pixels[i * 3 + 0];
+		pixels[i * 4 + 1] = image->pixels[i * 3 + 1];
+		pixels[i * 4 + 2] = image->pixels[i * 3 + 2];
+		pixels[i * 4 + 3] = 255;
+	}
+
+	core_free(image->pixels);
+	image->pixels = pixels;
+	image->flags = (image->flags & ~texture_rgb) | texture_rgba;
+}
+
+static u8* cook_texture(const u8* pixels, u32 w, u32 h, u64* size) {
+	struct pack_texture header = {
+		.magic = pack_texture_magic,
+		.width = w,
+		.height = h
+	};
+
+	u64 pixels_size = (u64)w * h * 4;
+	*size = sizeof(header) + pixels_size;
+
+	u8* cooked = core_alloc(*size);
+	memcpy(cooked, &header, sizeof(header));
+	memcpy(cooked + sizeof(header), pixels, pixels_size);
+
+	return cooked;
+}
+
+/* The cook functions take ownership of `raw'. */
+static bool cook_texture_item(struct pack_item* item, const char* path, u8* raw, u64 size) {
+	struct image image;
+	if (!decode_bitmap(&image, raw, size, 0)) {
+		core_free(raw);
+		return false;
+	}
+
+	if (image.flags & texture_mono) {
+		deinit_image(&image);
+		make_pack_item(item, path, raw, size);
+		return true;
+	}
+
+	core_free(raw);
+
+	expand_to_rgba(&image);
+
+	u64 cooked_size;
+	u8* cooked = cook_texture(image.pixels, image.width, image.height, &cooked_size);
+	make_pack_item(item, path, cooked, cooked_size);
+
+	deinit_image(&image);
+
+	return true;
+}
+
+/* Resolve the includes of a shader and split it into its stages, so
+ * that none of that has to be done at runtime. */
+static bool cook_shader_item(struct pack_item* item, const char* path, u8* raw, u64 size) {
+	char* source = core_realloc(raw, size + 1);
+	source[size] = '\0';
+
+	struct shader_stages stages;
+	split_shader(&stages, resolve_shader_includes(source, path, true));
+
+	if (!stages.sources[shader_vertex] || !stages.sources[shader_fragment]) {
+		fprintf(stderr, "`%s' needs both a vertex and a fragment stage.\n", path);
+		deinit_shader_stages(&stages);
+		return false;
+	}
+
+	struct pack_shader header = { .magic = pack_shader_magic };
+
+	u64 cooked_size = sizeof(header);
+	for (u32 i = 0; i < shader_stage_count; i++) {
+		header.sizes[i] = stages.sources[i] ? (u32)strlen(stages.sources[i]) + 1 : 0;
+		cooked_size += header.sizes[i];
+	}
+
+	u8* cooked = core_alloc(cooked_size);
+	memcpy(cooked, &header, sizeof(header));
+
+	u64 offset = sizeof(header);
+	for (u32 i = 0; i < shader_stage_count; i++) {
+		if (header.sizes[i] == 0) { continue; }
+
+		memcpy(cooked + offset, stages.sources[i], header.sizes[i]);
+		offset += header.sizes[i];
+	}
+
+	make_pack_item(item, path, cooked, cooked_size);
+
+	deinit_shader_stages(&stages);
+
+	return true;
+}
+
+static bool has_extension(const char* path, const char* extension) {
+	u64 len = strlen(path);
+	u64 ext_len = strlen(extension);
+	return len > ext_len && strcmp(path + len - ext_len, extension) == 0;
+}
+
+static bool cook_item(struct pack_item* item, const char* path, u8* raw, u64 size) {
+	if (has_extension(path, ".bmp")) {
+		return cook_texture_item(item, path, raw, size);
+	} else if (has_extension(path, ".glsl")) {
+		return cook_shader_item(item, path, raw, size);
+	}
+
+	make_pack_item(item, path, raw, size);
+
+	return true;
+}
+
+/* Bake every image that has the `atlas' option into as few atlases as
+ * it takes to fit them, and add the atlases and the table of regions
+ * to `items'. Returns the new item count. */
+static u32 bake_atlases(struct pack_item* items, u32 item_count) {
+	struct atlas_image* images = core_calloc(file_count, sizeof(struct atlas_image));
+	u32 image_count = 0;
+
+	for (u32 i = 0; i < file_count; i++) {
+		if (!line_has_option(files[i], "atlas")) { continue; }
+
+		char path[256];
+		line_path(files[i], path, sizeof(path));
+
+		u8* raw;
+		u64 size;
+		if (!read_raw_no_pck(path, &raw, &size, false)) {
+			continue;
+		}
+
+		struct atlas_image* image = images + image_count;
+
+		bool ok = decode_bitmap(&image->image, raw, size, sprite_texture);
+		core_free(raw);
+
+		if (!ok) { continue; }
+
+		if (image->image.flags & texture_mono) {
+			fprintf(stderr, "`%s' can't go into an atlas, because it only has one channel.\n", path);
+			deinit_image(&image->image);
+			continue;
+		}
+
+		expand_to_rgba(&image->image);
+
+		if (image->image.width + atlas_padding > pack_atlas_size ||
+			image->image.height + atlas_padding > pack_atlas_size) {
+			fprintf(stderr, "`%s' is too big to go into an atlas.\n", path);
+			deinit_image(&image->image);
+			continue;
+		}
+
+		image->path = copy_string(path);
+		image_count++;
+	}
+
+	if (image_count == 0) {
+		core_free(images);
+		return item_count;
+	}
+
+	stbrp_rect* rects = core_calloc(image_count, sizeof(stbrp_rect));
+	stbrp_node* nodes = core_alloc(pack_atlas_size * sizeof(stbrp_node));
+
+	for (u32 i = 0; i < image_count; i++) {
+		rects[i].id = (i32)i;
+		rects[i].w = (stbrp_coord)(images[i].image.width + atlas_padding);
+		rects[i].h = (stbrp_coord)(images[i].image.height + atlas_padding);
+	}
+
+	/* Fill one atlas at a time, until every image has a place. */
+	u32 atlas_count = 0;
+	u32 remaining = image_count;
+	while (remaining > 0) {
+		stbrp_context context;
+		stbrp_init_target(&context, pack_atlas_size, pack_atlas_size, nodes, pack_atlas_size);
+		stbrp_pack_rects(&context, rects, (i32)remaining);
+
+		u8* pixels = core_calloc(pack_atlas_size * pack_atlas_size, 4);
+
+		u32 left = 0;
+		for (u32 i = 0; i < remaining; i++) {
+			if (!rects[i].was_packed) {
+				rects[left++] = rects[i];
+				continue;
+			}
+
+			struct atlas_image* image = images + rects[i].id;
+
+			image->region = (struct pack_atlas_region) {
+				.hash = pack_hash(image->path),
+				.atlas = atlas_count,
+				.x = (u32)rects[i].x,
+				.y = (u32)rects[i].y,
+				.w = image->image.width,
+				.h = image->image.height
+			};
+
+			for (u32 y = 0; y < image->image.height; y++) {
+				memcpy(pixels + ((u64)(image->region.y + y) * pack_atlas_size + image->region.x) * 4,
+					image->image.pixels + (u64)y * image->image.width * 4,
+					image->image.width * 4);
+			}
+		}
+
+		remaining = left;
+
+		char atlas_path[64];
+		sprintf(atlas_path, pack_atlas_path, atlas_count);
+
+		u64 cooked_size;
+		u8* cooked = cook_texture(pixels, pack_atlas_size, pack_atlas_size, &cooked_size);
+		make_pack_item(items + item_count++, atlas_path, cooked, cooked_size);
+
+		core_free(pixels);
+
+		atlas_count++;
+	}
+
+	struct pack_atlas_region* regions = core_alloc(image_count * sizeof(struct pack_atlas_region));
+	for (u32 i = 0; i < image_count; i++) {
+		regions[i] = images[i].region;
+	}
+
+	qsort(regions, image_count, sizeof(struct pack_atlas_region), region_cmp);
+
+	make_pack_item(items + item_count++, pack_atlas_map_path, (u8*)regions, image_count * sizeof(struct pack_atlas_region));
+
+	printf("Baked %u images into %u atlas(es).\n", image_count, atlas_count);
+
+	for (u32 i = 0; i < image_count; i++) {
+		core_free(images[i].path);
+		deinit_image(&images[i].image);
+	}
+
+	core_free(nodes);
+	core_free(rects);
+	core_free(images);
+
+	return item_count;
+}
+
+static void write_padding(FILE* out, u64 offset) {
+	static const u8 zeroes[pack_alignment] = { 0 };
+
+	u64 cur = (u64)ftell(out);
+	if (cur < offset) {
+		fwrite(zeroes, 1, offset - cur, out);
+	}
+}
+
+/* The manifest sits next to the package, and records what every line
+ * of `packed.include' looked like when the package was made, so that
+ * the next run only has to redo what changed. Entries that are
+ * generated from several files, like the atlases, are recorded under
+ * their own path prefixed with `@', with the combined hash of their
+ * inputs.
+ *
+ * The manifest is only trusted if the package is still the size that
+ * it was when the manifest was written. */
+
+#define manifest_magic "OMVM"
+#define manifest_version 1
+
+struct manifest_header {
+	char magic[4];
+	u32 version;
+	u64 package_size;
+	u64 record_count;
+};
+
+/* Records are stored as the length of the line, the line, and then
+ * the rest of this struct. */
+struct manifest_record {
+	char* line;
+	u64 mtime;
+	u64 content_hash;
+
+	/* The entry that the line produced, if any. Its hash is zero for
+	 * lines that don't produce an entry by themselves. */
+	struct pack_entry entry;
+};
+
+struct manifest {
+	u64 package_size;
+
+	/* When the manifest was written. */
+	u64 mod_time;
+
+	struct manifest_record* records;
+	u64 record_count;
+
+	/* Maps lines to indices into `records'. */
+	struct table* index;
+};
+
+static bool read_bytes(const u8** cur, const u8* end, void* dst, u64 size) {
+	if ((u64)(end - *cur) < size) { return false; }
+
+	memcpy(dst, *cur, size);
+	*cur += size;
+
+	return true;
+}
+
+static void free_manifest(struct manifest* manifest) {
+	for (u64 i = 0; i < manifest->record_count; i++) {
+		core_free(manifest->records[i].line);
+	}
+
+	core_free(manifest->records);
+
+	if (manifest->index) {
+		free_table(manifest->index);
+	}
+
+	*manifest = (struct manifest) { 0 };
+}
+
+static bool load_manifest(struct manifest* manifest, const char* path) {
+	*manifest = (struct manifest) { 0 };
+
+	if (!file_exists(path)) { return false; }
+
+	u8* data;
+	u64 size;
+	if (!read_raw_no_pck(path, &data, &size, false)) {
+		return false;
+	}
+
+	const u8* cur = data;
+	const u8* end = data + size;
+
+	struct manifest_header header;
+	bool ok = read_bytes(&cur, end, &header, sizeof(header)) &&
+		memcmp(header.magic, manifest_magic, sizeof(header.magic)) == 0 &&
+		header.version == manifest_version &&
+		header.record_count <= size;
+
+	if (ok) {
+		manifest->package_size = header.package_size;
+		manifest->mod_time = file_mod_time(path);
+		manifest->records = core_calloc(header.record_count, sizeof(struct manifest_record));
+		manifest->index = new_table(sizeof(u64));
+	}
+
+	for (u64 i = 0; ok && i < header.record_count; i++) {
+		struct manifest_record* record = manifest->records + i;
+
+		u32 line_len;
+		ok = read_bytes(&cur, end, &line_len, sizeof(line_len)) && (u64)(end - cur) >= line_len;
+		if (!ok) { break; }
+
+		record->line = core_alloc(line_len + 1);
+		read_bytes(&cur, end, record->line, line_len);
+		record->line[line_len] = '\0';
+
+		manifest->record_count++;
+
+		ok = read_bytes(&cur, end, &record->mtime, sizeof(record->mtime)) &&
+			read_bytes(&cur, end, &record->content_hash, sizeof(record->content_hash)) &&
+			read_bytes(&cur, end, &record->entry, sizeof(record->entry));
+
+		table_set(manifest->index, record->line, &i);
+	}
+
+	core_free(data);
+
+	if (!ok) {
+		fprintf(stderr, "`%s' is corrupt; Ignoring it.\n", path);
+		free_manifest(manifest);
+	}
+
+	return ok;
+}
+
+static const struct manifest_record* find_record(const struct manifest* manifest, const char* line) {
+	if (!manifest->index) { return null; }
+
+	/* Values in the table aren't necessarily aligned. */
+	const void* value = table_get(manifest->index, line);
+	if (!value) { return null; }
+
+	u64 index;
+	memcpy(&index, value, sizeof(index));
+
+	return manifest->records + index;
+}
+
+/* Modification times only have a resolution of a second on some
+ * platforms, so a file that was changed in the same second that the
+ * manifest was written might not look any different afterwards. Those
+ * are always hashed. */
+static bool unchanged_since(const struct manifest* manifest, const struct manifest_record* record, u64 mtime) {
+	return record && record->mtime == mtime && mtime < manifest->mod_time;
+}
+
+static bool save_manifest(const char* path, u64 package_size, const struct manifest_record* records, u64 count) {
+	FILE* file = fopen(path, "wb");
+	if (!file) {
+		fprintf(stderr, "Failed to open `%s' for writing.\n", path);
+		return false;
+	}
+
+	struct manifest_header header = {
+		.magic = manifest_magic,
+		.version = manifest_version,
+		.package_size = package_size,
+		.record_count = count
+	};
+
+	fwrite(&header, sizeof(header), 1, file);
+
+	for (u64 i = 0; i < count; i++) {
+		u32 line_len = (u32)strlen(records[i].line);
+		fwrite(&line_len, sizeof(line_len), 1, file);
+		fwrite(records[i].line, 1, line_len, file);
+		fwrite(&records[i].mtime, sizeof(records[i].mtime), 1, file);
+		fwrite(&records[i].content_hash, sizeof(records[i].content_hash), 1, file);
+		fwrite(&records[i].entry, sizeof(records[i].entry), 1, file);
+	}
+
+	fclose(file);
+
+	return true;
+}
+
+/* The previous package, which unchanged entries are copied from. */
+struct old_package {
+	struct file_mapping* mapping;
+	const u8* data;
+	u64 size;
+};
+
+static bool reuse_entry(struct pack_item* item, const char* path, const struct pack_entry* entry,
+	const struct old_package* old) {
+
+	if (!old->mapping || entry->hash != pack_hash(path) || entry->offset + entry->size > old->size) {
+		return false;
+	}
+
+	item->path = copy_string(path);
+	item->entry = *entry;
+	item->data = (u8*)old->data + entry->offset;
+	item->borrowed = true;
+
+	return true;
+}
+
+static u64 combine_hash(u64 hash, u64 value) {
+	return hash ^ (value + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2));
+}
+
+/* Some lines make more entries than just the file itself, such as the
+ * resource manifests and cooked rooms of maps, and the glyph sets of
+ * fonts. These are recorded in the manifest under their own path
+ * prefixed with `+', keyed on the content of the file and the options
+ * on its line. */
+#define max_extras 16
+
+struct pack_extra {
+	char path[300];
+	u64 key;
+
+	struct pack_item item;
+	bool ok;
+	bool reused;
+};
+
+struct pack_task {
+	struct job job;
+
+	const char* line;
+	char path[256];
+	const struct manifest* manifest;
+	const struct manifest_record* record;
+	const struct old_package* old;
+
+	u64 mtime;
+	u64 content_hash;
+
+	struct pack_item item;
+	bool ok;
+	bool reused;
+
+	struct pack_extra extras[max_extras];
+	u32 extra_count;
+};
+
+/* Get every `<option>=<n>' on a line. */
+static u32 line_option_values(const char* line, const char* option, u32* values, u32 max) {
+	u64 option_len = strlen(option);
+	u32 count = 0;
+
+	const char* cur = strchr(line, ' ');
+	while (cur && count < max) {
+		cur++;
+
+		if (strncmp(cur, option, option_len) == 0 && cur[option_len] == '=') {
+			values[count++] = (u32)strtoul(cur + option_len + 1, null, 10);
+		}
+
+		cur = strchr(cur, ' ');
+	}
+
+	return count;
+}
+
+static void add_extra(struct pack_task* task, const char* format, ...) {
+	if (task->extra_count >= max_extras) { return; }
+
+	struct pack_extra* extra = task->extras + task->extra_count++;
+
+	va_list args;
+	va_start(args, format);
+	vsnprintf(extra->path, sizeof(extra->path), format, args);
+	va_end(args);
+}
+
+static void list_extras(struct pack_task* task) {
+	if (has_extension(task->path, ".dat")) {
+		add_extra(task, "%s" map_manifest_ext, task->path);
+		add_extra(task, "%s" room_blob_ext, task->path);
+	}
+
+	if (has_extension(task->path, ".ttf")) {
+		u32 sizes[max_extras];
+		u32 size_count = line_option_values(task->line, "size", sizes, max_extras);
+
+		for (u32 i = 0; i < size_count; i++) {
+			add_extra(task, pack_font_path, task->path, sizes[i]);
+		}
+	}
+}
+
+static bool cook_extra(struct pack_task* task, struct pack_extra* extra, const u8* raw, u64 size) {
+	if (has_extension(extra->path, map_manifest_ext)) {
+		char* text = cook_map_manifest(raw, size);
+		make_pack_item(&extra->item, extra->path, (u8*)text, strlen(text));
+		return true;
+	}
+
+	if (has_extension(extra->path, room_blob_ext)) {
+		u64 cooked_size;
+		u8* cooked = cook_room(raw, size, &cooked_size);
+		if (!cooked) {
+			fprintf(stderr, "Failed to cook `%s'.\n", extra->path);
+			return false;
+		}
+
+		make_pack_item(&extra->item, extra->path, cooked, cooked_size);
+		return true;
+	}
+
+	/* Everything else is a font size. */
+	u32 font_size = (u32)strtoul(strrchr(extra->path, '@') + 1, null, 10);
+
+	u32 pages[max_extras];
+	u32 page_count = line_option_values(task->line, "page", pages, max_extras);
+	if (page_count == 0) {
+		pages[page_count++] = 0;
+	}
+
+	u64 cooked_size;
+	u8* cooked = cook_font((void*)raw, size, (f32)font_size, pages, page_count, &cooked_size);
+	if (!cooked) {
+		fprintf(stderr, "Failed to bake `%s'.\n", extra->path);
+		return false;
+	}
+
+	make_pack_item(&extra->item, extra->path, cooked, cooked_size);
+	return true;
+}
+
+/* Reuse or cook the extra entries of a task. `raw' is read if any of
+ * them have to be cooked, and it hasn't been already. */
+static void pack_extras(struct pack_task* task, u8** raw, u64* size) {
+	u64 line_hash = fnv1a_hash((const u8*)task->line, strlen(task->line));
+
+	for (u32 i = 0; i < task->extra_count; i++) {
+		struct pack_extra* extra = task->extras + i;
+		extra->key = combine_hash(task->content_hash, line_hash);
+
+		/* Rooms have to be cooked again when their format changes. */
+		if (has_extension(extra->path, room_blob_ext)) {
+			extra->key = combine_hash(extra->key, room_blob_version);
+		}
+
+		char line[310];
+		snprintf(line, sizeof(line), "+%s", extra->path);
+
+		const struct manifest_record* record = find_record(task->manifest, line);
+		if (record && record->content_hash == extra->key &&
+			reuse_entry(&extra->item, extra->path, &record->entry, task->old)) {
+			extra->ok = extra->reused = true;
+			continue;
+		}
+
+		if (!*raw && !read_raw_no_pck(task->path, raw, size, false)) {
+			return;
+		}
+
+		extra->ok = cook_extra(task, extra, *raw, *size);
+	}
+}
+
+/* Packs one line of `packed.include'. Runs on the job pool. */
+static void pack_task_func(struct job* job) {
+	struct pack_task* task = job->udata;
+
+	const struct manifest_record* record = task->record;
+
+	list_extras(task);
+
+	u8* raw = null;
+	u64 size = 0;
+
+	/* Files that haven't been touched aren't even read. */
+	task->mtime = file_mod_time(task->path);
+	if (unchanged_since(task->manifest, record, task->mtime) &&
+		reuse_entry(&task->item, task->path, &record->entry, task->old)) {
+		task->content_hash = record->content_hash;
+		task->reused = true;
+	} else {
+		if (!read_raw_no_pck(task->path, &raw, &size, false)) {
+			return;
+		}
+
+		task->content_hash = fnv1a_hash(raw, size);
+
+		task->reused = record && record->content_hash == task->content_hash &&
+			reuse_entry(&task->item, task->path, &record->entry, task->old);
+	}
+
+	pack_extras(task, &raw, &size);
+
+	if (task->reused) {
+		core_free(raw);
+		task->ok = true;
 		return;
 	}
 
-	u64 header_size = file_count * (sizeof(u64) * 3) + sizeof(u64);
-	u64 cur_size = header_size;
+	/* The file might have been read for its extras. */
+	if (!raw && !read_raw_no_pck(task->path, &raw, &size, false)) {
+		return;
+	}
+
+	task->ok = cook_item(&task->item, task->path, raw, size);
+}
+
+static void set_progress(struct mutex* progress_mutex, i32 progress, const char* name) {
+	if (!progress_mutex) { return; }
+
+	lock_mutex(progress_mutex);
+	*(i32*)mutex_get_ptr(progress_mutex) = progress;
+	strcpy(current_file, name);
+	unlock_mutex(progress_mutex);
+}
+
+static struct pack_item* find_item(struct pack_item* items, u32 count, u64 hash) {
+	u32 low = 0, high = count;
+
+	while (low < high) {
+		u32 mid = low + (high - low) / 2;
+
+		if (items[mid].entry.hash < hash) {
+			low = mid + 1;
+		} else if (items[mid].entry.hash > hash) {
+			high = mid;
+		} else {
+			return items + mid;
+		}
+	}
+
+	return null;
+}
+
+/* Entries are laid out in the order that they were first read in
+ * a trace recorded by the resource manager (see `res.h'), so that
+ * starting the game and loading a room read the package from front
+ * to back. Accesses are grouped by room first, so that a room that
+ * was visited in several sessions still ends up in one place.
+ * Entries that aren't in the trace go at the end, in index order. */
+
+struct trace_line {
+	u32 group;
+	u32 index;
+	const char* path;
+};
+
+static i32 trace_line_cmp(const void* a, const void* b) {
+	const struct trace_line* x = a;
+	const struct trace_line* y = b;
+
+	if (x->group != y->group) {
+		return x->group < y->group ? -1 : 1;
+	}
+
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/* Images that were baked into atlases are traced under their own
+ * paths, and placed with the atlas that they ended up in. */
+static struct pack_atlas_region* load_regions(struct pack_item* items, u32 item_count, u64* count) {
+	*count = 0;
+
+	struct pack_item* item = find_item(items, item_count, pack_hash(pack_atlas_map_path));
+	if (!item) { return null; }
+
+	u8* raw = core_alloc(item->entry.raw_size);
+
+	if (item->entry.flags & pack_entry_compressed) {
+		if (!lz_decompress(item->data, item->entry.size, raw, item->entry.raw_size)) {
+			core_free(raw);
+			return null;
+		}
+	} else {
+		memcpy(raw, item->data, item->entry.raw_size);
+	}
+
+	*count = item->entry.raw_size / sizeof(struct pack_atlas_region);
+
+	return (struct pack_atlas_region*)raw;
+}
+
+static struct pack_item* find_traced_item(struct pack_item* items, u32 item_count, const char* path,
+	struct pack_atlas_region* regions, u64 region_count) {
+
+	u64 hash = pack_hash(path);
+
+	struct pack_item* item = find_item(items, item_count, hash);
+	if (item) { return item; }
+
+	struct pack_atlas_region* region = pack_find_region(regions, region_count, hash);
+	if (!region) { return null; }
+
+	char atlas_path[64];
+	snprintf(atlas_path, sizeof(atlas_path), pack_atlas_path, region->atlas);
+
+	return find_item(items, item_count, pack_hash(atlas_path));
+}
+
+/* Fill `order' with the indices of the items, sorted by hash, in the
+ * order that they should be laid out in. Returns how many of them
+ * were in the trace. */
+static u32 order_items(struct pack_item* items, u32 item_count, const char* trace_path, u32* order) {
+	u32* ranks = core_alloc(item_count * sizeof(u32));
+	for (u32 i = 0; i < item_count; i++) {
+		ranks[i] = UINT32_MAX;
+	}
+
+	u32 traced_count = 0;
+
+	char* text;
+	if (trace_path && file_exists(trace_path) && read_raw_no_pck(trace_path, (u8**)&text, null, true)) {
+		/* Group zero is whatever is read before the first group starts,
+		 * which is usually the start up of the game. */
+		struct table* groups = new_table(sizeof(u32));
+		u32 group_count = 1;
+		u32 group = 0;
+
+		vector(struct trace_line) lines = null;
+
+		for (char* line = text; *line;) {
+			u64 len = strcspn(line, "\r\n");
+			char* next = line + len;
+			next += strspn(next, "\r\n");
+			line[len] = '\0';
+
+			if (line[0] == '>') {
+				const char* name = line + 1 + strspn(line + 1, " ");
+
+				const void* value = table_get(groups, name);
+				if (value) {
+					memcpy(&group, value, sizeof(group));
+				} else {
+					group = group_count++;
+					table_set(groups, name, &group);
+				}
+			} else if (line[0]) {
+				struct trace_line tl = { .group = group, .index = vector_count(lines), .path = line };
+				vector_push(lines, tl);
+			}
+
+			line = next;
+		}
+
+		qsort(lines, vector_count(lines), sizeof(struct trace_line), trace_line_cmp);
+
+		u64 region_count;
+		struct pack_atlas_region* regions = load_regions(items, item_count, &region_count);
+
+		for (u32 i = 0; i < vector_count(lines); i++) {
+			struct pack_item* item = find_traced_item(items, item_count, lines[i].path, regions, region_count);
+
+			if (item && ranks[item - items] == UINT32_MAX) {
+				ranks[item - items] = traced_count++;
+			}
+		}
+
+		core_free(regions);
+		free_vector(lines);
+		free_table(groups);
+		core_free(text);
+	}
+
+	u32 next_rank = traced_count;
+	for (u32 i = 0; i < item_count; i++) {
+		if (ranks[i] == UINT32_MAX) {
+			ranks[i] = next_rank++;
+		}
+
+		order[ranks[i]] = i;
+	}
+
+	core_free(ranks);
+
+	return traced_count;
+}
+
+/* Write a package from the lines in `files'. Unless `force' is set,
+ * anything that hasn't changed since the last run is copied from the
+ * previous package, rather than being read, cooked and compressed
+ * again. `trace_path' and `progress_mutex' are optional. */
+static bool pack_files(const char* package_path, const char* trace_path, struct mutex* progress_mutex, bool force) {
+	u64 start_time = get_time();
+
+	set_progress(progress_mutex, 0, "");
+
+	char manifest_path[300];
+	snprintf(manifest_path, sizeof(manifest_path), "%s.manifest", package_path);
+
+	char temp_path[300];
+	snprintf(temp_path, sizeof(temp_path), "%s.tmp", package_path);
+
+	struct manifest manifest = { 0 };
+	struct old_package old = { 0 };
+
+	if (!force && load_manifest(&manifest, manifest_path)) {
+		const void* data;
+		old.mapping = map_file(package_path, &data, &old.size);
+		old.data = data;
+
+		if (old.mapping && old.size != manifest.package_size) {
+			unmap_file(old.mapping);
+			old = (struct old_package) { 0 };
+		}
+
+		if (!old.mapping) {
+			free_manifest(&manifest);
+		}
+	}
+
+	/* Every atlased image could, at worst, end up in an atlas of its
+	 * own, plus there is the table of regions. */
+	u32 item_capacity = file_count * 2 + 1;
+	struct pack_item* items = core_calloc(item_capacity, sizeof(struct pack_item));
+	u32 item_count = 0;
 
-	fwrite(&header_size, sizeof(header_size), 1, out);
+	vector(struct manifest_record) records = null;
+
+	/* Atlases are baked from all of their images at once, so they are
+	 * rebaked if any one of them changes. */
+	u64 atlas_key = 0;
+	bool has_atlas = false;
+
+	u32 reused_count = 0;
 
 	for (u32 i = 0; i < file_count; i++) {
-		u64 hash = elf_hash((const u8*)files[i], (u32)strlen(files[i]));
+		if (!line_has_option(files[i], "atlas")) { continue; }
+
+		char path[256];
+		line_path(files[i], path, sizeof(path));
+
+		struct manifest_record record = {
+			.line = copy_string(files[i]),
+			.mtime = file_mod_time(path)
+		};
+
+		const struct manifest_record* old_record = find_record(&manifest, files[i]);
+		if (unchanged_since(&manifest, old_record, record.mtime)) {
+			record.content_hash = old_record->content_hash;
+		} else {
+			u8* raw;
+			u64 size;
+			if (read_raw_no_pck(path, &raw, &size, false)) {
+				record.content_hash = fnv1a_hash(raw, size);
+				core_free(raw);
+			}
+		}
 
-		FILE* file = fopen(files[i], "rb");
-		if (!file) { continue; }
+		atlas_key = combine_hash(atlas_key, fnv1a_hash((const u8*)files[i], strlen(files[i])));
+		atlas_key = combine_hash(atlas_key, record.content_hash);
+		has_atlas = true;
 
-		fseek(file, 0, SEEK_END);
+		vector_push(records, record);
+	}
 
-		u64 size = ftell(file);
+	if (has_atlas) {
+		set_progress(progress_mutex, 0, "Atlases");
 
-		fwrite(&hash, sizeof(hash), 1, out);
-		fwrite(&cur_size, sizeof(cur_size), 1, out);
-		fwrite(&size, sizeof(size), 1, out);
+		u32 first = item_count;
 
-		cur_size += size;
+		const struct manifest_record* map_record = find_record(&manifest, "@" pack_atlas_map_path);
+		if (map_record && map_record->content_hash == atlas_key) {
+			for (u64 i = 0; i < manifest.record_count; i++) {
+				const struct manifest_record* record = manifest.records + i;
+				if (record->line[0] != '@') { continue; }
 
-		fclose(file);
+				if (reuse_entry(items + item_count, record->line + 1, &record->entry, &old)) {
+					item_count++;
+					reused_count++;
+				}
+			}
+		} else {
+			item_count = bake_atlases(items, item_count);
+		}
+
+		for (u32 i = first; i < item_count; i++) {
+			char line[256];
+			snprintf(line, sizeof(line), "@%s", items[i].path);
+
+			struct manifest_record record = {
+				.line = copy_string(line),
+				.content_hash = atlas_key,
+				.entry.hash = items[i].entry.hash
+			};
+
+			vector_push(records, record);
+		}
 	}
 
-	lock_mutex(get_thread_uptr(thread));
+	/* Everything else is independent, so it is spread over a pool of
+	 * workers. */
+	struct pack_task* tasks = core_calloc(file_count, sizeof(struct pack_task));
+
+	u32 worker_count = get_cpu_count();
+	struct job_pool* pool = new_job_pool(worker_count > 0 ? worker_count : 1);
+
+	for (u32 i = 0; i < file_count; i++) {
+		/* Images in atlases aren't stored by themselves. */
+		if (line_has_option(files[i], "atlas")) { continue; }
+
+		struct pack_task* task = tasks + i;
+
+		task->line = files[i];
+		line_path(files[i], task->path, sizeof(task->path));
+		task->manifest = &manifest;
+		task->record = find_record(&manifest, files[i]);
+		task->old = &old;
+		task->job = (struct job) { .func = pack_task_func, .udata = task };
+
+		job_submit(pool, &task->job);
+	}
 
 	for (u32 i = 0; i < file_count; i++) {
-		*pack_progress = (i32)(((f32)i / (f32)file_count) * 100.0f);
-		strcpy(current_file, files[i]);
+		if (line_has_option(files[i], "atlas")) { continue; }
 
-		FILE* file = fopen(files[i], "rb");
-		if (!file) { continue; }
+		set_progress(progress_mutex, (i32)(((f32)i / (f32)file_count) * 100.0f), files[i]);
 
-		fseek(file, 0, SEEK_END);
-		u64 file_size = ftell(file);
-		fseek(file, 0, SEEK_SET);
+		struct pack_task* task = tasks + i;
+		job_wait(pool, &task->job);
 
-		for (u64 ii = 0; ii < file_size; ii++) {
-			u64 read = fread(buffer, 1, buffer_size, file);
-			fwrite(buffer, read, 1, out);
+		/* There is room for at least one more item per line already. */
+		u32 needed = item_count + 1 + task->extra_count;
+		if (needed > item_capacity) {
+			item_capacity = needed * 2;
+			items = core_realloc(items, item_capacity * sizeof(struct pack_item));
 		}
 
-		fclose(file);
+		for (u32 ii = 0; ii < task->extra_count; ii++) {
+			struct pack_extra* extra = task->extras + ii;
+			if (!extra->ok) { continue; }
+
+			reused_count += extra->reused;
+
+			items[item_count++] = extra->item;
+
+			char line[310];
+			snprintf(line, sizeof(line), "+%s", extra->path);
+
+			struct manifest_record record = {
+				.line = copy_string(line),
+				.content_hash = extra->key,
+				.entry.hash = extra->item.entry.hash
+			};
+
+			vector_push(records, record);
+		}
+
+		if (!task->ok) { continue; }
+
+		reused_count += task->reused;
+
+		items[item_count++] = task->item;
+
+		struct manifest_record record = {
+			.line = copy_string(files[i]),
+			.mtime = task->mtime,
+			.content_hash = task->content_hash,
+			.entry.hash = task->item.entry.hash
+		};
+
+		vector_push(records, record);
+	}
+
+	free_job_pool(pool);
+	core_free(tasks);
+
+	bool ok = false;
+	u32* order = null;
+
+	qsort(items, item_count, sizeof(struct pack_item), pack_item_cmp);
+
+	for (u32 i = 1; i < item_count; i++) {
+		if (items[i].entry.hash == items[i - 1].entry.hash) {
+			fprintf(stderr, "`%s' and `%s' have the same hash; Rename one of them.\n",
+				items[i - 1].path, items[i].path);
+			goto end;
+		}
 	}
 
-	unlock_mutex(get_thread_uptr(thread));
+	struct pack_header header = {
+		.magic = pack_magic,
+		.version = pack_version,
+		.entry_count = item_count,
+		.index_offset = sizeof(struct pack_header)
+	};
 
+	order = core_alloc(item_count * sizeof(u32));
+	u32 traced_count = order_items(items, item_count, trace_path, order);
+
+	u64 offset = pack_align(header.index_offset + item_count * sizeof(struct pack_entry));
+	for (u32 i = 0; i < item_count; i++) {
+		struct pack_item* item = items + order[i];
+
+		item->entry.offset = offset;
+		offset = pack_align(offset + item->entry.size);
+	}
+
+	/* The new package is written next to the old one, because reused
+	 * entries are still being read from it. */
+	FILE* out = fopen(temp_path, "wb");
+	if (!out) {
+		fprintf(stderr, "Failed to open `%s' for writing.\n", temp_path);
+		goto end;
+	}
+
+	fwrite(&header, sizeof(header), 1, out);
+
+	for (u32 i = 0; i < item_count; i++) {
+		fwrite(&items[i].entry, sizeof(struct pack_entry), 1, out);
+	}
+
+	for (u32 i = 0; i < item_count; i++) {
+		struct pack_item* item = items + order[i];
+
+		write_padding(out, item->entry.offset);
+		fwrite(item->data, 1, item->entry.size, out);
+	}
+
+	u64 package_size = (u64)ftell(out);
+
+	ok = ferror(out) == 0;
 	fclose(out);
 
-	return;
+	if (!ok) {
+		fprintf(stderr, "Failed to write `%s'.\n", temp_path);
+		remove(temp_path);
+		goto end;
+	}
+
+	for (u32 i = 0; i < vector_count(records); i++) {
+		if (records[i].entry.hash == 0) { continue; }
+
+		struct pack_item* item = find_item(items, item_count, records[i].entry.hash);
+		records[i].entry = item ? item->entry : (struct pack_entry) { 0 };
+	}
+
+	if (old.mapping) {
+		unmap_file(old.mapping);
+		old = (struct old_package) { 0 };
+	}
+
+	/* Renaming over an existing file fails on some platforms. */
+	if (rename(temp_path, package_path) != 0) {
+		remove(package_path);
+
+		if (rename(temp_path, package_path) != 0) {
+			fprintf(stderr, "Failed to replace `%s'.\n", package_path);
+			ok = false;
+			goto end;
+		}
+	}
+
+	save_manifest(manifest_path, package_size, records, vector_count(records));
+
+	printf("Packed %u entries into `%s' (%u reused, %u in trace order) in %.1fms.\n",
+		item_count, package_path, reused_count, traced_count,
+		(f64)(get_time() - start_time) / (f64)get_frequency() * 1000.0);
+
+end:
+	core_free(order);
+
+	for (u32 i = 0; i < item_count; i++) {
+		core_free(items[i].path);
+
+		if (!items[i].borrowed) {
+			core_free(items[i].data);
+		}
+	}
+
+	core_free(items);
+
+	for (u32 i = 0; i < vector_count(records); i++) {
+		core_free(records[i].line);
+	}
+
+	free_vector(records);
+
+	if (old.mapping) {
+		unmap_file(old.mapping);
+	}
 
+	free_manifest(&manifest);
+
+	set_progress(progress_mutex, 100, "");
+
+	return ok;
+}
+
+void pack_files_worker(struct thread* thread) {
+	pack_files(pack_file_buffer, res_trace_path, get_thread_uptr(thread), false);
 }
 
 i32 file_name_cmp(const void* a, const void* b) {
@@ -116,11 +1302,14 @@ void init_file_list() {
 	file_count = 0;
 
 	while (fgets(line, sizeof(line), list_f)) {
-		line[strlen(line) - 1] = '\0';
+		line[strcspn(line, "\r\n")] = '\0';
+
+		char path[256];
+		line_path(line, path, sizeof(path));
 
-		FILE* file = fopen(line, "r");
+		FILE* file = fopen(path, "r");
 		if (!file) {
-			fprintf(stderr, "Failed to open `%s' for reading.\n", line);
+			fprintf(stderr, "Failed to open `%s' for reading.\n", path);
 			continue;
 		}
 
@@ -141,12 +1330,54 @@ bool check_pack_ok() {
 	return false;
 }
 
-i32 main() {
-	buffer = core_calloc(1, buffer_size);
+/* With any arguments, the packer packs everything in `packed.include'
+ * without opening a window, so that it can be run from build scripts:
+ *
+ *    packer [-o <package>] [-t <trace>] [-f]
+ *
+ * `-t' lays the package out using a different trace than
+ * res_trace_path. `-f' ignores the manifest and rebuilds every entry. */
+static i32 run_headless(i32 argc, char** argv) {
+	const char* trace_path = res_trace_path;
+	bool force = false;
+
+	for (i32 i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			snprintf(pack_file_buffer, sizeof(pack_file_buffer), "%s", argv[++i]);
+		} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			trace_path = argv[++i];
+		} else if (strcmp(argv[i], "-f") == 0) {
+			force = true;
+		} else {
+			fprintf(stderr, "Usage: %s [-o <package>] [-t <trace>] [-f]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	init_time();
+	init_file_list();
+
+	bool ok = pack_files(pack_file_buffer, trace_path, null, force);
+
+	for (u32 i = 0; i < file_count; i++) {
+		core_free(files[i]);
+	}
+
+	core_free(files);
+
+	return ok ? 0 : 1;
+}
+
+i32 main(i32 argc, char** argv) {
 	files = core_calloc(1, max_files * sizeof(const char*));
 	file_count = 0;
 
 	strcpy(pack_file_buffer, "res.pck");
+
+	if (argc > 1) {
+		return run_headless(argc, argv);
+	}
+
 	pack_file_ok = check_pack_ok();
 
 	srand((u32)time(null));
@@ -263,7 +1494,6 @@ i32 main() {
 	free_thread(worker);
 	free_mutex(pack_progress_mutex);
 
-	core_free(buffer);
 	core_free(files);
 
 	free_ui_context(ui);
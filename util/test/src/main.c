@@ -4,9 +4,16 @@
 #include "common.h"
 #include "core.h"
 #include "coroutine.h"
+#include "entity.h"
+#include "jobs.h"
 #include "lsp.h"
+#include "lz.h"
 #include "maths.h"
+#include "pack.h"
+#include "physics.h"
+#include "table.h"
 #include "test.h"
+#include "video.h"
 
 static coroutine_decl(test_coroutine)
 	*(i32*)co_udata = 10;
@@ -442,8 +449,588 @@ bool m_m4f_identity() {
 		a.m[3][3] == 1.0f;
 }
 
+bool m_m4f_transform() {
+	m4f a = m4f_scale(m4f_translate(m4f_identity(), make_v3f(10.0f, 20.0f, 0.0f)), make_v3f(2.0f, 3.0f, 1.0f));
+
+	v4f p = m4f_transform(a, make_v4f(1.0f, 1.0f, 0.0f, 1.0f));
+	v4f d = m4f_transform(a, make_v4f(1.0f, 1.0f, 0.0f, 0.0f));
+
+	return
+		p.x == 12.0f && p.y == 23.0f && p.w == 1.0f &&
+		d.x == 2.0f && d.y == 3.0f && d.w == 0.0f;
+}
+
+bool lz_roundtrip() {
+	u8 src[1024];
+	for (u32 i = 0; i < sizeof(src); i++) {
+		src[i] = (u8)((i % 13) * (i / 100));
+	}
+
+	u8 compressed[1100];
+	u64 size = lz_compress(src, sizeof(src), compressed, lz_compress_bound(sizeof(src)));
+	if (size == 0 || size >= sizeof(src)) { return false; }
+
+	u8 dst[1024];
+	if (!lz_decompress(compressed, size, dst, sizeof(dst))) { return false; }
+
+	return memcmp(src, dst, sizeof(src)) == 0 &&
+		!lz_decompress(compressed, size, dst, sizeof(dst) - 1);
+}
+
+bool pack_index_find() {
+	struct pack_entry entries[] = {
+		{ .hash = 3 }, { .hash = 8 }, { .hash = 21 }, { .hash = 40 }
+	};
+
+	return
+		pack_find(entries, 4, 3) == entries + 0 &&
+		pack_find(entries, 4, 21) == entries + 2 &&
+		pack_find(entries, 4, 40) == entries + 3 &&
+		pack_find(entries, 4, 9) == null &&
+		pack_align(1) == pack_alignment &&
+		pack_align(pack_alignment) == pack_alignment &&
+		pack_checksum((const u8*)"Wikipedia", 9) == 0x11e60398;
+}
+
+bool table_churn() {
+	struct table* table = new_table(sizeof(u32));
+
+	/* Adding and deleting keys over and over leaves tombstones
+	 * behind, which mustn't fill up the table. */
+	char key[32];
+	for (u32 i = 0; i < 1000; i++) {
+		sprintf(key, "key%u", i);
+		table_set(table, key, &i);
+		table_delete(table, key);
+	}
+
+	u32 v = 42;
+	table_set(table, "last", &v);
+
+	bool ok = get_table_count(table) == 1 &&
+		*(u32*)table_get(table, "last") == 42 &&
+		table_get(table, "key999") == null;
+
+	free_table(table);
+
+	return ok;
+}
+
+struct test_position {
+	i32 x, y;
+};
+
+struct test_tag {
+	i32 value;
+};
+
+static i32 test_destroy_count;
+
+static void on_test_tag_destroy(struct world* world, entity e, void* component) {
+	test_destroy_count++;
+}
+
+bool entity_move() {
+	struct world* a = new_world();
+	struct world* b = new_world();
+
+	set_component_destroy_func(a, struct test_tag, on_test_tag_destroy);
+	test_destroy_count = 0;
+
+	entity other = new_entity(a);
+	add_componentv(a, other, struct test_position, .x = 1, .y = 2);
+
+	entity e = new_entity(a);
+	add_componentv(a, e, struct test_position, .x = 3, .y = 4);
+	add_componentv(a, e, struct test_tag, .value = 5);
+
+	entity moved = move_entity(a, b, e);
+
+	bool ok = !entity_valid(a, e) && entity_valid(b, moved) &&
+		get_alive_entity_count(a) == 1 && get_alive_entity_count(b) == 1 &&
+		get_component(b, moved, struct test_position)->x == 3 &&
+		get_component(b, moved, struct test_position)->y == 4 &&
+		get_component(b, moved, struct test_tag)->value == 5 &&
+		get_component(a, other, struct test_position)->y == 2 &&
+		test_destroy_count == 0;
+
+	entity back = move_entity(b, a, moved);
+
+	ok = ok && get_component(a, back, struct test_tag)->value == 5 && test_destroy_count == 0;
+
+	destroy_entity(a, back);
+
+	ok = ok && test_destroy_count == 1;
+
+	free_world(a);
+	free_world(b);
+
+	return ok;
+}
+
+bool shader_split() {
+	struct shader_stages stages;
+	split_shader(&stages, copy_string(
+		"#begin VERTEX\n"
+		"void main() {}\n"
+		"#end VERTEX\n"
+		"\n"
+		"#begin FRAGMENT\n"
+		"out vec4 c;\n"
+		"void main() {}\n"
+		"#end FRAGMENT\n"));
+
+	bool ok =
+		strcmp(stages.sources[shader_vertex], "void main() {}\n") == 0 &&
+		strcmp(stages.sources[shader_fragment], "out vec4 c;\nvoid main() {}\n") == 0 &&
+		stages.sources[shader_geometry] == null;
+
+	deinit_shader_stages(&stages);
+
+	return ok;
+}
+
+#include "tiled.h"
+
+#include <stddef.h>
+
+/* Adds a string to the pool of a map, returning its offset. */
+static u32 put_string(char* pool, u32* size, const char* str) {
+	u32 offset = *size;
+
+	strcpy(pool + offset, str);
+	*size += (u32)strlen(str) + 1;
+
+	return offset;
+}
+
+struct test_map {
+	struct map_header header;
+	struct map_property property;
+	struct map_tileset tileset;
+	char strings[64];
+};
+
+bool map_manifest() {
+	struct test_map map = { 0 };
+
+	u32 pool_size = 0;
+	put_string(map.strings, &pool_size, "");
+
+	memcpy(map.header.magic, map_magic, sizeof(map.header.magic));
+	map.header.version = map_version;
+
+	/* One string property, naming a sound. */
+	map.header.properties = (struct map_table) { offsetof(struct test_map, property), 1 };
+	map.header.map_properties = (struct map_range) { 0, 1 };
+	map.property.name = put_string(map.strings, &pool_size, "music");
+	map.property.type = prop_string;
+	map.property.as.string = put_string(map.strings, &pool_size, "res/aud/step.wav");
+
+	/* One tileset. */
+	map.header.tilesets = (struct map_table) { offsetof(struct test_map, tileset), 1 };
+	map.tileset.name = put_string(map.strings, &pool_size, "tiles");
+	map.tileset.image = put_string(map.strings, &pool_size, "res/bmp/tsblue.bmp");
+	map.tileset.tile_count = 64;
+	map.tileset.tile_w = 16;
+	map.tileset.tile_h = 16;
+
+	map.header.strings = (struct map_table) { offsetof(struct test_map, strings), pool_size };
+
+	char expected[256];
+	snprintf(expected, sizeof(expected), "audio res/aud/step.wav 0\ntexture res/bmp/tsblue.bmp %u\n", sprite_texture);
+
+	char* text = cook_map_manifest((u8*)&map, sizeof(map));
+	bool ok = strcmp(text, expected) == 0;
+	core_free(text);
+
+	/* Truncated maps must be rejected, rather than read past their end. */
+	text = cook_map_manifest((u8*)&map, offsetof(struct test_map, strings) + 4);
+	ok = ok && text[0] == '\0';
+	core_free(text);
+
+	return ok;
+}
+
+struct test_property_map {
+	struct map_header header;
+	struct map_property properties[4];
+	struct map_layer layer;
+	struct map_object object;
+	char strings[96];
+};
+
+bool map_properties() {
+	struct test_property_map data = { 0 };
+
+	u32 pool_size = 0;
+	put_string(data.strings, &pool_size, "");
+
+	memcpy(data.header.magic, map_magic, sizeof(data.header.magic));
+	data.header.version = map_version;
+
+	/* Three properties on the map, out of order, and one on an object. */
+	data.header.properties = (struct map_table) { offsetof(struct test_property_map, properties), 4 };
+	data.header.map_properties = (struct map_range) { 0, 3 };
+
+	data.properties[0] = (struct map_property) { .name = put_string(data.strings, &pool_size, "speed"),
+		.type = prop_number, .as.number = 2.5 };
+	data.properties[1] = (struct map_property) { .name = put_string(data.strings, &pool_size, "dark"),
+		.type = prop_bool, .as.boolean = 1 };
+	data.properties[2] = (struct map_property) { .name = put_string(data.strings, &pool_size, "music"),
+		.type = prop_string, .as.string = put_string(data.strings, &pool_size, "a.wav") };
+	data.properties[3] = (struct map_property) { .name = put_string(data.strings, &pool_size, "change_to"),
+		.type = prop_string, .as.string = put_string(data.strings, &pool_size, "b.dat") };
+
+	data.header.layers = (struct map_table) { offsetof(struct test_property_map, layer), 1 };
+	data.layer.name = put_string(data.strings, &pool_size, "objects");
+	data.layer.type = layer_objects;
+	data.layer.objects = (struct map_range) { 0, 1 };
+
+	data.header.objects = (struct map_table) { offsetof(struct test_property_map, object), 1 };
+	data.object.shape = object_shape_rect;
+	data.object.properties = (struct map_range) { 3, 1 };
+
+	data.header.strings = (struct map_table) { offsetof(struct test_property_map, strings), pool_size };
+
+	struct tiled_map* map = load_map_from_file((struct file) { .data = (u8*)&data, .size = sizeof(data) }, "test");
+	if (!map) { return false; }
+
+	const struct property* speed = find_property(&map->properties, "speed");
+	const struct property* dark = find_property(&map->properties, "dark");
+	const struct property* music = find_property(&map->properties, "music");
+
+	const struct properties* object = &map->layers[0].as.object_layer.objects[0].properties;
+	const struct property* change_to = find_property(object, "change_to");
+
+	bool ok =
+		speed && speed->type == prop_number && speed->as.number == 2.5 &&
+		dark && dark->type == prop_bool && dark->as.boolean &&
+		music && strcmp(music->as.string, "a.wav") == 0 &&
+		find_property(&map->properties, "change_to") == null &&
+		find_property(&map->layers[0].properties, "speed") == null &&
+		change_to && strcmp(change_to->as.string, "b.dat") == 0 &&
+		find_property(object, "music") == null;
+
+	free_map(map);
+
+	return ok;
+}
+
+bool tile_animation() {
+	struct animated_tile animations[4] = { 0 };
+	u32 animated[] = { 2 };
+
+	struct tileset tileset = {
+		.tile_count = 4,
+		.animations = animations,
+		.animated = animated,
+		.animated_count = 1
+	};
+
+	/* Three frames, lasting 0.1, 0.2 and 0.3 seconds. */
+	struct animated_tile* tile = animations + 2;
+	tile->exists = true;
+	tile->frame_count = 3;
+	tile->ends[0] = 0.1;
+	tile->ends[1] = 0.3;
+	tile->ends[2] = 0.6;
+
+	const f64 times[] = { 0.0, 0.05, 0.15, 0.45, 0.65, 6.25, 6.5 };
+	const u32 expected[] = { 0, 0, 1, 2, 0, 1, 2 };
+
+	for (u32 i = 0; i < sizeof(times) / sizeof(*times); i++) {
+		update_tile_animations(&tileset, times[i]);
+
+		if (tile->current_frame != expected[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool rect_grid_near() {
+	struct rect rects[64];
+
+	/* Rectangles of all sizes, some of them empty, some of them larger
+	 * than a cell, on both sides of zero. */
+	u32 seed = 1;
+	for (u32 i = 0; i < 64; i++) {
+		seed = seed * 1103515245 + 12345;
+		i32 x = (i32)((seed >> 8) % 2000) - 1000;
+		seed = seed * 1103515245 + 12345;
+		i32 y = (i32)((seed >> 8) % 2000) - 1000;
+		seed = seed * 1103515245 + 12345;
+
+		rects[i] = make_rect(x, y, (i32)((seed >> 8) % 300), (i32)((seed >> 16) % 300));
+	}
+
+	struct rect_grid grid;
+	init_rect_grid(&grid, rects, 64, 128);
+
+	bool ok = true;
+
+	for (i32 y = -1200; y < 1200 && ok; y += 37) {
+		for (i32 x = -1200; x < 1200 && ok; x += 41) {
+			struct rect query = make_rect(x, y, 50, 90);
+
+			const u32* near;
+			u32 near_count = rect_grid_query(&grid, query, &near);
+
+			/* Every overlapping rectangle must be found, once and in order. */
+			u32 found = 0;
+			for (u32 i = 0; i < 64; i++) {
+				if (!rect_overlap(query, rects[i], null)) { continue; }
+
+				while (found < near_count && near[found] < i) { found++; }
+
+				if (found == near_count || near[found] != i) {
+					ok = false;
+				}
+			}
+
+			for (u32 i = 1; i < near_count; i++) {
+				ok = ok && near[i - 1] < near[i];
+			}
+		}
+	}
+
+	deinit_rect_grid(&grid);
+
+	v2i normal;
+	ok = ok && rect_overlap(make_rect(0, 0, 10, 10), make_rect(8, 2, 10, 4), &normal) && normal.x == 1 && normal.y == 0;
+	ok = ok && rect_overlap(make_rect(0, 0, 10, 10), make_rect(2, 9, 4, 10), &normal) && normal.x == 0 && normal.y == 1;
+
+	return ok;
+}
+
+/* What solid_map_sweep_x should return, by testing every rectangle. */
+static i32 sweep_x_every_rect(const struct rect* rects, u32 count, struct rect rect, i32 dx) {
+	i32 best = dx > 0 ? dx : -dx;
+
+	for (u32 i = 0; i < count; i++) {
+		const struct rect r = rects[i];
+		if (!(rect.y < r.y + r.h && rect.y + rect.h > r.y)) { continue; }
+
+		i32 distance;
+		if (dx > 0) {
+			if (r.x + r.w <= rect.x + rect.w) { continue; }
+			distance = r.x - (rect.x + rect.w);
+		} else {
+			if (r.x >= rect.x) { continue; }
+			distance = rect.x - (r.x + r.w);
+		}
+
+		distance = distance > 0 ? distance : 0;
+		best = distance < best ? distance : best;
+	}
+
+	return dx > 0 ? best : -best;
+}
+
+bool solid_map_queries() {
+	/* Some rectangles that line up with the tiles, and some that don't. */
+	struct rect rects[] = {
+		{ 0,    0,   256, 64  },
+		{ 256,  0,   64,  320 },
+		{ -100, 200, 90,  30  },
+		{ 40,   130, 13,  200 },
+		{ 100,  100, 64,  64  },
+		{ 130,  120, 100, 10  }
+	};
+
+	const u32 count = sizeof(rects) / sizeof(*rects);
+
+	struct solid_map map;
+	init_solid_map(&map, rects, count, 64);
+
+	bool ok = true;
+
+	for (i32 y = -120; y < 360 && ok; y += 7) {
+		for (i32 x = -120; x < 360 && ok; x += 5) {
+			bool inside = false;
+			for (u32 i = 0; i < count; i++) {
+				inside = inside || (x >= rects[i].x && x < rects[i].x + rects[i].w &&
+					y >= rects[i].y && y < rects[i].y + rects[i].h);
+			}
+
+			ok = solid_map_at(&map, make_v2i(x, y)) == inside;
+		}
+	}
+
+	for (i32 y = -150; y < 400 && ok; y += 23) {
+		for (i32 x = -150; x < 400 && ok; x += 29) {
+			struct rect rect = make_rect(x, y, 20, 30);
+
+			bool overlap = false;
+			for (u32 i = 0; i < count; i++) {
+				overlap = overlap || rect_overlap(rect, rects[i], null);
+			}
+
+			ok = ok && solid_map_overlap(&map, rect) == overlap;
+
+			for (i32 d = -300; d <= 300 && ok; d += 75) {
+				ok = ok && solid_map_sweep_x(&map, rect, d) == sweep_x_every_rect(rects, count, rect, d);
+			}
+		}
+	}
+
+	/* Sweeping along y is sweeping along x, with the axes swapped. */
+	struct rect swapped[sizeof(rects) / sizeof(*rects)];
+	for (u32 i = 0; i < count; i++) {
+		swapped[i] = make_rect(rects[i].y, rects[i].x, rects[i].h, rects[i].w);
+	}
+
+	for (i32 y = -150; y < 400 && ok; y += 31) {
+		for (i32 x = -150; x < 400 && ok; x += 17) {
+			for (i32 d = -300; d <= 300 && ok; d += 75) {
+				ok = ok && solid_map_sweep_y(&map, make_rect(x, y, 30, 20), d) ==
+					sweep_x_every_rect(swapped, count, make_rect(y, x, 20, 30), d);
+			}
+		}
+	}
+
+	deinit_solid_map(&map);
+
+	return ok;
+}
+
 #include "platform.h"
 
+static void add_job(struct job* job) {
+	atomic_add(job->udata, 1);
+}
+
+bool job_pool() {
+	struct job_pool* pool = new_job_pool(2);
+
+	i64 count = 0;
+
+	struct job jobs[16];
+	for (u32 i = 0; i < 16; i++) {
+		jobs[i] = (struct job) { .func = add_job, .udata = &count };
+		job_submit(pool, jobs + i);
+	}
+
+	bool cancelled = job_cancel(pool, jobs + 15);
+
+	for (u32 i = 0; i < 15; i++) {
+		job_wait(pool, jobs + i);
+	}
+
+	free_job_pool(pool);
+
+	return count == (cancelled ? 15 : 16);
+}
+
+static void hold_job(struct job* job) {
+	while (atomic_add(job->udata, 0) == 0) {
+		thread_yield();
+	}
+}
+
+bool job_join_only() {
+	struct job_pool* pool = new_job_pool(1);
+
+	i64 release = 0, count = 0;
+
+	/* Keeps the only worker busy, so that the others stay queued. */
+	struct job hold = { .func = hold_job, .udata = &release };
+	job_submit(pool, &hold);
+
+	struct job jobs[2];
+	for (u32 i = 0; i < 2; i++) {
+		jobs[i] = (struct job) { .func = add_job, .udata = &count };
+		job_submit(pool, jobs + i);
+	}
+
+	job_join(pool, jobs + 1);
+
+	bool ok = job_finished(pool, jobs + 1) && !job_finished(pool, jobs + 0) && count == 1;
+
+	atomic_add(&release, 1);
+	job_wait(pool, jobs + 0);
+
+	free_job_pool(pool);
+
+	return ok && count == 2;
+}
+
+struct busy_state {
+	i64 started;
+	i64 count;
+	i64 seen;
+};
+
+/* Runs for a while on the worker, then records how many of the queued
+ * jobs had already run. Only the waiting thread could have run them. */
+static void busy_job(struct job* job) {
+	struct busy_state* state = job->udata;
+
+	atomic_add(&state->started, 1);
+
+	for (u32 i = 0; i < 10000; i++) {
+		thread_yield();
+	}
+
+	atomic_add(&state->seen, atomic_add(&state->count, 0));
+}
+
+bool job_join_running() {
+	struct job_pool* pool = new_job_pool(1);
+
+	struct busy_state state = { 0 };
+
+	struct job busy = { .func = busy_job, .udata = &state };
+	job_submit(pool, &busy);
+
+	while (atomic_add(&state.started, 0) == 0) {
+		thread_yield();
+	}
+
+	struct job jobs[4];
+	for (u32 i = 0; i < 4; i++) {
+		jobs[i] = (struct job) { .func = add_job, .udata = &state.count };
+		job_submit(pool, jobs + i);
+	}
+
+	job_join(pool, &busy);
+
+	bool ok = job_finished(pool, &busy) && state.seen == 0;
+
+	for (u32 i = 0; i < 4; i++) {
+		job_wait(pool, jobs + i);
+	}
+
+	free_job_pool(pool);
+
+	return ok && state.count == 4;
+}
+
+bool job_drain_all() {
+	struct job_pool* pool = new_job_pool(2);
+
+	i64 count = 0;
+
+	struct job jobs[32];
+	for (u32 i = 0; i < 32; i++) {
+		jobs[i] = (struct job) { .func = add_job, .udata = &count };
+		job_submit(pool, jobs + i);
+	}
+
+	job_drain(pool);
+
+	bool ok = count == 32;
+	for (u32 i = 0; i < 32; i++) {
+		ok = ok && job_finished(pool, jobs + i);
+	}
+
+	free_job_pool(pool);
+
+	return ok;
+}
+
 i32 main() {
 	struct test_func funcs[] = {
 		make_test_func(coroutine),
@@ -485,6 +1072,21 @@ i32 main() {
 		make_test_func(m_v2i_mag),
 		make_test_func(m_make_m4f),
 		make_test_func(m_m4f_identity),
+		make_test_func(m_m4f_transform),
+		make_test_func(lz_roundtrip),
+		make_test_func(pack_index_find),
+		make_test_func(table_churn),
+		make_test_func(entity_move),
+		make_test_func(job_pool),
+		make_test_func(job_join_only),
+		make_test_func(job_join_running),
+		make_test_func(job_drain_all),
+		make_test_func(shader_split),
+		make_test_func(map_manifest),
+		make_test_func(map_properties),
+		make_test_func(tile_animation),
+		make_test_func(rect_grid_near),
+		make_test_func(solid_map_queries),
 	};
 
 	run_tests(funcs, sizeof(funcs) / sizeof(*funcs));